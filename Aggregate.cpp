@@ -0,0 +1,90 @@
+#include "Aggregate.h"
+#include <limits>
+
+Aggregate::Aggregate(): count(0), sum(0),
+    min(std::numeric_limits<double>::infinity()), max(-std::numeric_limits<double>::infinity()) {}
+
+void Aggregate::add(double v){
+    count++;
+    sum += v;
+    if(v < min) min = v;
+    if(v > max) max = v;
+}
+
+void Aggregate::merge(const Aggregate &other){
+    count += other.count;
+    sum += other.sum;
+    if(other.min < min) min = other.min;
+    if(other.max > max) max = other.max;
+}
+
+CoursStats::CoursStats(): ok(false) {}
+
+void CoursStats::invalidate(){
+    byCours.clear();
+    ok = false;
+}
+
+void CoursStats::reset(){
+    byCours.clear();
+    ok = true;
+}
+
+void CoursStats::insert(int cours, double grade){
+    add(cours, grade, 1);
+}
+
+void CoursStats::add(int cours, double grade, long long n){
+    if(!ok || n <= 0) return;
+    Group &g = byCours[cours];
+    g.count += n;
+    g.sum += (long double)grade * n;
+    g.grades[grade] += n;
+}
+
+void CoursStats::erase(int cours, double grade){
+    if(!ok) return;
+    auto it = byCours.find(cours);
+    if(it == byCours.end()){
+        // записи не было в статистике - дальше ей верить нельзя
+        invalidate();
+        return;
+    }
+    Group &g = it->second;
+    auto value = g.grades.find(grade);
+    if(value == g.grades.end()){
+        invalidate();
+        return;
+    }
+    if(--g.count == 0){
+        byCours.erase(it);
+        return;
+    }
+    g.sum -= grade;
+    if(--value->second == 0) g.grades.erase(value);
+}
+
+std::map<int, Aggregate> CoursStats::groups(bool gradeField) const {
+    std::map<int, Aggregate> res;
+    for(const auto &kv: byCours){
+        const Group &g = kv.second;
+        Aggregate a;
+        a.count = g.count;
+        if(gradeField){
+            a.sum = (double)g.sum;
+            a.min = g.grades.begin()->first;
+            a.max = g.grades.rbegin()->first;
+        } else {
+            a.sum = (double)kv.first * (double)g.count;
+            a.min = a.max = kv.first;
+        }
+        res[kv.first] = a;
+    }
+    return res;
+}
+
+Aggregate CoursStats::total(bool gradeField) const {
+    Aggregate res;
+    for(const auto &kv: groups(gradeField)) res.merge(kv.second);
+    return res;
+}
@@ -0,0 +1,50 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <cstddef>
+#include <map>
+
+// count/sum/min/max одного числового поля; avg считается из sum и count
+struct Aggregate {
+    long long count;
+    double sum;
+    double min;
+    double max;
+
+    Aggregate();
+    void add(double v);
+    void merge(const Aggregate &other);
+    double avg() const { return count ? sum / (double)count : 0; }
+};
+
+// Статистика по активным записям с группировкой по cours, поддерживаемая при изменениях.
+// Итоги по всей таблице складываются из групп (курсов немного), поэтому запрос без
+// условия не читает файл. В группе хранится число записей на каждую оценку, поэтому
+// min/max остаются точными и после удалений, а вставка и удаление стоят O(log n).
+class CoursStats {
+    public:
+        CoursStats();
+
+        bool valid() const { return ok; }
+        void invalidate(); // статистика будет построена заново при следующем запросе
+        void reset();      // пустая и точная
+
+        void insert(int cours, double grade);
+        void erase(int cours, double grade);
+        void add(int cours, double grade, long long n); // n записей курса с одной оценкой
+
+        // field - "averageGrade" или "cours"
+        std::map<int, Aggregate> groups(bool gradeField) const;
+        Aggregate total(bool gradeField) const;
+
+    private:
+        struct Group {
+            long long count = 0;
+            long double sum = 0; // long double: меньше накопленной ошибки от вставок и удалений
+            std::map<double, long long> grades; // оценка -> число записей
+        };
+        std::map<int, Group> byCours;
+        bool ok;
+};
+
+#endif
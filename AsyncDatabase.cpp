@@ -0,0 +1,91 @@
+#include "AsyncDatabase.h"
+
+// Отмена, пришедшая после того, как операция уже сделала работу, не отменяет результат:
+// исключение бросается, только если операция ничего не вернула и флаг отмены стоит.
+static void checkCancelled(const std::shared_ptr<Progress> &progress, bool nothingDone){
+    if(nothingDone && progress && progress->cancelled()) throw OperationCancelled();
+}
+
+AsyncDatabase::AsyncDatabase(Database &db, size_t threads): db(db), pool(threads ? threads : 1) {}
+
+std::future<std::vector<Student>> AsyncDatabase::search(const Query &q, std::shared_ptr<Progress> progress){
+    return submit([q, progress](Database &d){
+        std::vector<Student> res = d.search(q, progress.get());
+        checkCancelled(progress, res.empty());
+        return res;
+    });
+}
+
+std::future<size_t> AsyncDatabase::deleteWhere(const Query &q, std::shared_ptr<Progress> progress){
+    return submit([q, progress](Database &d){
+        size_t deleted = d.deleteWhere(q, progress.get());
+        checkCancelled(progress, deleted == 0);
+        return deleted;
+    });
+}
+
+std::future<Aggregate> AsyncDatabase::aggregate(const std::string &field, const Query &q, std::shared_ptr<Progress> progress){
+    return submit([field, q, progress](Database &d){
+        Aggregate out;
+        bool ok = d.aggregate(field, q, out, progress.get());
+        checkCancelled(progress, !ok);
+        if(!ok) throw std::invalid_argument("aggregate: unsupported field " + field);
+        return out;
+    });
+}
+
+std::future<std::map<int, Aggregate>> AsyncDatabase::aggregateByCours(const std::string &field, const Query &q,
+                                                                      std::shared_ptr<Progress> progress){
+    return submit([field, q, progress](Database &d){
+        std::map<int, Aggregate> out;
+        bool ok = d.aggregateByCours(field, q, out, progress.get());
+        checkCancelled(progress, !ok);
+        if(!ok) throw std::invalid_argument("aggregate: unsupported field " + field);
+        return out;
+    });
+}
+
+std::future<bool> AsyncDatabase::backup(const std::string &backupFile, std::shared_ptr<Progress> progress){
+    return submit([backupFile, progress](Database &d){
+        bool ok = d.backup(backupFile, progress.get());
+        checkCancelled(progress, !ok);
+        return ok;
+    });
+}
+
+std::future<bool> AsyncDatabase::restoreFromBackup(const std::string &backupFile, std::shared_ptr<Progress> progress){
+    return submit([backupFile, progress](Database &d){
+        bool ok = d.restoreFromBackup(backupFile, progress.get());
+        checkCancelled(progress, !ok);
+        return ok;
+    });
+}
+
+std::future<bool> AsyncDatabase::backupIncremental(const std::string &deltaFile, std::shared_ptr<Progress> progress){
+    return submit([deltaFile, progress](Database &d){
+        bool ok = d.backupIncremental(deltaFile, progress.get());
+        checkCancelled(progress, !ok);
+        return ok;
+    });
+}
+
+std::future<bool> AsyncDatabase::restoreFromBackup(const std::string &backupFile, const std::vector<std::string> &deltas,
+                                                   std::shared_ptr<Progress> progress){
+    return submit([backupFile, deltas, progress](Database &d){
+        bool ok = d.restoreFromBackup(backupFile, deltas, progress.get());
+        checkCancelled(progress, !ok);
+        return ok;
+    });
+}
+
+std::future<bool> AsyncDatabase::exportCSV(const std::string &csvFile, std::shared_ptr<Progress> progress){
+    return submit([csvFile, progress](Database &d){
+        bool ok = d.exportCSV(csvFile, progress.get());
+        checkCancelled(progress, !ok);
+        return ok;
+    });
+}
+
+std::future<long long> AsyncDatabase::compact(){
+    return submit([](Database &d){ return d.compact(); });
+}
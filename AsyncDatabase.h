@@ -0,0 +1,51 @@
+#ifndef ASYNCDATABASE_H
+#define ASYNCDATABASE_H
+
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include "Database.h"
+
+// Операция прервана через Progress::cancel(); бросается из future::get()
+class OperationCancelled : public std::runtime_error {
+    public:
+        OperationCancelled(): std::runtime_error("operation cancelled") {}
+};
+
+// Асинхронный фасад над Database: операция ставится в очередь собственного пула
+// ввода-вывода и сразу возвращает std::future. По умолчанию в пуле один поток, так что
+// операции выполняются по одной в порядке вызова. Переданный Progress показывает ход
+// операции и позволяет отменить её из любого потока; результат отменённой операции -
+// исключение OperationCancelled, ошибки самой операции возвращаются как в Database.
+class AsyncDatabase {
+    public:
+        explicit AsyncDatabase(Database &db, size_t threads = 1);
+
+        std::future<std::vector<Student>> search(const Query &q, std::shared_ptr<Progress> progress = nullptr);
+        std::future<size_t> deleteWhere(const Query &q, std::shared_ptr<Progress> progress = nullptr);
+        // неподдерживаемое поле - std::invalid_argument
+        std::future<Aggregate> aggregate(const std::string &field, const Query &q,
+                                         std::shared_ptr<Progress> progress = nullptr);
+        std::future<std::map<int, Aggregate>> aggregateByCours(const std::string &field, const Query &q,
+                                                               std::shared_ptr<Progress> progress = nullptr);
+        std::future<bool> backup(const std::string &backupFile, std::shared_ptr<Progress> progress = nullptr);
+        std::future<bool> restoreFromBackup(const std::string &backupFile, std::shared_ptr<Progress> progress = nullptr);
+        std::future<bool> backupIncremental(const std::string &deltaFile, std::shared_ptr<Progress> progress = nullptr);
+        std::future<bool> restoreFromBackup(const std::string &backupFile, const std::vector<std::string> &deltas,
+                                            std::shared_ptr<Progress> progress = nullptr);
+        std::future<bool> exportCSV(const std::string &csvFile, std::shared_ptr<Progress> progress = nullptr);
+        std::future<long long> compact();
+
+        // любая другая операция: submit([](Database &db){ return db.addRecords(...); })
+        template<typename F>
+        auto submit(F f) -> std::future<decltype(f(std::declval<Database&>()))> {
+            Database *target = &db;
+            return pool.submit([target, f]() mutable { return f(*target); });
+        }
+
+    private:
+        Database &db;
+        ThreadPool pool;
+};
+
+#endif
@@ -0,0 +1,441 @@
+#include "BPlusTree.h"
+#include "Checksum.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+
+BPlusTree::BPlusTree(size_t cachePages)
+    : file(PAGE_SIZE, cachePages), openFlag(false), dirtyMarked(false), cleanAtOpen(false) {
+    memset(&meta, 0, sizeof(meta));
+}
+
+BPlusTree::~BPlusTree(){
+    close();
+}
+
+bool BPlusTree::readPage(uint32_t page, void *buf, size_t size){
+    if(!overlayPages.empty()){
+        auto it = overlayPages.find(page);
+        if(it != overlayPages.end()) return overlay.readAt((long long)it->second * PAGE_SIZE, (char*)buf, size);
+    }
+    return file.readAt((long long)page * PAGE_SIZE, (char*)buf, size);
+}
+
+bool BPlusTree::readNode(uint32_t page, Node &n){
+    return readPage(page, &n, sizeof(Node));
+}
+
+bool BPlusTree::writeNode(uint32_t page, const Node &n){
+    return file.writeAt((long long)page * PAGE_SIZE, (const char*)&n, sizeof(Node));
+}
+
+bool BPlusTree::writeMeta(){
+    meta.crc = crc32(&meta, offsetof(Meta, crc));
+    return file.writeAt(0, (const char*)&meta, sizeof(meta));
+}
+
+bool BPlusTree::markDirty(){
+    // до первого изменения после sync() на диске фиксируется clean = 0:
+    // если процесс упадёт, при открытии станет видно, что дерево надо перестроить
+    if(dirtyMarked){return true;}
+    meta.clean = 0;
+    if(!writeMeta() || !file.sync()){return false;}
+    dirtyMarked = true;
+    return true;
+}
+
+uint32_t BPlusTree::allocPage(){
+    return meta.pageCount++;
+}
+
+bool BPlusTree::create(const std::string &path){
+    close();
+    if(!file.createFile(path)){return false;}
+    openFlag = true;
+    if(!clear() || !sync()){
+        close();
+        return false;
+    }
+    cleanAtOpen = true;
+    return true;
+}
+
+bool BPlusTree::loadMeta(long long fileBytes){
+    if(fileBytes < (long long)PAGE_SIZE || !readPage(0, &meta, sizeof(meta))
+       || meta.magic != MAGIC || meta.version != VERSION || meta.crc != crc32(&meta, offsetof(Meta, crc))
+       || (long long)meta.pageCount * (long long)PAGE_SIZE > fileBytes){
+        file.closeFile();
+        overlay.closeFile();
+        overlayPages.clear();
+        memset(&meta, 0, sizeof(meta));
+        return false;
+    }
+    openFlag = true;
+    cleanAtOpen = meta.clean != 0;
+    dirtyMarked = !cleanAtOpen;
+    return true;
+}
+
+bool BPlusTree::open(const std::string &path, bool readOnly){
+    close();
+    if(!file.openFile(path, readOnly)){return false;}
+    return loadMeta(file.size());
+}
+
+bool BPlusTree::openOverlay(const std::string &basePath, const std::string &overlayPath){
+    close();
+    if(!overlay.openFile(overlayPath, true)){return false;}
+    OverlayHeader h;
+    std::vector<uint32_t> list;
+    bool ok = overlay.readAt(0, (char*)&h, sizeof(h)) && h.magic == OVERLAY_MAGIC && h.version == OVERLAY_VERSION;
+    size_t listPages = ok ? (sizeof(h) + (size_t)h.count * sizeof(uint32_t) + PAGE_SIZE - 1) / PAGE_SIZE : 0;
+    ok = ok && overlay.size() >= (long long)(listPages + h.count) * (long long)PAGE_SIZE;
+    if(ok){
+        list.resize(h.count);
+        ok = overlay.readAt(sizeof(h), (char*)list.data(), list.size() * sizeof(uint32_t))
+          && h.crc == crc32(list.data(), list.size() * sizeof(uint32_t), crc32(&h, offsetof(OverlayHeader, crc)));
+    }
+    if(!ok || !file.openFile(basePath, true)){
+        overlay.closeFile();
+        return false;
+    }
+    // страницы, появившиеся после копии, есть только в наложении
+    long long bytes = file.size();
+    for(size_t i = 0; i < list.size(); i++){
+        overlayPages[list[i]] = (uint32_t)(listPages + i);
+        bytes = std::max(bytes, ((long long)list[i] + 1) * (long long)PAGE_SIZE);
+    }
+    return loadMeta(bytes);
+}
+
+bool BPlusTree::writeOverlay(const std::string &path, uint64_t base, const std::vector<uint64_t> &pages){
+    if(!openFlag){return false;}
+    OverlayHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = OVERLAY_MAGIC;
+    h.version = OVERLAY_VERSION;
+    h.base = base;
+    h.count = (uint32_t)pages.size();
+    std::vector<uint32_t> list(pages.begin(), pages.end());
+    h.crc = crc32(list.data(), list.size() * sizeof(uint32_t), crc32(&h, offsetof(OverlayHeader, crc)));
+    size_t listBytes = sizeof(h) + list.size() * sizeof(uint32_t);
+    std::vector<char> page((listBytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE, 0);
+    memcpy(page.data(), &h, sizeof(h));
+    memcpy(page.data() + sizeof(h), list.data(), list.size() * sizeof(uint32_t));
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    if(!ofs.write(page.data(), page.size())){return false;}
+    page.assign(PAGE_SIZE, 0);
+    for(uint32_t p: list){
+        // последняя страница файла может быть неполной
+        long long offset = (long long)p * PAGE_SIZE;
+        size_t n = (size_t)std::max<long long>(0, std::min<long long>(PAGE_SIZE, file.size() - offset));
+        std::fill(page.begin() + n, page.end(), 0);
+        if(!file.readAt(offset, page.data(), n) || !ofs.write(page.data(), PAGE_SIZE)){return false;}
+    }
+    ofs.close();
+    return !ofs.fail();
+}
+
+bool BPlusTree::overlayBase(const std::string &path, uint64_t &base){
+    std::ifstream ifs(path, std::ios::binary);
+    OverlayHeader h;
+    if(!ifs.read((char*)&h, sizeof(h)) || h.magic != OVERLAY_MAGIC || h.version != OVERLAY_VERSION){return false;}
+    base = h.base;
+    return true;
+}
+
+void BPlusTree::close(){
+    if(!openFlag) return;
+    file.closeFile();
+    overlay.closeFile();
+    overlayPages.clear();
+    openFlag = false;
+    dirtyMarked = false;
+}
+
+bool BPlusTree::isTreeFile(const std::string &path){
+    std::ifstream ifs(path, std::ios::binary);
+    uint32_t magic = 0;
+    return ifs.read((char*)&magic, sizeof(magic)) && magic == MAGIC;
+}
+
+bool BPlusTree::clear(){
+    return build({});
+}
+
+void BPlusTree::setDataStamp(uint64_t generation, uint64_t records){
+    if(meta.dataGeneration == generation && meta.dataRecords == records){return;}
+    meta.dataGeneration = generation;
+    meta.dataRecords = records;
+    // на диске остаётся прежняя отметка, пока sync() не запишет метаданные
+    meta.clean = 0;
+}
+
+bool BPlusTree::sync(){
+    if(!openFlag){return false;}
+    if(!file.sync()){return false;}
+    if(meta.clean){return true;}
+    meta.clean = 1;
+    if(!writeMeta() || !file.sync()){return false;}
+    dirtyMarked = false;
+    return true;
+}
+
+bool BPlusTree::findLeaf(int key, uint32_t &page, Node &n){
+    page = meta.root;
+    for(uint32_t level = 0; level <= meta.height; level++){
+        if(!readNode(page, n)){return false;}
+        if(n.isLeaf){return true;}
+        size_t idx = std::upper_bound(n.inner.keys, n.inner.keys + n.count, key) - n.inner.keys;
+        page = n.inner.child[idx];
+    }
+    return false;
+}
+
+bool BPlusTree::find(int key, long long &value){
+    if(!openFlag){return false;}
+    uint32_t page;
+    Node n;
+    if(!findLeaf(key, page, n)){return false;}
+    const int32_t *k = std::lower_bound(n.leaf.keys, n.leaf.keys + n.count, key);
+    size_t pos = k - n.leaf.keys;
+    if(pos >= n.count || *k != key){return false;}
+    value = n.leaf.vals[pos];
+    return true;
+}
+
+bool BPlusTree::insertRec(uint32_t page, int key, long long value, bool &split, int &sepKey, uint32_t &newPage){
+    Node n;
+    split = false;
+    if(!readNode(page, n)){return false;}
+
+    if(n.isLeaf){
+        size_t pos = std::lower_bound(n.leaf.keys, n.leaf.keys + n.count, key) - n.leaf.keys;
+        if(pos < n.count && n.leaf.keys[pos] == key){
+            n.leaf.vals[pos] = value;
+            return writeNode(page, n);
+        }
+        meta.entries++;
+        if(n.count < LEAF_CAP){
+            memmove(n.leaf.keys + pos + 1, n.leaf.keys + pos, (n.count - pos) * sizeof(int32_t));
+            memmove(n.leaf.vals + pos + 1, n.leaf.vals + pos, (n.count - pos) * sizeof(int64_t));
+            n.leaf.keys[pos] = key;
+            n.leaf.vals[pos] = value;
+            n.count++;
+            return writeNode(page, n);
+        }
+
+        // лист полон: делим пополам вместе с новым ключом
+        int32_t keys[LEAF_CAP + 1];
+        int64_t vals[LEAF_CAP + 1];
+        memcpy(keys, n.leaf.keys, pos * sizeof(int32_t));
+        memcpy(vals, n.leaf.vals, pos * sizeof(int64_t));
+        keys[pos] = key;
+        vals[pos] = value;
+        memcpy(keys + pos + 1, n.leaf.keys + pos, (n.count - pos) * sizeof(int32_t));
+        memcpy(vals + pos + 1, n.leaf.vals + pos, (n.count - pos) * sizeof(int64_t));
+
+        size_t total = LEAF_CAP + 1;
+        size_t left = total / 2;
+        Node r;
+        memset(&r, 0, sizeof(r));
+        r.isLeaf = 1;
+        r.count = (uint16_t)(total - left);
+        memcpy(r.leaf.keys, keys + left, r.count * sizeof(int32_t));
+        memcpy(r.leaf.vals, vals + left, r.count * sizeof(int64_t));
+        n.count = (uint16_t)left;
+        memcpy(n.leaf.keys, keys, left * sizeof(int32_t));
+        memcpy(n.leaf.vals, vals, left * sizeof(int64_t));
+
+        newPage = allocPage();
+        r.next = n.next;
+        n.next = newPage;
+        sepKey = r.leaf.keys[0];
+        split = true;
+        return writeNode(newPage, r) && writeNode(page, n);
+    }
+
+    size_t idx = std::upper_bound(n.inner.keys, n.inner.keys + n.count, key) - n.inner.keys;
+    bool childSplit;
+    int childSep;
+    uint32_t childPage;
+    if(!insertRec(n.inner.child[idx], key, value, childSplit, childSep, childPage)){return false;}
+    if(!childSplit){return true;}
+
+    if(n.count < INNER_CAP){
+        memmove(n.inner.keys + idx + 1, n.inner.keys + idx, (n.count - idx) * sizeof(int32_t));
+        memmove(n.inner.child + idx + 2, n.inner.child + idx + 1, (n.count - idx) * sizeof(uint32_t));
+        n.inner.keys[idx] = childSep;
+        n.inner.child[idx + 1] = childPage;
+        n.count++;
+        return writeNode(page, n);
+    }
+
+    // внутренний узел полон: средний ключ уходит на уровень выше
+    int32_t keys[INNER_CAP + 1];
+    uint32_t child[INNER_CAP + 2];
+    memcpy(keys, n.inner.keys, idx * sizeof(int32_t));
+    keys[idx] = childSep;
+    memcpy(keys + idx + 1, n.inner.keys + idx, (n.count - idx) * sizeof(int32_t));
+    memcpy(child, n.inner.child, (idx + 1) * sizeof(uint32_t));
+    child[idx + 1] = childPage;
+    memcpy(child + idx + 2, n.inner.child + idx + 1, (n.count - idx) * sizeof(uint32_t));
+
+    size_t total = INNER_CAP + 1;
+    size_t mid = total / 2;
+    Node r;
+    memset(&r, 0, sizeof(r));
+    r.isLeaf = 0;
+    r.count = (uint16_t)(total - mid - 1);
+    memcpy(r.inner.keys, keys + mid + 1, r.count * sizeof(int32_t));
+    memcpy(r.inner.child, child + mid + 1, (r.count + 1) * sizeof(uint32_t));
+    n.count = (uint16_t)mid;
+    memcpy(n.inner.keys, keys, mid * sizeof(int32_t));
+    memcpy(n.inner.child, child, (mid + 1) * sizeof(uint32_t));
+
+    newPage = allocPage();
+    sepKey = keys[mid];
+    split = true;
+    return writeNode(newPage, r) && writeNode(page, n);
+}
+
+bool BPlusTree::insert(int key, long long value){
+    if(!openFlag || !markDirty()){return false;}
+    bool split;
+    int sepKey;
+    uint32_t newPage;
+    if(!insertRec(meta.root, key, value, split, sepKey, newPage)){return false;}
+    if(split){
+        Node root;
+        memset(&root, 0, sizeof(root));
+        root.isLeaf = 0;
+        root.count = 1;
+        root.inner.keys[0] = sepKey;
+        root.inner.child[0] = meta.root;
+        root.inner.child[1] = newPage;
+        uint32_t page = allocPage();
+        if(!writeNode(page, root)){return false;}
+        meta.root = page;
+        meta.height++;
+    }
+    return writeMeta();
+}
+
+bool BPlusTree::erase(int key){
+    if(!openFlag){return false;}
+    uint32_t page;
+    Node n;
+    if(!findLeaf(key, page, n)){return false;}
+    size_t pos = std::lower_bound(n.leaf.keys, n.leaf.keys + n.count, key) - n.leaf.keys;
+    if(pos >= n.count || n.leaf.keys[pos] != key){return false;}
+    if(!markDirty()){return false;}
+    memmove(n.leaf.keys + pos, n.leaf.keys + pos + 1, (n.count - pos - 1) * sizeof(int32_t));
+    memmove(n.leaf.vals + pos, n.leaf.vals + pos + 1, (n.count - pos - 1) * sizeof(int64_t));
+    n.count--;
+    meta.entries--;
+    return writeNode(page, n) && writeMeta();
+}
+
+bool BPlusTree::build(const std::vector<std::pair<int, long long>> &sorted){
+    if(!openFlag || !file.truncate()){return false;}
+    uint64_t generation = meta.dataGeneration, records = meta.dataRecords;
+    memset(&meta, 0, sizeof(meta));
+    meta.dataGeneration = generation;
+    meta.dataRecords = records;
+    meta.magic = MAGIC;
+    meta.version = VERSION;
+    meta.pageCount = 1;
+    meta.entries = sorted.size();
+    meta.clean = 0;
+    dirtyMarked = true;
+
+    // листья заполняются целиком и идут подряд, за ними уровни внутренних узлов
+    std::vector<std::pair<int, uint32_t>> level;
+    size_t leaves = std::max<size_t>(1, (sorted.size() + LEAF_CAP - 1) / LEAF_CAP);
+    for(size_t l = 0; l < leaves; l++){
+        Node n;
+        memset(&n, 0, sizeof(n));
+        n.isLeaf = 1;
+        size_t from = l * LEAF_CAP;
+        size_t to = std::min(sorted.size(), from + LEAF_CAP);
+        for(size_t i = from; i < to; i++){
+            n.leaf.keys[i - from] = sorted[i].first;
+            n.leaf.vals[i - from] = sorted[i].second;
+        }
+        n.count = (uint16_t)(to - from);
+        uint32_t page = allocPage();
+        n.next = (l + 1 < leaves) ? page + 1 : 0;
+        if(!writeNode(page, n)){return false;}
+        level.push_back({from < to ? sorted[from].first : 0, page});
+    }
+
+    meta.height = 0;
+    while(level.size() > 1){
+        std::vector<std::pair<int, uint32_t>> upper;
+        for(size_t from = 0; from < level.size(); from += INNER_CAP + 1){
+            size_t to = std::min(level.size(), from + INNER_CAP + 1);
+            Node n;
+            memset(&n, 0, sizeof(n));
+            n.isLeaf = 0;
+            n.count = (uint16_t)(to - from - 1);
+            for(size_t i = from; i < to; i++){
+                n.inner.child[i - from] = level[i].second;
+                if(i > from) n.inner.keys[i - from - 1] = level[i].first;
+            }
+            uint32_t page = allocPage();
+            if(!writeNode(page, n)){return false;}
+            upper.push_back({level[from].first, page});
+        }
+        level.swap(upper);
+        meta.height++;
+    }
+    meta.root = level[0].second;
+    return writeMeta();
+}
+
+void BPlusTree::Iterator::settle(){
+    while(ok && pos >= node.count){
+        if(node.next == 0 || !tree->readNode((uint32_t)node.next, node)){
+            ok = false;
+            return;
+        }
+        pos = 0;
+    }
+}
+
+void BPlusTree::Iterator::next(){
+    if(!ok) return;
+    pos++;
+    settle();
+}
+
+BPlusTree::Iterator BPlusTree::begin(){
+    Iterator it;
+    if(!openFlag) return it;
+    it.tree = this;
+    uint32_t page = meta.root;
+    for(uint32_t level = 0; level <= meta.height; level++){
+        if(!readNode(page, it.node)) return it;
+        if(it.node.isLeaf){
+            it.pos = 0;
+            it.ok = true;
+            it.settle();
+            return it;
+        }
+        page = it.node.inner.child[0];
+    }
+    return it;
+}
+
+BPlusTree::Iterator BPlusTree::lowerBound(int key){
+    Iterator it;
+    if(!openFlag) return it;
+    it.tree = this;
+    uint32_t page;
+    if(!findLeaf(key, page, it.node)) return it;
+    it.pos = std::lower_bound(it.node.leaf.keys, it.node.leaf.keys + it.node.count, key) - it.node.leaf.keys;
+    it.ok = true;
+    it.settle();
+    return it;
+}
@@ -0,0 +1,148 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include "FileManager.h"
+
+// B+-дерево id -> смещение записи в отдельном страничном файле.
+// Узел занимает одну страницу и читается через кэш страниц FileManager,
+// поэтому открытие не зависит от размера индекса, а память ограничена кэшем.
+// Страница 0 - метаданные с контрольной суммой и отметкой файла данных, по которому
+// дерево было записано (поколение и число записей). Удаление не сливает узлы: пустые
+// листья остаются в цепочке до следующей перестройки (build).
+class BPlusTree {
+    public:
+        static constexpr size_t PAGE_SIZE = 4096;
+        static constexpr size_t DEFAULT_CACHE_PAGES = 1024;
+
+    private:
+        static constexpr uint32_t MAGIC = 0x45525442; // "BTRE"
+        static constexpr uint32_t VERSION = 2;
+        static constexpr size_t HEADER_SIZE = 16;
+        static constexpr size_t LEAF_CAP = (PAGE_SIZE - HEADER_SIZE) / (sizeof(int32_t) + sizeof(int64_t));
+        static constexpr size_t INNER_CAP = (PAGE_SIZE - HEADER_SIZE - sizeof(uint32_t)) / (2 * sizeof(uint32_t));
+
+        struct Meta {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t root;
+            uint32_t pageCount;
+            uint64_t entries;
+            uint32_t clean;     // 1 - файл записан целиком при последней синхронизации
+            uint32_t height;
+            uint64_t dataGeneration; // заголовок файла данных, с которым дерево согласовано
+            uint64_t dataRecords;
+            uint32_t crc;       // по всем полям выше
+        };
+
+        struct Node {
+            uint16_t isLeaf;
+            uint16_t count;
+            uint32_t reserved;
+            int64_t next;       // следующий лист, 0 - нет
+            union {
+                struct { int32_t keys[LEAF_CAP]; int64_t vals[LEAF_CAP]; } leaf;
+                struct { int32_t keys[INNER_CAP]; uint32_t child[INNER_CAP + 1]; } inner;
+            };
+        };
+        static_assert(sizeof(Node) <= PAGE_SIZE, "B+tree node must fit a page");
+
+        // Наложение: страницы дерева, изменённые после полной копии его файла (base).
+        // За заголовком - номера страниц, с первой целой страницы после них - их образы.
+        static constexpr uint32_t OVERLAY_MAGIC = 0x564f5442; // "BTOV"
+        static constexpr uint32_t OVERLAY_VERSION = 1;
+        struct OverlayHeader {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t base;
+            uint32_t count;
+            uint32_t crc;       // по полям выше и списку номеров
+        };
+
+        FileManager file;
+        Meta meta;
+        bool openFlag;
+        bool dirtyMarked;   // на диске уже отмечено clean = 0
+        bool cleanAtOpen;
+        FileManager overlay;
+        std::unordered_map<uint32_t, uint32_t> overlayPages; // страница дерева -> страница наложения
+
+        bool readPage(uint32_t page, void *buf, size_t size);
+        bool loadMeta(long long fileBytes);
+        bool readNode(uint32_t page, Node &n);
+        bool writeNode(uint32_t page, const Node &n);
+        bool writeMeta();
+        bool markDirty();
+        uint32_t allocPage();
+        bool insertRec(uint32_t page, int key, long long value, bool &split, int &sepKey, uint32_t &newPage);
+        bool findLeaf(int key, uint32_t &page, Node &n);
+
+    public:
+        class Iterator {
+            friend class BPlusTree;
+            private:
+                BPlusTree *tree;
+                Node node;
+                size_t pos;
+                bool ok;
+                void settle();
+            public:
+                Iterator(): tree(nullptr), pos(0), ok(false) {}
+                bool valid() const { return ok; }
+                int key() const { return node.leaf.keys[pos]; }
+                long long value() const { return node.leaf.vals[pos]; }
+                void next();
+        };
+
+        BPlusTree(size_t cachePages = DEFAULT_CACHE_PAGES);
+        ~BPlusTree();
+        BPlusTree(const BPlusTree&) = delete;
+        BPlusTree &operator=(const BPlusTree&) = delete;
+
+        bool create(const std::string &path);
+        // false, если файл не является деревом; readOnly - узлы читаются из общего
+        // отображения файла (снимок индекса, который делят процессы-читатели)
+        bool open(const std::string &path, bool readOnly = false);
+        // Только чтение: полная копия basePath, поверх которой читаются страницы наложения
+        bool openOverlay(const std::string &basePath, const std::string &overlayPath);
+        // Наложение из страниц pages этого дерева (после sync()); base - метка его полной копии
+        bool writeOverlay(const std::string &path, uint64_t base, const std::vector<uint64_t> &pages);
+        // true, если path - наложение, и тогда base - метка его полной копии
+        static bool overlayBase(const std::string &path, uint64_t &base);
+        void close();
+        bool isOpen() const { return openFlag; }
+        bool wasCleanAtOpen() const { return cleanAtOpen; }
+        static bool isTreeFile(const std::string &path);
+        void setMetrics(Metrics *m) { file.setMetrics(m); }
+
+        bool find(int key, long long &value);
+        bool contains(int key) { long long v; return find(key, v); }
+        bool insert(int key, long long value); // вставка или замена значения
+        bool erase(int key);
+        size_t size() const { return (size_t)meta.entries; }
+        bool clear();
+        // Перестраивает дерево из отсортированных по ключу пар без повторов
+        bool build(const std::vector<std::pair<int, long long>> &sorted);
+        bool sync(); // страницы на диск, fsync, отметка clean
+
+        // Отметка файла данных записывается в метаданные при следующем sync()
+        void setDataStamp(uint64_t generation, uint64_t records);
+        uint64_t dataGeneration() const { return meta.dataGeneration; }
+        uint64_t dataRecords() const { return meta.dataRecords; }
+
+        // Страницы файла дерева, изменённые с последней копии (см. FileManager::Changes)
+        FileManager::Changes changedPages(FileManager::Tracker t = FileManager::TRACK_BACKUP) { return file.changedPages(t); }
+        void setChangedPages(const FileManager::Changes &c, FileManager::Tracker t = FileManager::TRACK_BACKUP) { file.setChangedPages(c, t); }
+        void clearChangedPages(FileManager::Tracker t = FileManager::TRACK_BACKUP) { file.clearChangedPages(t); }
+        size_t filePageSize() const { return file.getPageSize(); }
+        long long fileSize() const { return file.size(); }
+
+        Iterator begin();
+        Iterator lowerBound(int key); // первый ключ >= key
+};
+
+#endif
@@ -0,0 +1,29 @@
+#include "Checksum.h"
+
+namespace {
+
+struct Crc32Table {
+    uint32_t t[256];
+    Crc32Table(){
+        for(uint32_t i = 0; i < 256; i++){
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++){
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            t[i] = c;
+        }
+    }
+};
+
+const Crc32Table table;
+
+}
+
+uint32_t crc32(const void *data, size_t size, uint32_t seed){
+    const unsigned char *p = (const unsigned char*)data;
+    uint32_t c = seed ^ 0xFFFFFFFFu;
+    for(size_t i = 0; i < size; i++){
+        c = table.t[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
@@ -0,0 +1,11 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (IEEE 802.3). seed позволяет считать сумму по частям:
+// crc32(b, nb, crc32(a, na)) == crc32(a+b)
+uint32_t crc32(const void *data, size_t size, uint32_t seed = 0);
+
+#endif
@@ -0,0 +1,315 @@
+#include "ColumnStore.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLUMNS_X86 1
+#endif
+
+namespace {
+
+const uint32_t COLUMN_MAGIC = 0x534c4f43; // "COLS"
+
+struct ColumnHeader {
+    uint32_t magic;
+    uint32_t width;   // размер элемента колонки
+    int64_t rows;
+    uint64_t generation; // поколение файла данных
+};
+
+// Ядра заполняют битовую карту целыми словами по 64 строки;
+// хвост меньше слова и платформы без x86 обрабатываются скалярно.
+typedef void (*IntKernel)(const int32_t *v, const uint8_t *act, size_t n, int32_t lo, int32_t hi, uint64_t *bits);
+typedef void (*DoubleKernel)(const double *v, const uint8_t *act, size_t n, double lo, double hi, uint64_t *bits);
+
+std::atomic<ColumnStore::Kernel> forcedKernel{ColumnStore::Kernel::Auto};
+
+void selectIntScalar(const int32_t *v, const uint8_t *act, size_t n, int32_t lo, int32_t hi, uint64_t *bits){
+    for(size_t w = 0; w * 64 < n; w++){
+        uint64_t word = 0;
+        size_t end = std::min<size_t>(64, n - w * 64);
+        for(size_t j = 0; j < end; j++){
+            size_t i = w * 64 + j;
+            word |= (uint64_t)(act[i] != 0 && v[i] >= lo && v[i] <= hi) << j;
+        }
+        bits[w] = word;
+    }
+}
+
+void selectDoubleScalar(const double *v, const uint8_t *act, size_t n, double lo, double hi, uint64_t *bits){
+    for(size_t w = 0; w * 64 < n; w++){
+        uint64_t word = 0;
+        size_t end = std::min<size_t>(64, n - w * 64);
+        for(size_t j = 0; j < end; j++){
+            size_t i = w * 64 + j;
+            word |= (uint64_t)(act[i] != 0 && v[i] >= lo && v[i] <= hi) << j;
+        }
+        bits[w] = word;
+    }
+}
+
+#ifdef COLUMNS_X86
+
+void selectIntSse2(const int32_t *v, const uint8_t *act, size_t n, int32_t lo, int32_t hi, uint64_t *bits){
+    size_t full = n / 64;
+    const __m128i vlo = _mm_set1_epi32(lo), vhi = _mm_set1_epi32(hi), zero = _mm_setzero_si128();
+    for(size_t w = 0; w < full; w++){
+        const int32_t *p = v + w * 64;
+        uint64_t word = 0;
+        for(size_t j = 0; j < 64; j += 4){
+            __m128i x = _mm_loadu_si128((const __m128i*)(p + j));
+            __m128i out = _mm_or_si128(_mm_cmpgt_epi32(vlo, x), _mm_cmpgt_epi32(x, vhi));
+            word |= (uint64_t)(~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xF) << j;
+        }
+        const uint8_t *a = act + w * 64;
+        uint64_t live = 0;
+        for(size_t j = 0; j < 64; j += 16){
+            __m128i x = _mm_loadu_si128((const __m128i*)(a + j));
+            live |= (uint64_t)(~_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) & 0xFFFF) << j;
+        }
+        bits[w] = word & live;
+    }
+    if(full * 64 < n){
+        selectIntScalar(v + full * 64, act + full * 64, n - full * 64, lo, hi, bits + full);
+    }
+}
+
+void selectDoubleSse2(const double *v, const uint8_t *act, size_t n, double lo, double hi, uint64_t *bits){
+    size_t full = n / 64;
+    const __m128d vlo = _mm_set1_pd(lo), vhi = _mm_set1_pd(hi);
+    const __m128i zero = _mm_setzero_si128();
+    for(size_t w = 0; w < full; w++){
+        const double *p = v + w * 64;
+        uint64_t word = 0;
+        for(size_t j = 0; j < 64; j += 2){
+            __m128d x = _mm_loadu_pd(p + j);
+            __m128d in = _mm_and_pd(_mm_cmpge_pd(x, vlo), _mm_cmple_pd(x, vhi));
+            word |= (uint64_t)_mm_movemask_pd(in) << j;
+        }
+        const uint8_t *a = act + w * 64;
+        uint64_t live = 0;
+        for(size_t j = 0; j < 64; j += 16){
+            __m128i x = _mm_loadu_si128((const __m128i*)(a + j));
+            live |= (uint64_t)(~_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) & 0xFFFF) << j;
+        }
+        bits[w] = word & live;
+    }
+    if(full * 64 < n){
+        selectDoubleScalar(v + full * 64, act + full * 64, n - full * 64, lo, hi, bits + full);
+    }
+}
+
+__attribute__((target("avx2")))
+uint64_t activeWordAvx2(const uint8_t *a){
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t lo = (uint32_t)~_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)a), zero));
+    uint64_t hi = (uint32_t)~_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + 32)), zero));
+    return lo | (hi << 32);
+}
+
+__attribute__((target("avx2")))
+void selectIntAvx2(const int32_t *v, const uint8_t *act, size_t n, int32_t lo, int32_t hi, uint64_t *bits){
+    size_t full = n / 64;
+    const __m256i vlo = _mm256_set1_epi32(lo), vhi = _mm256_set1_epi32(hi);
+    for(size_t w = 0; w < full; w++){
+        const int32_t *p = v + w * 64;
+        uint64_t word = 0;
+        for(size_t j = 0; j < 64; j += 8){
+            __m256i x = _mm256_loadu_si256((const __m256i*)(p + j));
+            __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(vlo, x), _mm256_cmpgt_epi32(x, vhi));
+            word |= (uint64_t)(~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xFF) << j;
+        }
+        bits[w] = word & activeWordAvx2(act + w * 64);
+    }
+    if(full * 64 < n){
+        selectIntScalar(v + full * 64, act + full * 64, n - full * 64, lo, hi, bits + full);
+    }
+}
+
+__attribute__((target("avx2")))
+void selectDoubleAvx2(const double *v, const uint8_t *act, size_t n, double lo, double hi, uint64_t *bits){
+    size_t full = n / 64;
+    const __m256d vlo = _mm256_set1_pd(lo), vhi = _mm256_set1_pd(hi);
+    for(size_t w = 0; w < full; w++){
+        const double *p = v + w * 64;
+        uint64_t word = 0;
+        for(size_t j = 0; j < 64; j += 4){
+            __m256d x = _mm256_loadu_pd(p + j);
+            __m256d in = _mm256_and_pd(_mm256_cmp_pd(x, vlo, _CMP_GE_OQ), _mm256_cmp_pd(x, vhi, _CMP_LE_OQ));
+            word |= (uint64_t)_mm256_movemask_pd(in) << j;
+        }
+        bits[w] = word & activeWordAvx2(act + w * 64);
+    }
+    if(full * 64 < n){
+        selectDoubleScalar(v + full * 64, act + full * 64, n - full * 64, lo, hi, bits + full);
+    }
+}
+
+bool hasAvx2(){
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+ColumnStore::Kernel bestKernel(){ return hasAvx2() ? ColumnStore::Kernel::Avx2 : ColumnStore::Kernel::Sse2; }
+
+#else
+
+ColumnStore::Kernel bestKernel(){ return ColumnStore::Kernel::Scalar; }
+
+#endif
+
+ColumnStore::Kernel activeKernel(){
+    ColumnStore::Kernel k = forcedKernel.load(std::memory_order_relaxed);
+    return k == ColumnStore::Kernel::Auto ? bestKernel() : k;
+}
+
+IntKernel intKernel(){
+    switch(activeKernel()){
+#ifdef COLUMNS_X86
+        case ColumnStore::Kernel::Avx2: return selectIntAvx2;
+        case ColumnStore::Kernel::Sse2: return selectIntSse2;
+#endif
+        default: return selectIntScalar;
+    }
+}
+
+DoubleKernel doubleKernel(){
+    switch(activeKernel()){
+#ifdef COLUMNS_X86
+        case ColumnStore::Kernel::Avx2: return selectDoubleAvx2;
+        case ColumnStore::Kernel::Sse2: return selectDoubleSse2;
+#endif
+        default: return selectDoubleScalar;
+    }
+}
+
+template<typename T>
+bool saveColumn(const std::string &path, const std::vector<T> &col, long long recordCount, uint64_t generation){
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if(!ofs){return false;}
+        ColumnHeader h{COLUMN_MAGIC, (uint32_t)sizeof(T), recordCount, generation};
+        ofs.write((const char*)&h, sizeof(h));
+        ofs.write((const char*)col.data(), col.size() * sizeof(T));
+        if(!ofs){return false;}
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+template<typename T>
+bool loadColumn(const std::string &path, std::vector<T> &col, long long recordCount, uint64_t generation){
+    std::ifstream ifs(path, std::ios::binary);
+    ColumnHeader h;
+    if(!ifs || !ifs.read((char*)&h, sizeof(h))){return false;}
+    if(h.magic != COLUMN_MAGIC || h.width != sizeof(T) || h.rows != recordCount || h.generation != generation){return false;}
+    col.resize((size_t)recordCount);
+    return (bool)ifs.read((char*)col.data(), col.size() * sizeof(T));
+}
+
+}
+
+ColumnStore::ColumnStore(): on(false) {}
+
+void ColumnStore::setEnabled(bool enabled){
+    on = enabled;
+    if(!on) clear();
+}
+
+void ColumnStore::clear(){
+    ids.clear();
+    courses.clear();
+    grades.clear();
+    active.clear();
+}
+
+void ColumnStore::put(size_t row, int id, int cours, double grade, bool isActive){
+    if(!on) return;
+    if(row >= active.size()){
+        // строки между концом колонок и row (не должно случаться) считаются удалёнными
+        ids.resize(row + 1, 0);
+        courses.resize(row + 1, 0);
+        grades.resize(row + 1, 0);
+        active.resize(row + 1, 0);
+    }
+    ids[row] = id;
+    courses[row] = cours;
+    grades[row] = grade;
+    active[row] = isActive ? 1 : 0;
+}
+
+void ColumnStore::setActive(size_t row, bool isActive){
+    if(on && row < active.size()) active[row] = isActive ? 1 : 0;
+}
+
+void ColumnStore::selectCours(int lo, int hi, std::vector<uint64_t> &bits) const {
+    bits.assign((active.size() + 63) / 64, 0);
+    if(lo > hi || active.empty()) return;
+    intKernel()(courses.data(), active.data(), active.size(), lo, hi, bits.data());
+}
+
+void ColumnStore::selectGrade(double lo, double hi, std::vector<uint64_t> &bits) const {
+    bits.assign((active.size() + 63) / 64, 0);
+    if(!(lo <= hi) || active.empty()) return;
+    doubleKernel()(grades.data(), active.data(), active.size(), lo, hi, bits.data());
+}
+
+std::vector<size_t> ColumnStore::selectedRows(const std::vector<uint64_t> &bits){
+    std::vector<size_t> rows;
+    for(size_t w = 0; w < bits.size(); w++){
+        uint64_t word = bits[w];
+        while(word){
+            rows.push_back(w * 64 + (size_t)__builtin_ctzll(word));
+            word &= word - 1;
+        }
+    }
+    return rows;
+}
+
+const char *ColumnStore::kernelName(){
+    switch(activeKernel()){
+        case Kernel::Avx2: return "avx2";
+        case Kernel::Sse2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+bool ColumnStore::setKernel(Kernel k){
+#ifdef COLUMNS_X86
+    if(k == Kernel::Avx2 && !hasAvx2()){return false;}
+#else
+    if(k == Kernel::Sse2 || k == Kernel::Avx2){return false;}
+#endif
+    forcedKernel.store(k, std::memory_order_relaxed);
+    return true;
+}
+
+bool ColumnStore::save(const std::string &prefix, long long recordCount, uint64_t generation) const {
+    if((long long)active.size() != recordCount){return false;}
+    return saveColumn(prefix + ".id", ids, recordCount, generation)
+        && saveColumn(prefix + ".cours", courses, recordCount, generation)
+        && saveColumn(prefix + ".grade", grades, recordCount, generation)
+        && saveColumn(prefix + ".active", active, recordCount, generation);
+}
+
+bool ColumnStore::load(const std::string &prefix, long long recordCount, uint64_t generation){
+    bool ok = loadColumn(prefix + ".id", ids, recordCount, generation)
+        && loadColumn(prefix + ".cours", courses, recordCount, generation)
+        && loadColumn(prefix + ".grade", grades, recordCount, generation)
+        && loadColumn(prefix + ".active", active, recordCount, generation);
+    if(!ok) clear();
+    return ok;
+}
+
+bool ColumnStore::exists(const std::string &prefix){
+    struct stat st;
+    return stat((prefix + ".active").c_str(), &st) == 0;
+}
+
+std::vector<std::string> ColumnStore::files(const std::string &prefix){
+    return {prefix + ".id", prefix + ".cours", prefix + ".grade", prefix + ".active"};
+}
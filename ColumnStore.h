@@ -0,0 +1,50 @@
+#ifndef COLUMNSTORE_H
+#define COLUMNSTORE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Колоночная копия числовых полей: id, cours, averageGrade и isActive лежат
+// в отдельных плотных массивах. Строка колонок i соответствует записи номер i
+// файла данных (смещение - за его заголовком), так что смещение восстанавливается по номеру.
+// Фильтры по cours/averageGrade считаются векторными ядрами (AVX2, SSE2 или
+// скалярно) в битовую карту выборки; строки читаются только для совпавших бит.
+class ColumnStore {
+    public:
+        ColumnStore();
+
+        bool enabled() const { return on; }
+        void setEnabled(bool enabled);
+        void clear();
+        size_t rows() const { return active.size(); }
+
+        void put(size_t row, int id, int cours, double grade, bool isActive);
+        void setActive(size_t row, bool isActive);
+
+        // бит i выставлен, если строка i активна и lo <= значение <= hi
+        void selectCours(int lo, int hi, std::vector<uint64_t> &bits) const;
+        void selectGrade(double lo, double hi, std::vector<uint64_t> &bits) const;
+        static std::vector<size_t> selectedRows(const std::vector<uint64_t> &bits);
+        static const char *kernelName(); // набор инструкций, выбранный на этой машине
+        // Ядро по умолчанию (Auto) - лучшее для машины; остальные включаются для
+        // сравнения ядер между собой. false - машина это ядро не поддерживает.
+        enum class Kernel { Auto, Scalar, Sse2, Avx2 };
+        static bool setKernel(Kernel k);
+
+        // Файлы <prefix>.id, .cours, .grade, .active: заголовок (ширина элемента, число строк,
+        // поколение файла данных) и массив; число записей и поколение сверяются при загрузке
+        bool save(const std::string &prefix, long long recordCount, uint64_t generation) const;
+        bool load(const std::string &prefix, long long recordCount, uint64_t generation);
+        static bool exists(const std::string &prefix);
+        static std::vector<std::string> files(const std::string &prefix);
+
+    private:
+        bool on;
+        std::vector<int32_t> ids;
+        std::vector<int32_t> courses;
+        std::vector<double> grades;
+        std::vector<uint8_t> active;
+};
+
+#endif
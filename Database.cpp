@@ -1,484 +1,2536 @@
 #include "Database.h"
+#include "Log.h"
+#include "Checksum.h"
 #include <fstream>
 #include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+#include <climits>
+#include <cstddef>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <random>
 #include <sys/stat.h>
+#include <unistd.h>
 
-Database::Database(): openFlag(false) {}
+static Student toStudent(const StoredStudent &rs){
+    Student s;
+    s.id = rs.id;
+    strncpy(s.name, rs.name, sizeof(s.name));
+    s.name[sizeof(s.name)-1] = '\0';
+    s.isActive = (rs.isActive != 0);
+    s.averageGrade = rs.averageGrade;
+    s.cours = rs.cours;
+    return s;
+}
+
+static StoredStudent toStored(const Student &s){
+    StoredStudent rs;
+    rs.id = s.id;
+    strncpy(rs.name, s.name, sizeof(rs.name)-1);
+    rs.name[sizeof(rs.name)-1] = '\0';
+    rs.isActive = s.isActive ? 1 : 0;
+    rs.averageGrade = s.averageGrade;
+    rs.cours = s.cours;
+    return rs;
+}
+
+// контрольная точка WAL, когда журнал вырастает больше этого размера
+static const unsigned long long WAL_CHECKPOINT_BYTES = 32ULL * 1024 * 1024;
+// маленькие файлы автоматически не сжимаются
+static const size_t AUTO_COMPACT_MIN_RECORDS = 1024;
+// кусок параллельного прохода: меньшие файлы проходятся в вызывающем потоке
+static const size_t SCAN_CHUNK_RECORDS = 16384;
+
+// Делит записи [0, n) на куски по границам записей и обрабатывает их на пуле:
+// fn(first, last, part) заполняет part, результат - части в порядке файла.
+// С progress куски не укрупняются: после каждого отмечается ход, а после отмены
+// оставшиеся куски пропускаются (результат тогда неполный и отбрасывается вызывающим).
+template<typename Part, typename Fn>
+static std::vector<Part> scanParts(ThreadPool *pool, size_t n, Fn fn, Progress *progress = nullptr){
+    size_t chunks = (n + SCAN_CHUNK_RECORDS - 1) / SCAN_CHUNK_RECORDS;
+    if(progress) progress->start((long long)n);
+    else if(!pool) chunks = std::min<size_t>(chunks, 1);
+    else chunks = std::min(chunks, (pool->size() + 1) * 4);
+    std::vector<Part> parts(chunks);
+    auto body = [&](size_t c){
+        if(progress && progress->cancelled()) return;
+        size_t first = n * c / chunks, last = n * (c + 1) / chunks;
+        fn(first, last, parts[c]);
+        if(progress) progress->advance((long long)(last - first));
+    };
+    if(pool) pool->parallelFor(chunks, body);
+    else for(size_t c = 0; c < chunks; c++) body(c);
+    return parts;
+}
+
+template<typename T>
+static void appendParts(std::vector<T> &out, std::vector<std::vector<T>> &parts){
+    size_t total = out.size();
+    for(auto &p: parts) total += p.size();
+    out.reserve(total);
+    for(auto &p: parts) out.insert(out.end(), p.begin(), p.end());
+}
+
+// заголовок файла данных
+static const uint32_t DATA_MAGIC = 0x54414453; // "SDAT"
+static const uint32_t DATA_VERSION = 1;
+
+// учёт изменённых страниц для инкрементальных копий, <db>.bkmap:
+// заголовок, биты страниц файла данных, биты страниц индекса, crc32 всего предыдущего
+static const uint32_t BKMAP_MAGIC = 0x504d4b42; // "BKMP"
+#pragma pack(push,1)
+struct BackupMapHeader {
+    uint32_t magic;
+    uint32_t seq;
+    uint64_t chain;
+    uint64_t generation;   // поколение файла данных, при котором учёт записан
+    uint32_t dataPageSize;
+    uint32_t idxPageSize;
+    uint8_t dataAll;
+    uint8_t idxAll;
+    uint64_t dataWords;
+    uint64_t idxWords;
+};
+#pragma pack(pop)
+// больше слов быть не может: 2^26 * 64 страниц по 4 KiB - это 16 ТиБ
+static const uint64_t BKMAP_MAX_WORDS = 1ull << 26;
+
+// записей в одном окне курсора
+static const size_t CURSOR_WINDOW = 512;
+
+// длина страницы page в файле размера size
+static size_t pageBytes(uint64_t page, long long size, size_t pageSize){
+    return (size_t)std::min<long long>((long long)pageSize, size - (long long)(page * pageSize));
+}
+
+static std::vector<uint64_t> changedPageList(const FileManager::Changes &c, long long size, size_t pageSize){
+    std::vector<uint64_t> pages;
+    uint64_t count = (uint64_t)((size + (long long)pageSize - 1) / (long long)pageSize);
+    for(uint64_t p = 0; p < count; p++){
+        if(c.all || (p / 64 < c.bits.size() && (c.bits[p / 64] >> (p % 64) & 1))) pages.push_back(p);
+    }
+    return pages;
+}
+
+static WalEntry recordOp(long long offset, const StoredStudent &rs){
+    WalEntry e;
+    memset(&e, 0, sizeof(e));
+    e.type = WAL_RECORD;
+    e.offset = offset;
+    e.id = rs.id;
+    e.image = rs;
+    return e;
+}
+
+static WalEntry indexOp(int id, long long offset){
+    WalEntry e;
+    memset(&e, 0, sizeof(e));
+    e.type = WAL_INDEX;
+    e.offset = offset;
+    e.id = id;
+    return e;
+}
+
+Database::Database(): openFlag(false), readOnly(false), unpublished(false), publishMs(0), snapshotBase(0),
+    attachedSeq(0), publishedBytes(0), dataStart(0), generation(0), generationDirty(false),
+    backupChain(0), backupSeq(0), backupMapDirty(false), idsOn(false), autoCompactRatio(0), freeDirty(false), sidxDirty(false), colsDirty(false), scanThreads(0) {
+    // страница данных попадает на диск только после журнала, который её изменил
+    fm.setMetrics(&metrics);
+    index.setMetrics(&metrics);
+    wal.setMetrics(&metrics);
+    fm.setWalHook([this](unsigned long long lsn){
+        return wal.flushTo(lsn, wal.getDurability() != Wal::Durability::None);
+    });
+}
 Database::~Database(){ close(); }
 
 bool Database::create(const std::string &filename){
-    if(openFlag) close();
+    std::unique_lock<RwLock> lock(rwLock);
+    if(openFlag) closeLocked();
+
+    if(!shm.attach(filename + ".shm", true)){
+        LOG_WARN("Database " << filename << " is open for writing by another process");
+        return false;
+    }
+    if(!fm.createFile(filename)){
+        shm.detach();
+        return false;
+    }
+
+    dbFilename = filename;
+    idxFilename = filename + ".idx";
+    dataStart = (long long)sizeof(DataHeader);
+    generation = 1;
+    generationDirty = false;
+
+    backupChain = 0;
+    backupSeq = 0;
+    backupMapDirty = false;
+    std::remove((dbFilename + ".bkmap").c_str());
+
+    std::remove((idxFilename + ".log").c_str());
+    if(!writeDataHeader(fm, generation, 0) || !fm.sync() || !index.create(idxFilename)){
+        fm.closeFile();
+        shm.detach();
+        return false;
+    }
+    index.setDataStamp(generation, 0);
+    index.sync();
+    resetIds();
+    freeSlots.clear();
+    freeDirty = true;
+    sidx.setMask(0);
+    sidxDirty = false;
+    std::remove((dbFilename + ".sidx").c_str());
+    cols.setEnabled(false);
+    colsDirty = false;
+    for(const std::string &f: ColumnStore::files(dbFilename + ".col")) std::remove(f.c_str());
+    stats.reset();
+
+    if(!wal.open(dbFilename + ".wal") || !wal.reset()){
+        index.close();
+        fm.closeFile();
+        shm.detach();
+        return false;
+    }
+
+    openFlag = true;
+    readOnly = false;
+    unpublished = true;
+    publishSnapshot();
+    noteChange(Change::RESET, -1, nullptr, nullptr);
+    lock.unlock();
+    notifyChanges();
+    return true;
+}
+
+bool Database::open(const std::string &filename, Mode mode){
+    std::unique_lock<RwLock> lock(rwLock);
+    bool ok = openLocked(filename, mode);
+    lock.unlock();
+    notifyChanges();
+    return ok;
+}
+
+bool Database::openLocked(const std::string &filename, Mode mode){
+    if(openFlag) closeLocked();
+    if(mode == Mode::ReadOnly) return openReaderLocked(filename);
+    // блокировка писателя берётся раньше всего остального: восстановление и
+    // доведение сжатия тоже пишут файлы
+    if(!shm.attach(filename + ".shm", true)){
+        LOG_WARN("Database " << filename << " is open for writing by another process");
+        return false;
+    }
+    if(!openWriterLocked(filename)){
+        shm.detach();
+        return false;
+    }
+    // читатели получают снимок сразу, не дожидаясь первой контрольной точки
+    unpublished = true;
+    publishSnapshot();
+    return true;
+}
+
+bool Database::openReaderLocked(const std::string &filename){
+    if(!shm.attach(filename + ".shm", false)){
+        LOG_WARN("Database " << filename << " has no published index; open it for writing once");
+        return false;
+    }
+    dbFilename = filename;
+    idxFilename = filename + ".idx";
+    readOnly = true;
+    if(!attachSnapshot()){
+        LOG_ERROR("Cannot attach the index snapshot of " << filename);
+        shm.detach();
+        readOnly = false;
+        return false;
+    }
+    openFlag = true;
+    noteChange(Change::RESET, -1, nullptr, nullptr);
+    return true;
+}
+
+bool Database::openWriterLocked(const std::string &filename){
+    if(!finishCompaction(filename)){return false;}
+    if(!fm.openFile(filename)){return false;}
+    dbFilename = filename;
+    idxFilename = filename + ".idx";
+    generationDirty = false;
+    if(!readDataHeader()){
+        LOG_ERROR("Data file header of " << dbFilename << " is corrupted");
+        fm.closeFile();
+        return false;
+    }
+    bool indexOk = loadIndex();
+    if(!index.isOpen()){
+        fm.closeFile();
+        return false;
+    }
+    // до повтора журнала: страницы, которые он перепишет, добавятся к учёту
+    loadBackupMap(indexOk);
+    if(!wal.open(dbFilename + ".wal")){
+        index.close();
+        fm.closeFile();
+        return false;
+    }
+
+    // восстановление после сбоя: всё, что есть в журнале, применяется повторно
+    size_t replayed = 0;
+    bool ok = wal.replay([&](const char *payload, size_t size){
+        replayed++;
+        return applyWalRecord(payload, size);
+    });
+    if(!ok){
+        LOG_ERROR("Journal replay failed for " << dbFilename);
+        wal.close();
+        index.close();
+        fm.closeFile();
+        return false;
+    }
+    // дерево, не закрытое после изменений, строится заново по данным (уже с учётом WAL)
+    if(!indexOk){
+        LOG_INFO("Rebuilding primary index for " << dbFilename);
+        if(!rebuildIndex()){
+            wal.close();
+            index.close();
+            fm.closeFile();
+            return false;
+        }
+    }
+    resetIds();
+    // вторичные индексы с диска верны, только если после контрольной точки ничего не менялось
+    std::string sidxFile = dbFilename + ".sidx";
+    if(replayed > 0 || !sidx.load(sidxFile, recordCount(), generation)){
+        sidx.setMask(SecondaryIndexes::readMask(sidxFile));
+        rebuildSecondary();
+    }
+    // колонки включены, если их файлы есть; как и вторичные индексы, после восстановления строятся заново
+    std::string colPrefix = dbFilename + ".col";
+    cols.setEnabled(ColumnStore::exists(colPrefix));
+    colsDirty = false;
+    if(cols.enabled() && (replayed > 0 || !cols.load(colPrefix, recordCount(), generation))){
+        rebuildColumns();
+    }
+    if(replayed > 0){
+        LOG_INFO("Recovered " << replayed << " journal records");
+        rebuildFreeList();
+    } else if(!loadFreeList()){
+        rebuildFreeList();
+    }
+    // восстановленный файл или перестроенный индекс закрепляются новым поколением
+    if(replayed > 0 || !indexOk){
+        generationDirty = true;
+        checkpoint();
+    }
+    if(dataStart == 0 && !upgradeDataFile()){
+        LOG_ERROR("Cannot upgrade the data file format of " << dbFilename);
+        wal.close();
+        index.close();
+        fm.closeFile();
+        return false;
+    }
+    stats.invalidate();
+
+    openFlag = true;
+    readOnly = false;
+    noteChange(Change::RESET, -1, nullptr, nullptr);
+    return true;
+}
+
+bool Database::close(){
+    std::lock_guard<RwLock> lock(rwLock);
+    return closeLocked();
+}
+
+bool Database::closeLocked(){
+    if(!openFlag) return true;
+    checkpoint();
+    releaseLocked();
+    return true;
+}
+
+void Database::releaseLocked(){
+    wal.close();
+    index.close();
+    fm.closeFile();
+    shm.detach();
+    snapshotBase = 0;
+    ids.clear();
+    idsOn = false;
+    openFlag = false;
+    readOnly = false;
+}
+
+bool Database::writerActive(const std::string &filename){
+    return SharedSegment::writerActive(filename + ".shm");
+}
+
+std::string Database::snapshotFile(uint64_t generation) const {
+    return idxFilename + "." + std::to_string(generation);
+}
+
+bool Database::publishSnapshot(){
+    if(!shm.isWriter() || !unpublished) return true;
+    // снимок - полная копия файла дерева либо наложение из страниц, изменённых после
+    // неё; наложение растёт, пока не займёт четверть дерева, затем снимается новая копия.
+    // Прежний снимок удаляется, но у читателей, которые его открыли, он остаётся до их
+    // перехода на новый
+    if(!fm.sync() || !index.sync()) return false;
+    uint64_t next = shm.generation() + 1;
+    std::string snap = snapshotFile(next), tmp = snap + ".tmp";
+    FileManager::Changes changes = index.changedPages(FileManager::TRACK_PUBLISH);
+    size_t pageSize = index.filePageSize();
+    std::vector<uint64_t> pages = changedPageList(changes, index.fileSize(), pageSize);
+    long long treePages = (index.fileSize() + (long long)pageSize - 1) / (long long)pageSize;
+    bool full = snapshotBase == 0 || changes.all || (long long)pages.size() * 4 > treePages;
+    bool written = full ? FileManager::copyFile(idxFilename, tmp) : index.writeOverlay(tmp, snapshotBase, pages);
+    if(!written || std::rename(tmp.c_str(), snap.c_str()) != 0){
+        std::remove(tmp.c_str());
+        return false;
+    }
+    if(shm.publish(fm.size(), index.size()) != next) return false;
+    if(next > 1 && next - 1 != snapshotBase){
+        uint64_t base;
+        // наложение, оставшееся от прошлого открытия: его копия тоже больше не нужна
+        if(snapshotBase == 0 && BPlusTree::overlayBase(snapshotFile(next - 1), base)) std::remove(snapshotFile(base).c_str());
+        std::remove(snapshotFile(next - 1).c_str());
+    }
+    if(full){
+        if(snapshotBase != 0) std::remove(snapshotFile(snapshotBase).c_str());
+        snapshotBase = next;
+        index.clearChangedPages(FileManager::TRACK_PUBLISH);
+    }
+    unpublished = false;
+    lastPublish = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool Database::publish(){
+    std::lock_guard<RwLock> lock(rwLock);
+    if(!writable()) return false;
+    return checkpoint();
+}
+
+bool Database::attachSnapshot(){
+    // снимок могут удалить между чтением заголовка и открытием: тогда уже
+    // опубликован следующий, и попытка повторяется
+    for(int attempt = 0; attempt < 8; attempt++){
+        SharedSegment::State st;
+        if(!shm.read(st)) return false;
+        std::string snap = snapshotFile(st.generation);
+        uint64_t base;
+        bool opened = BPlusTree::overlayBase(snap, base) ? index.openOverlay(snapshotFile(base), snap) : index.open(snap, true);
+        if(!opened) continue;
+        // файл данных открывается заново: после сжатия писателя это уже другой файл
+        if(!fm.openFile(dbFilename, true) || !readDataHeader()){
+            fm.closeFile();
+            index.close();
+            return false;
+        }
+        attachedSeq = st.seq;
+        publishedBytes = std::min<long long>(st.dataSize, fm.size());
+        // вторичные индексы, колонки и хеш-таблицу id читатель не строит,
+        // запросы идут по дереву снимка и проходом
+        ids.clear();
+        idsOn = false;
+        freeSlots.clear();
+        sidx.setMask(0);
+        sidx.clear();
+        sidxDirty = false;
+        cols.setEnabled(false);
+        colsDirty = false;
+        stats.invalidate();
+        return true;
+    }
+    return false;
+}
+
+bool Database::refresh(){
+    {
+        std::shared_lock<RwLock> lock(rwLock);
+        if(!openFlag || !readOnly || shm.seq() == attachedSeq) return false;
+    }
+    std::unique_lock<RwLock> lock(rwLock);
+    if(!openFlag || !readOnly || shm.seq() == attachedSeq) return false;
+    if(!attachSnapshot()) LOG_ERROR("Cannot attach the index snapshot of " << dbFilename);
+    noteChange(Change::RESET, -1, nullptr, nullptr);
+    lock.unlock();
+    notifyChanges();
+    return true;
+}
+
+bool Database::removeDB(const std::string &filename){
+    close();
+    {
+        SharedSegment segment;
+        SharedSegment::State st;
+        if(segment.attach(filename + ".shm", false) && segment.read(st)){
+            std::string snap = filename + ".idx." + std::to_string(st.generation);
+            uint64_t base;
+            if(BPlusTree::overlayBase(snap, base)) std::remove((filename + ".idx." + std::to_string(base)).c_str());
+            std::remove(snap.c_str());
+        }
+    }
+    std::remove((filename + ".shm").c_str());
+    std::remove(filename.c_str());
+    std::remove((filename + ".idx").c_str());
+    std::remove((filename + ".idx.log").c_str());
+    std::remove((filename + ".wal").c_str());
+    std::remove((filename + ".free").c_str());
+    std::remove((filename + ".bkmap").c_str());
+    std::remove((filename + ".sidx").c_str());
+    for(const std::string &f: ColumnStore::files(filename + ".col")) std::remove(f.c_str());
+    std::remove((filename + ".compact").c_str());
+    std::remove((filename + ".idx.compact").c_str());
+    std::remove((filename + ".compact.done").c_str());
+    return true;
+}
+
+bool Database::clear(){
+    std::unique_lock<RwLock> lock(rwLock);
+    if(!writable()) return false;
+    checkpoint();
+    fm.truncate();
+    generation++;
+    generationDirty = false;
+    writeDataHeader(fm, generation, 0);
+    fm.sync();
+    index.clear();
+    index.setDataStamp(generation, 0);
+    index.sync();
+    resetIds();
+    freeSlots.clear();
+    freeDirty = true;
+    persistFreeList();
+    sidx.clear();
+    sidxDirty = true;
+    persistSecondary();
+    cols.clear();
+    colsDirty = true;
+    persistColumns();
+    stats.reset();
+    unpublished = true;
+    publishSnapshot();
+    noteChange(Change::RESET, -1, nullptr, nullptr);
+    lock.unlock();
+    notifyChanges();
+    return true;
+}
+
+bool Database::save(){
+    std::lock_guard<RwLock> lock(rwLock);
+    if(!writable()) return false;
+    return checkpoint();
+}
+
+void Database::setDurability(Wal::Durability d, int batchMs){
+    wal.setDurability(d, batchMs);
+}
+
+void Database::setChangeHook(const std::function<void(const std::vector<Change>&)> &hook){
+    std::lock_guard<std::mutex> lock(changeMutex);
+    changeHook = hook;
+    pendingChanges.clear();
+}
+
+void Database::noteChange(Change::Kind kind, long long offset, const StoredStudent *before, const StoredStudent *after){
+    std::lock_guard<std::mutex> lock(changeMutex);
+    if(!changeHook) return;
+    Change c;
+    memset(&c, 0, sizeof(c));
+    c.kind = kind;
+    c.offset = offset;
+    if(before) c.before = *before;
+    if(after) c.after = *after;
+    c.id = after ? after->id : before ? before->id : 0;
+    pendingChanges.push_back(c);
+}
+
+void Database::notifyChanges(){
+    std::vector<Change> batch;
+    std::function<void(const std::vector<Change>&)> hook;
+    {
+        std::lock_guard<std::mutex> lock(changeMutex);
+        batch.swap(pendingChanges);
+        hook = changeHook;
+    }
+    if(hook && !batch.empty()) hook(batch);
+}
+
+void Database::setScanThreads(size_t threads){
+    std::lock_guard<RwLock> lock(rwLock);
+    std::lock_guard<std::mutex> poolLock(poolMutex);
+    scanThreads = threads;
+    pool.reset();
+}
+
+ThreadPool *Database::scanPool(){
+    size_t threads = scanThreads ? scanThreads : std::thread::hardware_concurrency();
+    if(threads <= 1) return nullptr;
+    // вызывающий поток тоже обрабатывает куски, поэтому в пуле на один поток меньше;
+    // пул создаёт первый из параллельных читателей
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if(!pool) pool.reset(new ThreadPool(threads - 1));
+    return pool.get();
+}
+
+long long Database::appendRecordToFile(const StoredStudent &rs, unsigned long long lsn){
+    return fm.append((const char*)&rs, sizeof(StoredStudent), lsn);
+}
+
+bool Database::writeDataHeader(FileManager &file, uint64_t generation, long long records){
+    DataHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = DATA_MAGIC;
+    h.version = DATA_VERSION;
+    h.recordSize = sizeof(StoredStudent);
+    h.generation = generation;
+    h.records = (uint64_t)records;
+    h.crc = crc32(&h, offsetof(DataHeader, crc));
+    return file.writeAt(0, (const char*)&h, sizeof(h));
+}
+
+bool Database::readDataHeader(){
+    dataStart = 0;
+    generation = 0;
+    DataHeader h;
+    // файл без сигнатуры - массив записей старого формата
+    if(fm.size() < (long long)sizeof(h) || !fm.readAt(0, (char*)&h, sizeof(h)) || h.magic != DATA_MAGIC){return true;}
+    if(h.crc != crc32(&h, offsetof(DataHeader, crc)) || h.version != DATA_VERSION
+       || h.recordSize != sizeof(StoredStudent)){return false;}
+    dataStart = (long long)sizeof(DataHeader);
+    generation = h.generation;
+    return true;
+}
+
+bool Database::stampGeneration(){
+    // файл старого формата получает заголовок только в upgradeDataFile()
+    if(dataStart == 0){return true;}
+    if(!writeDataHeader(fm, generation + 1, recordCount())){return false;}
+    generation++;
+    generationDirty = false;
+    index.setDataStamp(generation, (uint64_t)recordCount());
+    // вторичные индексы и колонки записываются заново с той же отметкой
+    if(sidx.mask() != 0) sidxDirty = true;
+    if(cols.enabled()) colsDirty = true;
+    return true;
+}
+
+bool Database::upgradeDataFile(){
+    // записи сдвигаются за заголовок, поэтому всё, что хранит смещения, строится заново;
+    // до подмены файла сохранённые вторичные индексы и свободные места объявляются
+    // устаревшими, чтобы сбой после подмены не оставил их указывать на старые смещения
+    if(!checkpoint()){return false;}
+    LOG_INFO("Upgrading " << dbFilename << " to data format version " << DATA_VERSION);
+    std::string tmp = dbFilename + ".upgrade";
+    {
+        FileManager out;
+        RecordSpan records = scanRecords();
+        if(!out.createFile(tmp) || !writeDataHeader(out, 1, (long long)records.size())
+           || (records.size() > 0 && out.append((const char*)records.data, records.size() * sizeof(StoredStudent)) < 0)
+           || !out.sync()){
+            out.closeFile();
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    if(sidx.mask() != 0 && !sidx.save(dbFilename + ".sidx", -1, 0)){return false;}
+    std::remove((dbFilename + ".free").c_str());
+    fm.closeFile();
+    if(std::rename(tmp.c_str(), dbFilename.c_str()) != 0 || !FileManager::syncPath(dbFilename)){
+        std::remove(tmp.c_str());
+        return false;
+    }
+    if(!fm.openFile(dbFilename) || !readDataHeader() || dataStart == 0){return false;}
+    if(!rebuildIndex()){return false;}
+    resetIds();
+    rebuildFreeList();
+    rebuildSecondary();
+    generationDirty = true;
+    return checkpoint();
+}
+
+bool Database::loadIndex(){
+    // файл старого формата (снимок пар id/смещение) или повреждённое дерево
+    // заменяются пустым деревом, которое затем строится по файлу данных.
+    // Дерево верно, если оно закрыто после последних изменений и записано по тому же
+    // поколению файла данных: проверка читает только метаданные, а не записи
+    if(index.open(idxFilename)){
+        if(index.wasCleanAtOpen() && dataStart > 0 && index.dataGeneration() == generation
+           && index.dataRecords() == (uint64_t)recordCount()){return true;}
+        index.clear();
+        return false;
+    }
+    std::remove((idxFilename + ".log").c_str());
+    index.create(idxFilename);
+    return false;
+}
+
+bool Database::rebuildIndex(){
+    typedef std::vector<std::pair<int, long long>> Entries;
+    auto byId = [](const std::pair<int, long long> &a, const std::pair<int, long long> &b){
+        return a.first < b.first;
+    };
+    // куски собираются и сортируются параллельно, затем сливаются по порядку;
+    // слияние устойчиво, так что при повторе id побеждает запись с большим смещением,
+    // как при последовательных вставках
+    RecordSpan records = scanRecords();
+    metrics.add(Metrics::RECORDS_SCANNED, records.size());
+    std::vector<Entries> parts = scanParts<Entries>(scanPool(), records.size(), [&](size_t first, size_t last, Entries &part){
+        for(size_t i = first; i < last; i++){
+            if(records.data[i].isActive) part.push_back({records.data[i].id, rowOffset(i)});
+        }
+        std::stable_sort(part.begin(), part.end(), byId);
+    });
+    Entries entries;
+    std::vector<size_t> bounds{0};
+    for(auto &p: parts){
+        entries.insert(entries.end(), p.begin(), p.end());
+        bounds.push_back(entries.size());
+        Entries().swap(p);
+    }
+    for(size_t width = 1; width + 1 < bounds.size(); width *= 2){
+        for(size_t b = 0; b + width < bounds.size() - 1; b += 2 * width){
+            size_t mid = bounds[b + width], end = bounds[std::min(b + 2 * width, bounds.size() - 1)];
+            std::inplace_merge(entries.begin() + bounds[b], entries.begin() + mid, entries.begin() + end, byId);
+        }
+    }
+    size_t n = 0;
+    for(size_t i = 0; i < entries.size(); i++){
+        if(n > 0 && entries[n-1].first == entries[i].first) entries[n-1] = entries[i];
+        else entries[n++] = entries[i];
+    }
+    entries.resize(n);
+    return index.build(entries) && index.sync();
+}
+
+void Database::resetIds(){
+    ids.clear();
+    idsOn = true;
+}
+
+void Database::idsPut(int id, long long offset){
+    long long row = (long long)rowOf(offset);
+    if(offset < dataStart || (offset - dataStart) % (long long)sizeof(StoredStudent) != 0 || row > (long long)UINT32_MAX){
+        // номер записи не помещается в 32 бита: этот id ищется в дереве
+        ids.erase(id);
+        return;
+    }
+    ids.insert(id, (uint32_t)row);
+}
+
+bool Database::findId(int id, long long &offset){
+    // попадание или промах считается один раз на поиск: и по таблице id, и по дереву
+    bool found = lookupId(id, offset);
+    metrics.add(found ? Metrics::INDEX_HITS : Metrics::INDEX_MISSES);
+    return found;
+}
+
+bool Database::lookupId(int id, long long &offset){
+    if(!idsOn) return index.find(id, offset);
+    {
+        std::shared_lock<std::shared_mutex> g(idsMutex);
+        uint32_t row;
+        if(ids.find(id, row)){
+            offset = rowOffset(row);
+            return true;
+        }
+        // таблица заполнена целиком: ключа нет и в дереве
+        if(ids.size() == index.size()) return false;
+    }
+    if(!index.find(id, offset)) return false;
+    std::lock_guard<std::shared_mutex> g(idsMutex);
+    idsPut(id, offset);
+    return true;
+}
+
+// изменения идут под исключительной блокировкой rwLock, заполняющих таблицу читателей нет
+void Database::indexPut(int id, long long offset){
+    index.insert(id, offset);
+    if(idsOn) idsPut(id, offset);
+}
+
+void Database::indexErase(int id){
+    index.erase(id);
+    if(idsOn) ids.erase(id);
+}
+
+std::vector<bool> Database::liveSlots(){
+    std::vector<bool> live((size_t)recordCount(), false);
+    for(BPlusTree::Iterator it = index.begin(); it.valid(); it.next()){
+        size_t slot = rowOf(it.value());
+        if(slot < live.size()) live[slot] = true;
+    }
+    return live;
+}
+
+unsigned long long Database::logMutation(const std::vector<WalEntry> &ops){
+    unpublished = true;
+    generationDirty = true;
+    return wal.append((const char*)ops.data(), ops.size() * sizeof(WalEntry));
+}
+
+bool Database::applyWalRecord(const char *payload, size_t size){
+    size_t pos = 0;
+    while(pos < size){
+        if(size - pos < sizeof(WalEntry)){return false;}
+        WalEntry e;
+        memcpy(&e, payload + pos, sizeof(e));
+        pos += sizeof(WalEntry);
+        if(e.type == WAL_APPEND){
+            // пакет записей подряд с e.offset, каждая попадает в индекс
+            size_t bytes = (size_t)e.id * sizeof(StoredStudent);
+            if(e.id < 0 || size - pos < bytes){return false;}
+            if(!fm.writeAt(e.offset, payload + pos, bytes)){return false;}
+            for(int k = 0; k < e.id; k++){
+                StoredStudent rs;
+                memcpy(&rs, payload + pos + k * sizeof(StoredStudent), sizeof(rs));
+                long long off = e.offset + (long long)k * sizeof(StoredStudent);
+                indexPut(rs.id, off);
+            }
+            pos += bytes;
+        } else if(e.type == WAL_RECORD){
+            if(!fm.writeAt(e.offset, (const char*)&e.image, sizeof(StoredStudent))){return false;}
+        } else if(e.type == WAL_INDEX){
+            if(e.offset < 0) indexErase(e.id);
+            else indexPut(e.id, e.offset);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Database::checkpoint(){
+    if(readOnly){return true;}
+    Metrics::Timer timer(metrics, Metrics::OP_CHECKPOINT);
+    // порядок важен: журнал -> файл данных -> индекс -> очистка WAL -> снимок для читателей;
+    // новое поколение попадает в индекс только после файла данных
+    if(!wal.flushAll()){return false;}
+    if(generationDirty){
+        if(!stampGeneration()){return false;}
+        backupMapDirty = true;
+    }
+    if(!fm.sync()){return false;}
+    if(!index.sync()){return false;}
+    if(!persistFreeList()){return false;}
+    if(!persistSecondary()){return false;}
+    if(!persistColumns()){return false;}
+    // учёт страниц для копий сохраняется до очистки журнала: после сбоя повтор
+    // журнала снова отметит всё, что изменилось после этой точки
+    if(!persistBackupMap()){return false;}
+    if(!wal.reset()){return false;}
+    return publishSnapshot();
+}
+
+void Database::secondaryInsert(const StoredStudent &rs, long long offset){
+    if(sidx.mask() == 0 || rs.isActive == 0) return;
+    sidx.insert(rs.name, rs.cours, rs.averageGrade, offset);
+    sidxDirty = true;
+}
+
+void Database::secondaryErase(const StoredStudent &rs, long long offset){
+    if(sidx.mask() == 0 || rs.isActive == 0) return;
+    sidx.erase(rs.name, rs.cours, rs.averageGrade, offset);
+    sidxDirty = true;
+}
+
+void Database::rebuildSecondary(){
+    sidx.clear();
+    sidxDirty = true;
+    if(sidx.mask() == 0) return;
+    std::vector<bool> live = liveSlots();
+    RecordSpan records = scanRecords();
+    for(size_t i = 0; i < records.size() && i < live.size(); i++){
+        if(live[i]) secondaryInsert(records.data[i], rowOffset(i));
+    }
+}
+
+bool Database::persistSecondary(){
+    if(!sidxDirty){return true;}
+    std::string path = dbFilename + ".sidx";
+    if(sidx.mask() == 0){
+        std::remove(path.c_str());
+    } else if(!sidx.save(path, recordCount(), generation)){
+        return false;
+    }
+    sidxDirty = false;
+    return true;
+}
+
+void Database::columnsPut(const StoredStudent &rs, long long offset){
+    if(!cols.enabled()) return;
+    cols.put(rowOf(offset), rs.id, rs.cours, rs.averageGrade, rs.isActive != 0);
+    colsDirty = true;
+}
+
+void Database::rebuildColumns(){
+    cols.clear();
+    colsDirty = true;
+    if(!cols.enabled()) return;
+    RecordSpan records = scanRecords();
+    for(size_t i = 0; i < records.size(); i++){
+        columnsPut(records.data[i], rowOffset(i));
+    }
+}
+
+bool Database::persistColumns(){
+    if(!colsDirty){return true;}
+    std::string prefix = dbFilename + ".col";
+    long long count = recordCount();
+    if(!cols.enabled()){
+        for(const std::string &f: ColumnStore::files(prefix)) std::remove(f.c_str());
+    } else {
+        if((long long)cols.rows() != count) rebuildColumns();
+        if(!cols.save(prefix, count, generation)){return false;}
+    }
+    colsDirty = false;
+    return true;
+}
+
+bool Database::columnOffsets(const std::string &field, double lo, double hi, std::vector<long long> &offsets){
+    if(!cols.enabled()){return false;}
+    std::vector<uint64_t> bits;
+    if(field == "cours"){
+        int ilo = lo <= (double)INT_MIN ? INT_MIN : lo >= (double)INT_MAX ? INT_MAX : (int)std::ceil(lo);
+        int ihi = hi >= (double)INT_MAX ? INT_MAX : hi <= (double)INT_MIN ? INT_MIN : (int)std::floor(hi);
+        cols.selectCours(ilo, ihi, bits);
+    } else if(field == "averageGrade"){
+        cols.selectGrade(lo, hi, bits);
+    } else {
+        return false;
+    }
+    std::vector<size_t> rows = ColumnStore::selectedRows(bits);
+    offsets.resize(rows.size());
+    for(size_t i = 0; i < rows.size(); i++) offsets[i] = rowOffset(rows[i]);
+    return true;
+}
+
+void Database::statsInsert(const StoredStudent &rs){
+    if(rs.isActive != 0) stats.insert(rs.cours, rs.averageGrade);
+}
+
+void Database::statsErase(const StoredStudent &rs){
+    if(rs.isActive != 0) stats.erase(rs.cours, rs.averageGrade);
+}
+
+void Database::rebuildStats(){
+    // куски файла считаются параллельно, затем их группы складываются
+    std::vector<bool> live = liveSlots();
+    RecordSpan records = scanRecords();
+    metrics.add(Metrics::RECORDS_SCANNED, records.size());
+    typedef std::map<int, std::map<double, long long>> Groups;
+    std::vector<Groups> parts = scanParts<Groups>(scanPool(), records.size(), [&](size_t first, size_t last, Groups &part){
+        for(size_t i = first; i < last && i < live.size(); i++){
+            if(live[i]) part[records.data[i].cours][records.data[i].averageGrade]++;
+        }
+    });
+    stats.reset();
+    for(const Groups &part: parts){
+        for(const auto &group: part){
+            for(const auto &grade: group.second) stats.add(group.first, grade.first, grade.second);
+        }
+    }
+}
+
+bool Database::aggregateGroups(const std::string &field, const Query &q, std::map<int, Aggregate> &out, Progress *progress){
+    bool grade = field == "averageGrade";
+    if(!grade && field != "cours"){return false;}
+    out.clear();
+    if(q.empty()){
+        // статистику меняют только писатели под исключительной блокировкой,
+        // а перестроить её может любой из читателей - по одному
+        std::lock_guard<std::mutex> statsLock(statsMutex);
+        if(!stats.valid()) rebuildStats();
+        out = stats.groups(grade);
+        return true;
+    }
+
+    RecordSpan records = scanRecords();
+    auto value = [grade](const StoredStudent &rs){ return grade ? rs.averageGrade : (double)rs.cours; };
+    std::vector<long long> offsets;
+    std::string plan;
+    if(queryCandidates(q, offsets, plan)){
+        metrics.add(Metrics::RECORDS_SCANNED, offsets.size());
+        for(long long off: offsets){
+            size_t row = rowOf(off);
+            if(row >= records.size()) continue;
+            const StoredStudent &rs = records.data[row];
+            if(rs.isActive != 0 && q.matches(rs)) out[rs.cours].add(value(rs));
+        }
+        return true;
+    }
+    // значения складываются прямо из отображения файла, у каждого куска свои группы
+    metrics.add(Metrics::RECORDS_SCANNED, records.size());
+    typedef std::map<int, Aggregate> Groups;
+    std::vector<Groups> parts = scanParts<Groups>(scanPool(), records.size(), [&](size_t first, size_t last, Groups &part){
+        for(size_t i = first; i < last; i++){
+            const StoredStudent &rs = records.data[i];
+            if(rs.isActive != 0 && q.matches(rs)) part[rs.cours].add(value(rs));
+        }
+    }, progress);
+    if(progress && progress->cancelled()){return false;}
+    for(const Groups &part: parts){
+        for(const auto &kv: part) out[kv.first].merge(kv.second);
+    }
+    return true;
+}
+
+bool Database::aggregate(const std::string &field, const Query &q, Aggregate &out, Progress *progress){
+    Metrics::Timer timer(metrics, Metrics::OP_AGGREGATE);
+    out = Aggregate();
+    refresh();
+    std::shared_lock<RwLock> lock(rwLock);
+    if(!openFlag){return false;}
+    std::map<int, Aggregate> groups;
+    if(!aggregateGroups(field, q, groups, progress)){return false;}
+    for(const auto &kv: groups) out.merge(kv.second);
+    return true;
+}
+
+bool Database::aggregateByCours(const std::string &field, const Query &q, std::map<int, Aggregate> &out, Progress *progress){
+    Metrics::Timer timer(metrics, Metrics::OP_AGGREGATE);
+    out.clear();
+    refresh();
+    std::shared_lock<RwLock> lock(rwLock);
+    if(!openFlag){return false;}
+    if(aggregateGroups(field, q, out, progress)){return true;}
+    out.clear();
+    return false;
+}
+
+bool Database::setColumnStore(bool enabled){
+    std::lock_guard<RwLock> lock(rwLock);
+    if(!writable()) return false;
+    if(cols.enabled() == enabled) return true;
+    cols.setEnabled(enabled);
+    rebuildColumns();
+    return checkpoint();
+}
+
+bool Database::createIndex(const std::string &field){
+    unsigned f = SecondaryIndexes::fieldFromName(field);
+    if(f == 0) return false;
+    std::lock_guard<RwLock> lock(rwLock);
+    if(!writable()) return false;
+    if(sidx.enabled(f)) return true;
+    sidx.setMask(sidx.mask() | f);
+    rebuildSecondary();
+    return checkpoint();
+}
+
+bool Database::dropIndex(const std::string &field){
+    unsigned f = SecondaryIndexes::fieldFromName(field);
+    if(f == 0) return false;
+    std::lock_guard<RwLock> lock(rwLock);
+    if(!writable()) return false;
+    if(!sidx.enabled(f)) return true;
+    sidx.setMask(sidx.mask() & ~f);
+    sidxDirty = true;
+    return checkpoint();
+}
+
+bool Database::hasIndex(const std::string &field) const {
+    unsigned f = SecondaryIndexes::fieldFromName(field);
+    std::shared_lock<RwLock> lock(rwLock);
+    return f != 0 && sidx.enabled(f);
+}
+
+bool Database::loadFreeList(){
+    freeSlots.clear();
+    std::ifstream ifs(dbFilename + ".free", std::ios::binary);
+    if(!ifs){return false;}
+    long long off;
+    while(ifs.read((char*)&off, sizeof(off))){
+        freeSlots.push_back(off);
+    }
+    freeDirty = false;
+    return true;
+}
+
+bool Database::persistFreeList(){
+    if(!freeDirty){return true;}
+    std::string path = dbFilename + ".free";
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if(!ofs){return false;}
+        ofs.write((const char*)freeSlots.data(), freeSlots.size() * sizeof(long long));
+        if(!ofs){return false;}
+    }
+    if(std::rename(tmp.c_str(), path.c_str()) != 0){return false;}
+    freeDirty = false;
+    return true;
+}
+
+bool Database::loadBackupMap(bool indexValid){
+    backupChain = 0;
+    backupSeq = 0;
+    backupMapDirty = false;
+    std::ifstream ifs(dbFilename + ".bkmap", std::ios::binary);
+    BackupMapHeader h;
+    if(!ifs || !ifs.read((char*)&h, sizeof(h)) || h.magic != BKMAP_MAGIC
+       || h.dataWords > BKMAP_MAX_WORDS || h.idxWords > BKMAP_MAX_WORDS){return false;}
+    FileManager::Changes data, idx;
+    data.all = h.dataAll != 0;
+    idx.all = h.idxAll != 0;
+    data.bits.resize((size_t)h.dataWords);
+    idx.bits.resize((size_t)h.idxWords);
+    uint32_t crc = 0;
+    if(!ifs.read((char*)data.bits.data(), data.bits.size() * sizeof(uint64_t))
+       || !ifs.read((char*)idx.bits.data(), idx.bits.size() * sizeof(uint64_t))
+       || !ifs.read((char*)&crc, sizeof(crc))){return false;}
+    uint32_t expect = crc32(&h, sizeof(h));
+    expect = crc32(data.bits.data(), data.bits.size() * sizeof(uint64_t), expect);
+    expect = crc32(idx.bits.data(), idx.bits.size() * sizeof(uint64_t), expect);
+    if(crc != expect){return false;}
+    backupChain = h.chain;
+    backupSeq = h.seq;
+    // учёт другого поколения неполон: изменения после него не сохранены,
+    // и следующая дельта берёт файлы целиком
+    if(h.generation != generation || dataStart == 0){return true;}
+    if(h.dataPageSize == fm.getPageSize()) fm.setChangedPages(data);
+    if(indexValid && h.idxPageSize == index.filePageSize()) index.setChangedPages(idx);
+    return true;
+}
+
+bool Database::persistBackupMap(){
+    if(!backupMapDirty || backupChain == 0){return true;}
+    FileManager::Changes data = fm.changedPages(), idx = index.changedPages();
+    BackupMapHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = BKMAP_MAGIC;
+    h.seq = backupSeq;
+    h.chain = backupChain;
+    h.generation = generation;
+    h.dataPageSize = (uint32_t)fm.getPageSize();
+    h.idxPageSize = (uint32_t)index.filePageSize();
+    h.dataAll = data.all ? 1 : 0;
+    h.idxAll = idx.all ? 1 : 0;
+    h.dataWords = data.bits.size();
+    h.idxWords = idx.bits.size();
+    uint32_t crc = crc32(&h, sizeof(h));
+    crc = crc32(data.bits.data(), data.bits.size() * sizeof(uint64_t), crc);
+    crc = crc32(idx.bits.data(), idx.bits.size() * sizeof(uint64_t), crc);
+    std::string path = dbFilename + ".bkmap";
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if(!ofs){return false;}
+        ofs.write((const char*)&h, sizeof(h));
+        ofs.write((const char*)data.bits.data(), data.bits.size() * sizeof(uint64_t));
+        ofs.write((const char*)idx.bits.data(), idx.bits.size() * sizeof(uint64_t));
+        ofs.write((const char*)&crc, sizeof(crc));
+        if(!ofs){return false;}
+    }
+    // потерянный после сбоя учёт привёл бы к дельте без части изменений
+    if(!FileManager::syncPath(tmp) || std::rename(tmp.c_str(), path.c_str()) != 0){return false;}
+    backupMapDirty = false;
+    return true;
+}
+
+void Database::rebuildFreeList(){
+    freeSlots.clear();
+    std::vector<bool> live = liveSlots();
+    RecordSpan records = scanRecords();
+    for(size_t i = 0; i < records.size(); i++){
+        if(records.data[i].isActive || (i < live.size() && live[i])) continue;
+        freeSlots.push_back(rowOffset(i));
+    }
+    freeDirty = true;
+}
+
+bool Database::takeFreeSlot(long long &offset){
+    // список может быть устаревшим после сбоя, поэтому место проверяется перед записью
+    while(!freeSlots.empty()){
+        long long cand = freeSlots.back();
+        freeSlots.pop_back();
+        freeDirty = true;
+        StoredStudent rs;
+        if(cand < dataStart || (cand - dataStart) % (long long)sizeof(StoredStudent) != 0
+           || !readRecordAt(cand, rs) || rs.isActive != 0) continue;
+        long long cur;
+        if(findId(rs.id, cur) && cur == cand) continue;
+        offset = cand;
+        return true;
+    }
+    return false;
+}
+
+void Database::maybeCheckpoint(){
+    bool publishDue = publishMs > 0 && shm.isWriter()
+        && std::chrono::steady_clock::now() - lastPublish >= std::chrono::milliseconds(publishMs);
+    if(wal.size() > WAL_CHECKPOINT_BYTES || publishDue){
+        checkpoint();
+    }
+}
+
+bool Database::addRecord(const Student &s, std::string &err){
+    Metrics::Timer timer(metrics, Metrics::OP_ADD);
+    std::unique_lock<RwLock> lock(rwLock);
+    if(!openFlag){ err = "DB is not open"; return false; }
+    if(readOnly){ err = "DB is open read-only"; return false; }
+    
+    long long existing;
+    if(findId(s.id, existing)){ 
+        LOG_DEBUG("addRecord: duplicate id " << s.id);
+        err = "duplicate key (id)"; 
+        return false; 
+    }
+    
+    StoredStudent rs = toStored(s);
+    
+    // место удалённой записи занимается раньше, чем файл растёт
+    long long off;
+    bool reuse = takeFreeSlot(off);
+    if(!reuse) off = fm.size();
+    unsigned long long lsn = logMutation({recordOp(off, rs), indexOp(s.id, off)});
+    if(lsn == 0){err = "journal write error"; return false;}
+    
+    if(reuse){
+        if(!fm.writeAt(off, (const char*)&rs, sizeof(StoredStudent), lsn)) off = -1;
+    } else {
+        off = appendRecordToFile(rs, lsn);
+    }
+    if(off < 0){err = "file write error"; return false;}
+    
+    indexPut(s.id, off);
+    secondaryInsert(rs, off);
+    columnsPut(rs, off);
+    statsInsert(rs);
+    noteChange(Change::INSERTED, off, nullptr, &rs);
+    maybeCheckpoint();
+    LOG_DEBUG("addRecord: id " << s.id << " at offset " << off << (reuse ? " (reused slot)" : "")
+              << ", index size " << index.size());
+    lock.unlock();
+    
+    // ожидание fsync вне блокировки, чтобы параллельные вставки делили один commit
+    bool committed = wal.commit(lsn);
+    notifyChanges();
+    if(!committed){err = "journal sync error"; return false;}
+    return true;
+}
+
+size_t Database::addRecords(const std::vector<Student> &students, std::vector<std::string> &errors){
+    Metrics::Timer timer(metrics, Metrics::OP_ADD_BATCH);
+    std::unique_lock<RwLock> lock(rwLock);
+    if(!openFlag){ errors.push_back("DB is not open"); return 0; }
+    if(readOnly){ errors.push_back("DB is open read-only"); return 0; }
+
+    // дубликаты отсеиваются заранее: и с индексом, и внутри самого пакета
+    std::vector<StoredStudent> batch;
+    batch.reserve(students.size());
+    std::unordered_set<int> batchIds;
+    batchIds.reserve(students.size());
+    for(size_t i = 0; i < students.size(); i++){
+        const Student &s = students[i];
+        long long existing;
+        if(findId(s.id, existing) || !batchIds.insert(s.id).second){
+            errors.push_back("row " + std::to_string(i) + ": duplicate key (id) " + std::to_string(s.id));
+            continue;
+        }
+        batch.push_back(toStored(s));
+    }
+    if(batch.empty()) return 0;
+
+    long long base = fm.size();
+    size_t bytes = batch.size() * sizeof(StoredStudent);
+    WalEntry head;
+    memset(&head, 0, sizeof(head));
+    head.type = WAL_APPEND;
+    head.offset = base;
+    head.id = (int)batch.size();
+    std::vector<char> payload(sizeof(WalEntry) + bytes);
+    memcpy(payload.data(), &head, sizeof(head));
+    memcpy(payload.data() + sizeof(head), batch.data(), bytes);
+    unpublished = true;
+    generationDirty = true;
+    unsigned long long lsn = wal.append(payload.data(), payload.size());
+    if(lsn == 0){ errors.push_back("journal write error"); return 0; }
+
+    if(fm.append((const char*)batch.data(), bytes, lsn) != base){
+        errors.push_back("file write error");
+        return 0;
+    }
+
+    for(size_t k = 0; k < batch.size(); k++){
+        long long off = base + (long long)k * sizeof(StoredStudent);
+        indexPut(batch[k].id, off);
+        secondaryInsert(batch[k], off);
+        columnsPut(batch[k], off);
+        statsInsert(batch[k]);
+        noteChange(Change::INSERTED, off, nullptr, &batch[k]);
+    }
+    maybeCheckpoint();
+    LOG_DEBUG("Batch insert: " << batch.size() << " records added, "
+              << (students.size() - batch.size()) << " rejected");
+    lock.unlock();
+
+    if(!wal.commit(lsn)){ errors.push_back("journal sync error"); }
+    notifyChanges();
+    return batch.size();
+}
+
+bool Database::readRecordAt(long long offset, StoredStudent &out){
+    if(!fm.readAt(offset, (char*)&out, sizeof(StoredStudent))){return false;}
+    return true;
+}
+
+RecordSpan Database::scanRecords(){
+    size_t bytes = 0;
+    const char *p = fm.mapView(bytes);
+    // читатель не видит записей, дописанных после публикации его снимка
+    if(readOnly) bytes = std::min(bytes, (size_t)publishedBytes);
+    if(!p || bytes <= (size_t)dataStart) return RecordSpan{nullptr, 0};
+    return RecordSpan{(const StoredStudent*)(p + dataStart), (bytes - (size_t)dataStart) / sizeof(StoredStudent)};
+}
+
+bool Database::markRecordDeleted(long long offset, unsigned long long lsn){
+    StoredStudent rs;
+    if(!readRecordAt(offset, rs)){return false;}
+    if(rs.isActive == 0){return false;}
+    rs.isActive = 0;
+    if(!fm.writeAt(offset, (const char*)&rs, sizeof(StoredStudent), lsn)){return false;}
+    return true;
+}
+
+
+std::vector<Student> Database::searchByField(const std::string &field, const std::string &value, Progress *progress){
+    if(!Query::isField(field)) return {};
+    return search(Query::where(field, Query::EQ, value), progress);
+}
+
+std::vector<Student> Database::search(const Query &q, Progress *progress){
+    Metrics::Timer timer(metrics, Metrics::OP_SEARCH);
+    std::vector<Student> res;
+    refresh();
+    std::shared_lock<RwLock> lock(rwLock);
+    if(!openFlag) return res;
+    std::vector<std::pair<long long, StoredStudent>> found = collectQuery(q, progress);
+    res.reserve(found.size());
+    for(auto &f: found) res.push_back(toStudent(f.second));
+    return res;
+}
+
+size_t Database::deleteByField(const std::string &field, const std::string &value, Progress *progress){
+    if(!Query::isField(field)) return 0;
+    return deleteWhere(Query::where(field, Query::EQ, value), progress);
+}
+
+size_t Database::deleteWhere(const Query &q, Progress *progress){
+    Metrics::Timer timer(metrics, Metrics::OP_DELETE);
+    // удаляемые записи собираются под общей блокировкой, не мешая читателям,
+    // затем одной записью журнала помечаются; отмена возможна только до записи в журнал
+    std::vector<std::pair<long long, StoredStudent>> victims;
+    {
+        std::shared_lock<RwLock> readLock(rwLock);
+        if(!writable()) return 0;
+        victims = collectQuery(q, progress);
+    }
+    if(progress && progress->cancelled()) return 0;
+    std::unique_lock<RwLock> lock(rwLock);
+    if(!writable()) return 0;
+    size_t deleted = deleteRecords(victims, lock);
+    lock.unlock();
+    notifyChanges();
+    return deleted;
+}
+
+std::vector<std::pair<long long, StoredStudent>> Database::collectQuery(const Query &q, Progress *progress){
+    std::vector<std::pair<long long, StoredStudent>> res;
+    std::vector<long long> offsets;
+    std::string plan;
+    if(queryCandidates(q, offsets, plan)){
+        // индекс даёт надмножество: каждый кандидат проверяется полным условием;
+        // записи читаются из отображения, минуя общий для потоков кэш страниц
+        if(progress) progress->start((long long)offsets.size());
+        RecordSpan records = scanRecords();
+        for(long long off: offsets){
+            size_t row = rowOf(off);
+            if(row >= records.size()) continue;
+            const StoredStudent &rs = records.data[row];
+            if(rs.isActive && q.matches(rs)) res.push_back({off, rs});
+        }
+        if(progress) progress->advance((long long)offsets.size());
+        metrics.add(Metrics::RECORDS_SCANNED, offsets.size());
+        LOG_DEBUG("Query " << q.toString() << ": " << plan << ", candidates: " << offsets.size()
+                  << ", found " << res.size());
+        return res;
+    }
+    res = scanMatches(q, progress);
+    if(progress && progress->cancelled()){
+        LOG_DEBUG("Query " << q.toString() << ": cancelled");
+        res.clear();
+        return res;
+    }
+    LOG_DEBUG("Query " << q.toString() << ": sequential scan of " << recordCount()
+              << " records, found " << res.size());
+    return res;
+}
+
+bool Database::queryCandidates(const Query &q, std::vector<long long> &offsets, std::string &plan){
+    std::vector<Query::Condition> conds = q.conjuncts();
+    // границы по каждому полю из условий верхнего уровня (включительные, с запасом)
+    auto bounds = [&](const std::string &field, double &lo, double &hi){
+        lo = -std::numeric_limits<double>::infinity();
+        hi = std::numeric_limits<double>::infinity();
+        bool any = false;
+        for(const Query::Condition &c: conds){
+            double v;
+            // нечисловое значение границы не даёт: такое условие проверит предикат
+            if(c.field != field || c.op == Query::NE || c.op == Query::PREFIX || !Query::toDouble(c.value, v)) continue;
+            if(c.op == Query::EQ || c.op == Query::GE || c.op == Query::GT) lo = std::max(lo, v);
+            if(c.op == Query::EQ || c.op == Query::LE || c.op == Query::LT) hi = std::min(hi, v);
+            any = true;
+        }
+        return any;
+    };
+    auto intBound = [](double v){
+        return v <= (double)INT_MIN ? INT_MIN : v >= (double)INT_MAX ? INT_MAX : (int)v;
+    };
+    double lo, hi;
+
+    if(bounds("id", lo, hi)){
+        int ilo = intBound(std::ceil(lo)), ihi = intBound(std::floor(hi));
+        long long off;
+        if(ilo == ihi){
+            if(findId(ilo, off)) offsets.push_back(off);
+        } else if(ilo < ihi){
+            for(BPlusTree::Iterator it = index.lowerBound(ilo); it.valid() && it.key() <= ihi; it.next()){
+                offsets.push_back(it.value());
+            }
+        }
+        plan = "primary index";
+        return true;
+    }
+    if(sidx.enabled(SecondaryIndexes::NAME)){
+        for(const Query::Condition &c: conds){
+            if(c.field == "name" && c.op == Query::EQ){
+                offsets = sidx.findName(c.value);
+                plan = "name index";
+                return true;
+            }
+        }
+    }
+    if(bounds("cours", lo, hi)){
+        int ilo = intBound(std::ceil(lo)), ihi = intBound(std::floor(hi));
+        if(sidx.enabled(SecondaryIndexes::COURS)){
+            if(ilo <= ihi) offsets = sidx.findCours(ilo, ihi);
+            plan = "cours index";
+            return true;
+        }
+        if(columnOffsets("cours", lo, hi, offsets)){
+            plan = "column filter";
+            return true;
+        }
+    }
+    if(bounds("averageGrade", lo, hi)){
+        // = сравнивает с погрешностью, поэтому границы расширяются на неё же
+        lo -= 0.0001;
+        hi += 0.0001;
+        if(sidx.enabled(SecondaryIndexes::GRADE)){
+            offsets = sidx.findGrade(lo, hi);
+            plan = "averageGrade index";
+            return true;
+        }
+        if(columnOffsets("averageGrade", lo, hi, offsets)){
+            plan = "column filter";
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::pair<long long, StoredStudent>> Database::scanMatches(const Query &q, Progress *progress){
+    typedef std::vector<std::pair<long long, StoredStudent>> Matches;
+    Matches res;
+    RecordSpan records = scanRecords();
+    metrics.add(Metrics::RECORDS_SCANNED, records.size());
+    std::vector<Matches> parts = scanParts<Matches>(scanPool(), records.size(), [&](size_t first, size_t last, Matches &part){
+        for(size_t i = first; i < last; i++){
+            const StoredStudent &rs = records.data[i];
+            if(rs.isActive != 0 && q.matches(rs)){
+                part.push_back({rowOffset(i), rs});
+            }
+        }
+    }, progress);
+    appendParts(res, parts);
+    return res;
+}
+
+size_t Database::deleteRecords(const std::vector<std::pair<long long, StoredStudent>> &collected, std::unique_lock<RwLock> &lock){
+    // между сбором и исключительной блокировкой запись могла измениться или
+    // освободившееся место занять другая: удаляются только оставшиеся прежними
+    std::vector<std::pair<long long, StoredStudent>> victims;
+    victims.reserve(collected.size());
+    for(auto &v: collected){
+        StoredStudent cur;
+        if(readRecordAt(v.first, cur) && memcmp(&cur, &v.second, sizeof(cur)) == 0) victims.push_back(v);
+    }
+    if(victims.empty()) return 0;
+
+    std::vector<WalEntry> ops;
+    ops.reserve(victims.size() * 2);
+    for(auto &v: victims){
+        StoredStudent dead = v.second;
+        dead.isActive = 0;
+        ops.push_back(recordOp(v.first, dead));
+        long long cur;
+        if(findId(dead.id, cur) && cur == v.first) ops.push_back(indexOp(dead.id, -1));
+    }
+    unsigned long long lsn = logMutation(ops);
+    if(lsn == 0) return 0;
+    
+    size_t deleted = 0;
+    for(auto &v: victims){
+        if(markRecordDeleted(v.first, lsn)){
+            long long cur;
+            if(findId(v.second.id, cur) && cur == v.first) {
+                indexErase(v.second.id);
+                secondaryErase(v.second, v.first);
+                statsErase(v.second);
+                freeSlots.push_back(v.first);
+                freeDirty = true;
+            }
+            cols.setActive(rowOf(v.first), false);
+            colsDirty = true;
+            noteChange(Change::DELETED, v.first, &v.second, nullptr);
+            deleted++;
+        }
+    }
+    maybeCheckpoint();
+    lock.unlock();
+    
+    bool committed = wal.commit(lsn);
+    
+    lock.lock();
+    if(!committed){
+        // удаление не дошло до диска: успехом его не считаем
+        LOG_ERROR("Journal sync failed, " << deleted << " deletions are not durable");
+        return 0;
+    }
+    // пока блокировка была отпущена, базу могли закрыть или переоткрыть на чтение
+    if(writable()) maybeAutoCompact();
+    return deleted;
+}
+
+std::vector<Student> Database::searchRange(const std::string &field, const std::string &lo, const std::string &hi){
+    Metrics::Timer timer(metrics, Metrics::OP_SEARCH_RANGE);
+    std::vector<Student> res;
+    refresh();
+    std::shared_lock<RwLock> lock(rwLock);
+    if(!openFlag) return res;
+    std::vector<std::pair<long long, StoredStudent>> found;
+    if(!collectRange(field, lo, hi, found)){
+        LOG_WARN("Range search failed for field " << field << ": unsupported field or bad bound");
+        return res;
+    }
+    res.reserve(found.size());
+    for(auto &f: found) res.push_back(toStudent(f.second));
+    LOG_DEBUG("Range search for field: " << field << " [" << lo << ", " << hi << "], found " << res.size());
+    return res;
+}
+
+size_t Database::deleteRange(const std::string &field, const std::string &lo, const std::string &hi){
+    Metrics::Timer timer(metrics, Metrics::OP_DELETE);
+    std::vector<std::pair<long long, StoredStudent>> victims;
+    {
+        std::shared_lock<RwLock> readLock(rwLock);
+        if(!writable()) return 0;
+        if(!collectRange(field, lo, hi, victims)) return 0;
+    }
+    std::unique_lock<RwLock> lock(rwLock);
+    if(!writable()) return 0;
+    size_t deleted = deleteRecords(victims, lock);
+    lock.unlock();
+    notifyChanges();
+    return deleted;
+}
+
+bool Database::collectRange(const std::string &field, const std::string &lo, const std::string &hi,
+                            std::vector<std::pair<long long, StoredStudent>> &out){
+    typedef std::vector<std::pair<long long, StoredStudent>> Matches;
+    bool hasLo = !lo.empty(), hasHi = !hi.empty();
+    RecordSpan mapped = scanRecords();
+    auto take = [&](long long off){
+        metrics.add(Metrics::RECORDS_SCANNED);
+        size_t row = rowOf(off);
+        if(row < mapped.size() && mapped.data[row].isActive) out.push_back({off, mapped.data[row]});
+    };
+    // проход по файлу кусками на пуле, совпадения в порядке файла
+    auto scan = [&](const std::function<bool(const StoredStudent&)> &pred){
+        RecordSpan records = scanRecords();
+        metrics.add(Metrics::RECORDS_SCANNED, records.size());
+        std::vector<Matches> parts = scanParts<Matches>(scanPool(), records.size(), [&](size_t first, size_t last, Matches &part){
+            for(size_t i = first; i < last; i++){
+                const StoredStudent &rs = records.data[i];
+                if(rs.isActive != 0 && pred(rs)) part.push_back({rowOffset(i), rs});
+            }
+        });
+        appendParts(out, parts);
+    };
+
+    if(field == "name"){
+        // хеш-индекс по имени порядка не хранит, поэтому только проход по файлу
+        scan([&](const StoredStudent &rs){
+            std::string name(rs.name, strnlen(rs.name, sizeof(rs.name)));
+            return !(hasLo && name < lo) && !(hasHi && name > hi);
+        });
+        return true;
+    }
 
-    if(!fm.createFile(filename)) return false;
+    bool isId = field == "id", isCours = field == "cours", isGrade = field == "averageGrade";
+    if(!isId && !isCours && !isGrade) return false;
+    // границы разбираются так же строго, как значения в Query: лишние символы - ошибка
+    auto bound = [&](const std::string &text, double &out){
+        int v;
+        if(isGrade) return Query::toDouble(text, out);
+        if(!Query::toInt(text, v)) return false;
+        out = v;
+        return true;
+    };
+    double dlo = -std::numeric_limits<double>::infinity();
+    double dhi = std::numeric_limits<double>::infinity();
+    if((hasLo && !bound(lo, dlo)) || (hasHi && !bound(hi, dhi))) return false;
+    // та же погрешность, что и при поиске по равенству
+    if(isGrade){ dlo -= 0.0001; dhi += 0.0001; }
+    if(dlo > dhi) return true;
+    int ilo = dlo <= (double)INT_MIN ? INT_MIN : dlo >= (double)INT_MAX ? INT_MAX : (int)std::ceil(dlo);
+    int ihi = dhi >= (double)INT_MAX ? INT_MAX : dhi <= (double)INT_MIN ? INT_MIN : (int)std::floor(dhi);
 
-    dbFilename = filename;
-    idxFilename = filename + ".idx";
+    if(isId){
+        if(dhi < (double)INT_MIN || dlo > (double)INT_MAX || ilo > ihi) return true;
+        for(BPlusTree::Iterator it = index.lowerBound(ilo); it.valid() && it.key() <= ihi; it.next()){
+            take(it.value());
+        }
+        return true;
+    }
 
-    index.clear();
-    persistIndex();
+    if(isCours && sidx.enabled(SecondaryIndexes::COURS)){
+        if(ilo <= ihi){
+            for(long long off: sidx.findCours(ilo, ihi)) take(off);
+        }
+        return true;
+    }
+    if(isGrade && sidx.enabled(SecondaryIndexes::GRADE)){
+        for(long long off: sidx.findGrade(dlo, dhi)) take(off);
+        return true;
+    }
+    std::vector<long long> offsets;
+    if(columnOffsets(field, dlo, dhi, offsets)){
+        // колонки уже отобрали строки: читаются только совпавшие записи из отображения
+        RecordSpan records = scanRecords();
+        metrics.add(Metrics::RECORDS_SCANNED, offsets.size());
+        out.reserve(offsets.size());
+        for(long long off: offsets){
+            size_t row = rowOf(off);
+            if(row < records.size() && records.data[row].isActive) out.push_back({off, records.data[row]});
+        }
+        return true;
+    }
 
-    openFlag = true;
+    // индекса нет: условие проверяется прямо при проходе, копируются только совпадения
+    scan([&](const StoredStudent &rs){
+        double v = isCours ? (double)rs.cours : rs.averageGrade;
+        return v >= dlo && v <= dhi;
+    });
     return true;
 }
 
-
-bool Database::open(const std::string &filename){
-    if(openFlag) close();
-    if(!fm.openFile(filename)){return false;}
-    dbFilename = filename;
-    idxFilename = filename + ".idx";
-    if(!loadIndex()){
-        index.clear();
-        persistIndex();
+bool Database::editRecordByKey(int keyId, const Student &newS){
+    Metrics::Timer timer(metrics, Metrics::OP_EDIT);
+    std::unique_lock<RwLock> lock(rwLock);
+    if(!writable()) return false;
+    long long off;
+    if(!findId(keyId, off)) {return false;}
+    StoredStudent rs;
+    if(!readRecordAt(off, rs)) {return false;}
+    if(rs.isActive==0) {return false;}
+    StoredStudent ns = toStored(newS);
+    long long taken;
+    if(newS.id != keyId && findId(newS.id, taken)){return false;}
+    
+    std::vector<WalEntry> ops{recordOp(off, ns)};
+    if(newS.id != keyId){
+        ops.push_back(indexOp(keyId, -1));
+        ops.push_back(indexOp(newS.id, off));
     }
-    openFlag = true;
-    return true;
+    unsigned long long lsn = logMutation(ops);
+    if(lsn == 0){return false;}
+    
+    if(!fm.writeAt(off, (const char*)&ns, sizeof(ns), lsn)){return false;}
+    secondaryErase(rs, off);
+    secondaryInsert(ns, off);
+    columnsPut(ns, off);
+    statsErase(rs);
+    statsInsert(ns);
+    if(newS.id != keyId){
+        indexErase(keyId);
+        indexPut(newS.id, off);
+    }
+    noteChange(Change::UPDATED, off, &rs, &ns);
+    maybeCheckpoint();
+    lock.unlock();
+    
+    bool committed = wal.commit(lsn);
+    notifyChanges();
+    return committed;
 }
 
-bool Database::close(){
-    if(!openFlag) return true;
-    persistIndex();
-    fm.closeFile();
-    index.clear();
-    openFlag = false;
-    return true;
+double Database::deadRatio(){
+    refresh();
+    std::shared_lock<RwLock> lock(rwLock);
+    if(!openFlag) return 0;
+    long long total = recordCount();
+    if(total == 0) return 0;
+    return (double)(total - (long long)index.size()) / (double)total;
 }
 
-bool Database::removeDB(const std::string &filename){
-    close();
-    std::remove(filename.c_str());
-    std::remove((filename + ".idx").c_str());
-    return true;
+long long Database::compact(){
+    Metrics::Timer timer(metrics, Metrics::OP_COMPACT);
+    std::unique_lock<RwLock> lock(rwLock);
+    if(!writable()) return -1;
+    long long reclaimed = compactLocked();
+    lock.unlock();
+    notifyChanges();
+    return reclaimed;
 }
 
-bool Database::clear(){
-    if(!openFlag) return false;
-    fm.truncate();
-    index.clear();
-    persistIndex();
-    return true;
+void Database::maybeAutoCompact(){
+    if(autoCompactRatio <= 0) return;
+    size_t total = (size_t)recordCount();
+    if(total < AUTO_COMPACT_MIN_RECORDS) return;
+    double dead = (double)(total - std::min(total, index.size())) / (double)total;
+    if(dead > autoCompactRatio){
+        LOG_INFO("Dead records ratio " << dead << ", compacting");
+        compactLocked();
+    }
 }
 
-bool Database::save(){
-    if(!openFlag) return false;
-    return persistIndex();
-}
+long long Database::compactLocked(){
+    // данные на диске должны совпадать с индексом, WAL пуст
+    if(!checkpoint()){return -1;}
 
-long long Database::appendRecordToFile(const StoredStudent &rs){
-    return fm.append((const char*)&rs, sizeof(StoredStudent));
-}
+    std::string dataTmp = dbFilename + ".compact";
+    std::string idxTmp = idxFilename + ".compact";
+    std::string marker = dbFilename + ".compact.done";
+    long long oldSize = fm.size();
 
-bool Database::loadIndex(){
-    index.clear();
-    std::ifstream ifs(idxFilename, std::ios::binary);
-    if(!ifs){return false;}
-    while (true)
+    // живыми считаются записи, на которые указывает индекс
+    std::vector<bool> live = liveSlots();
+    std::vector<std::pair<int, long long>> newIndex;
+    newIndex.reserve(index.size());
     {
-        int id;
-        long long off;
-        ifs.read((char*)&id, sizeof(id));
-        if(!ifs) break;
-        ifs.read((char*)&off, sizeof(off));
-        if(!ifs) break;
-        index[id] = off;
+        FileManager out;
+        if(!out.createFile(dataTmp) || !writeDataHeader(out, 0, 0)){return -1;}
+        std::vector<StoredStudent> chunk;
+        chunk.reserve(4096);
+        RecordSpan records = scanRecords();
+        for(size_t i = 0; i < records.size(); i++){
+            const StoredStudent &rs = records.data[i];
+            if(i >= live.size() || !live[i]) continue;
+            newIndex.push_back({rs.id, out.size() + (long long)chunk.size() * (long long)sizeof(StoredStudent)});
+            chunk.push_back(rs);
+            if(chunk.size() == chunk.capacity()){
+                if(out.append((const char*)chunk.data(), chunk.size() * sizeof(StoredStudent)) < 0){return -1;}
+                chunk.clear();
+            }
+        }
+        if(!chunk.empty() && out.append((const char*)chunk.data(), chunk.size() * sizeof(StoredStudent)) < 0){return -1;}
+        // новый файл - следующее поколение, индекс к нему отмечается тем же поколением
+        if(!writeDataHeader(out, generation + 1, (long long)newIndex.size()) || !out.sync()){return -1;}
+    }
+    std::sort(newIndex.begin(), newIndex.end());
+    {
+        BPlusTree out(16);
+        if(!out.create(idxTmp) || !out.build(newIndex)){return -1;}
+        out.setDataStamp(generation + 1, newIndex.size());
+        if(!out.sync()){return -1;}
     }
-    return true;
-}
 
-bool Database::persistIndex(){
-    std::ofstream ofs(idxFilename, std::ios::binary | std::ios::trunc);
-    if(!ofs){return false;}
-    for(auto &p: index){
-        ofs.write((char*)&p.first, sizeof(p.first));
-        ofs.write((char*)&p.second, sizeof(p.second));
+    // после появления маркера сжатие считается состоявшимся: прерванная подмена
+    // файлов будет доведена до конца при следующем open()
+    {
+        std::ofstream m(marker, std::ios::trunc);
+        if(!m){return -1;}
     }
+    if(!FileManager::syncPath(marker)){return -1;}
 
-    return true;
+    fm.closeFile();
+    index.close();
+    // файлы уже закрыты: при ошибке база закрывается целиком, а незаконченную
+    // подмену по маркеру доведёт до конца следующий open()
+    auto fail = [this](const char *what){
+        LOG_ERROR("Compaction of " << dbFilename << " failed: " << what << ", the database is closed");
+        releaseLocked();
+        return -1LL;
+    };
+    if(!finishCompaction(dbFilename)){return fail("cannot replace the files");}
+    if(!fm.openFile(dbFilename) || !readDataHeader()){return fail("cannot reopen the data file");}
+    if(!loadIndex()){
+        if(!rebuildIndex()){return fail("cannot rebuild the index");}
+        generationDirty = true;
+    }
+    resetIds();
+
+    freeSlots.clear();
+    freeDirty = true;
+    persistFreeList();
+    rebuildSecondary();
+    persistSecondary();
+    rebuildColumns();
+    persistColumns();
+    unpublished = true;
+    publishSnapshot();
+    noteChange(Change::RESET, -1, nullptr, nullptr);
+
+    long long reclaimed = oldSize - fm.size();
+    LOG_INFO("Compaction reclaimed " << reclaimed << " bytes");
+    return reclaimed;
 }
 
-bool Database::addRecord(const Student &s, std::string &err){
-    if(!openFlag){ err = "DB is not open"; return false; }
-    
-    std::cout << "=== ADD RECORD ===" << std::endl;
-    std::cout << "New record - ID: " << s.id << ", Name: " << s.name << std::endl;
-    std::cout << "Current index size: " << index.size() << std::endl;
-    
-    if(index.find(s.id) != index.end()){ 
-        std::cout << "DUPLICATE ID FOUND IN INDEX!" << std::endl;
-        err = "duplicate key (id)"; 
-        return false; 
+bool Database::finishCompaction(const std::string &filename){
+    std::string marker = filename + ".compact.done";
+    struct stat st;
+    if(stat(marker.c_str(), &st) != 0){
+        // сжатие не дошло до маркера: временные файлы просто выбрасываются
+        std::remove((filename + ".compact").c_str());
+        std::remove((filename + ".idx.compact").c_str());
+        return true;
     }
-    
-    StoredStudent rs;
-    rs.id = s.id;
-    strncpy(rs.name, s.name, sizeof(rs.name)-1);
-    rs.name[sizeof(rs.name)-1] = '\0';
-    rs.isActive = s.isActive ? 1 : 0;
-    rs.averageGrade = s.averageGrade;
-    rs.cours = s.cours;
-    
-    long long off = appendRecordToFile(rs);
-    std::cout << "Record written at offset: " << off << std::endl;
-    
-    if(off < 0){err = "file write error"; return false;}
-    
-    index[s.id] = off;
-    persistIndex();
-    
-    std::cout << "Record added successfully. New index size: " << index.size() << std::endl;
-    return true;
+
+    std::string dataTmp = filename + ".compact";
+    std::string idxTmp = filename + ".idx.compact";
+    if(stat(dataTmp.c_str(), &st) == 0 && std::rename(dataTmp.c_str(), filename.c_str()) != 0){return false;}
+    if(stat(idxTmp.c_str(), &st) == 0 && std::rename(idxTmp.c_str(), (filename + ".idx").c_str()) != 0){return false;}
+    // список свободных мест относится к старым смещениям
+    std::remove((filename + ".free").c_str());
+    return std::remove(marker.c_str()) == 0;
 }
 
-bool Database::readRecordAt(long long offset, StoredStudent &out){
-    if(!fm.readAt(offset, (char*)&out, sizeof(StoredStudent))){return false;}
-    return true;
+// размер файла или 0, если его нет
+static long long fileBytes(const std::string &path){
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? (long long)st.st_size : 0;
 }
 
-bool Database::markRecordDeleted(long long offset){
-    StoredStudent rs;
-    if(!readRecordAt(offset, rs)){return false;}
-    if(rs.isActive == 0){return false;}
-    rs.isActive = 0;
-    if(!fm.writeAt(offset, (const char*)&rs, sizeof(StoredStudent))){return false;}
-    return true;
+// копирование с отметкой хода по байтам; false - ошибка или отмена
+static bool copyWithProgress(const std::string &src, const std::string &dst, Progress *progress){
+    if(!progress) return FileManager::copyFile(src, dst);
+    return FileManager::copyFile(src, dst, [progress](long long n){
+        progress->advance(n);
+        return !progress->cancelled();
+    });
 }
 
+// исключительная блокировка становится общей без окна, в которое вошёл бы писатель;
+// пока она держится, читатели не ждут писателей, стоящих в очереди за копией
+class DowngradedLock {
+    public:
+        explicit DowngradedLock(std::unique_lock<RwLock> &lock): m(lock.release()) { m->downgrade(); }
+        ~DowngradedLock(){ m->unlock_downgraded(); }
+        DowngradedLock(const DowngradedLock&) = delete;
+        DowngradedLock &operator=(const DowngradedLock&) = delete;
+    private:
+        RwLock *m;
+};
 
-std::vector<Student> Database::searchByField(const std::string &field, const std::string &value){
-    std::vector<Student> res;
+// Инкрементальная копия (дельта): заголовок, затем страницы файла данных и файла
+// индекса (номер страницы и её байты; последняя страница файла бывает короче),
+// список свободных мест и crc32 всего после заголовка. Полная копия отмечается
+// таким же заголовком без страниц в <backup>.chain.
+static const uint32_t DELTA_MAGIC = 0x544c4453; // "SDLT"
+static const uint32_t DELTA_VERSION = 1;
+#pragma pack(push,1)
+struct DeltaHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t chain;        // общий для полной копии и её дельт
+    uint32_t seq;          // 0 - полная копия, дальше 1, 2, ... по порядку
+    uint32_t sidxMask;     // вторичные индексы и колонки строятся заново после применения
+    uint32_t columns;
+    uint32_t dataPageSize;
+    uint32_t idxPageSize;
+    uint32_t reserved;
+    uint64_t dataSize;     // размеры файлов после применения
+    uint64_t idxSize;
+    uint64_t dataPages;
+    uint64_t idxPages;
+    uint64_t freeBytes;
+    uint32_t crc;          // по полям выше
+};
+#pragma pack(pop)
 
-    if(field == "id"){
-        int searchId = std::stoi(value);
-        std::cout << "Searching for ID: " << searchId << " in index..." << std::endl;
-        
-        auto it = index.find(searchId);
-        if(it != index.end()) {
-            std::cout << "Found ID in index at offset: " << it->second << std::endl;
-            
-            StoredStudent rs;
-            if(readRecordAt(it->second, rs)) {
-                std::cout << "Read record - ID: " << rs.id << ", Active: " << (int)rs.isActive << std::endl;
-                
-                if(rs.isActive){
-                    Student s;
-                    s.id = rs.id;
-                    strncpy(s.name, rs.name, sizeof(s.name));
-                    s.name[sizeof(s.name)-1] = '\0';
-                    s.isActive = (rs.isActive != 0);
-                    s.averageGrade = rs.averageGrade;
-                    s.cours = rs.cours;
-                    res.push_back(s);
-                    std::cout << "Successfully added record to results" << std::endl;
-                }
-            }
-        } else {
-            std::cout << "ID " << searchId << " not found in index" << std::endl;
-        }
-        return res;
+static bool writeDeltaHeader(std::ofstream &ofs, DeltaHeader &h){
+    h.magic = DELTA_MAGIC;
+    h.version = DELTA_VERSION;
+    h.crc = crc32(&h, offsetof(DeltaHeader, crc));
+    return (bool)ofs.write((const char*)&h, sizeof(h));
+}
+
+static bool readDeltaHeader(const std::string &path, DeltaHeader &h){
+    std::ifstream ifs(path, std::ios::binary);
+    return ifs && ifs.read((char*)&h, sizeof(h)) && h.magic == DELTA_MAGIC && h.version == DELTA_VERSION
+        && h.crc == crc32(&h, offsetof(DeltaHeader, crc));
+}
+
+// Сначала проверяется crc всей дельты, и только потом переписываются страницы копии:
+// повреждённая дельта не портит уже восстановленные файлы
+static bool applyDelta(const std::string &path, const DeltaHeader &h, const std::string &dataFile,
+                       const std::string &idxFile, Progress *progress){
+    std::ifstream ifs(path, std::ios::binary);
+    long long body = fileBytes(path) - (long long)sizeof(DeltaHeader) - (long long)sizeof(uint32_t);
+    if(!ifs || body < 0 || h.freeBytes > (uint64_t)body){return false;}
+    std::vector<char> buf(FileManager::COPY_CHUNK);
+    uint32_t crc = 0, stored = 0;
+    ifs.seekg(sizeof(DeltaHeader));
+    for(long long left = body; left > 0; ){
+        size_t n = (size_t)std::min<long long>(left, (long long)buf.size());
+        if(!ifs.read(buf.data(), n)){return false;}
+        crc = crc32(buf.data(), n, crc);
+        left -= (long long)n;
     }
-    
-    std::cout << "Sequential search for field: " << field << " value: " << value << std::endl;
-    
-    fm.seekToBegin();
-    StoredStudent rs;
-    int recordsChecked = 0;
-    
-    while(fm.readNext((char*)&rs, sizeof(StoredStudent))){
-        recordsChecked++;
-        if(rs.isActive == 0) {
-            continue;
-        }
-        
-        std::cout << "Checking record #" << recordsChecked << " - ID: " << rs.id << ", Name: " << rs.name << std::endl;
-        
-        bool match = false;
-        
-        if(field == "name"){
-            if(strcmp(value.c_str(), rs.name) == 0) {
-                match = true;
-                std::cout << "Name match found!" << std::endl;
+    if(!ifs.read((char*)&stored, sizeof(stored)) || stored != crc){return false;}
+
+    ifs.seekg(sizeof(DeltaHeader));
+    auto apply = [&](const std::string &file, uint64_t pages, uint64_t size, uint32_t pageSize){
+        if(pageSize == 0 || pageSize > buf.size()){return false;}
+        { std::ofstream touch(file, std::ios::binary | std::ios::app); }
+        std::fstream out(file, std::ios::binary | std::ios::in | std::ios::out);
+        if(!out){return false;}
+        uint64_t count = (size + pageSize - 1) / pageSize;
+        for(uint64_t k = 0; k < pages; k++){
+            uint64_t page;
+            if(!ifs.read((char*)&page, sizeof(page)) || page >= count){return false;}
+            size_t n = pageBytes(page, (long long)size, pageSize);
+            if(!ifs.read(buf.data(), n) || !out.seekp((std::streamoff)(page * pageSize)) || !out.write(buf.data(), n)){return false;}
+            if(progress){
+                progress->advance((long long)n);
+                if(progress->cancelled()){return false;}
             }
-        } else if(field == "isActive"){
-            bool val = (value == "1" || value == "true" || value == "True");
-            if(rs.isActive == (val ? 1 : 0)) match = true;
-        } else if(field == "averageGrade"){
-            double v = std::stod(value);
-            if(std::abs(rs.averageGrade - v) < 0.0001) match = true;
-        } else if(field == "cours"){
-            int v = std::stoi(value);
-            if(rs.cours == v) match = true;
-        }
-        
-        if(match){
-            Student s;
-            s.id = rs.id;
-            strncpy(s.name, rs.name, sizeof(s.name));
-            s.name[sizeof(s.name)-1] = '\0';
-            s.isActive = (rs.isActive != 0);
-            s.averageGrade = rs.averageGrade;
-            s.cours = rs.cours;
-            res.push_back(s);
-            std::cout << "Record added to search results" << std::endl;
         }
+        out.close();
+        // файл мог стать короче (clear, сжатие): хвост отрезается
+        return !out.fail() && ::truncate(file.c_str(), (off_t)size) == 0;
+    };
+    if(!apply(dataFile, h.dataPages, h.dataSize, h.dataPageSize) || !apply(idxFile, h.idxPages, h.idxSize, h.idxPageSize)){return false;}
+    std::vector<char> freeList((size_t)h.freeBytes);
+    if(!ifs.read(freeList.data(), freeList.size())){return false;}
+    std::ofstream ofs(dataFile + ".free", std::ios::binary | std::ios::trunc);
+    return ofs && ofs.write(freeList.data(), freeList.size());
+}
+
+bool Database::backup(const std::string &backupFile, Progress *progress){
+    Metrics::Timer timer(metrics, Metrics::OP_BACKUP);
+    std::lock_guard<std::mutex> guard(backupMutex);
+    std::unique_lock<RwLock> lock(rwLock);
+    if(!writable()) {
+        LOG_WARN("Database is not open for writing, cannot back it up");
+        return false;
     }
     
-    std::cout << "Search completed. Checked " << recordsChecked << " records, found " << res.size() << " matches" << std::endl;
-    return res;
-}
 
-size_t Database::deleteByField(const std::string &field, const std::string &value){
-    size_t deleted = 0;
+    if(!checkpoint()) {
+        LOG_ERROR("Failed to persist index for backup");
+        return false;
+    }
+    // после контрольной точки файлы на диске полные: копирование идёт под общей
+    // блокировкой, и читатели (модель GUI в том числе) его не ждут
+    DowngradedLock shared(lock);
     
-    if(field == "id"){
-        int id = std::stoi(value);
-        auto it = index.find(id);
-        if(it == index.end()) return 0;
-        if(markRecordDeleted(it->second)){
-            index.erase(it);
-            persistIndex();
-            return 1;
-        }
-        return 0;
+    LOG_INFO("Creating backup to: " << backupFile);
+
+    // файл данных, индекс, свободные места, вторичные индексы и колонки копируются
+    // одним списком, чтобы ход считался по общему числу байт
+    struct Copy { std::string src, dst, what; };
+    std::vector<Copy> copies{{dbFilename, backupFile, "database"}, {idxFilename, backupFile + ".idx", "index"}};
+    std::string backupFreeFile = backupFile + ".free";
+    std::remove(backupFreeFile.c_str());
+    struct stat st;
+    if(stat((dbFilename + ".free").c_str(), &st) == 0) copies.push_back({dbFilename + ".free", backupFreeFile, "free list"});
+    std::string backupSidxFile = backupFile + ".sidx";
+    std::remove(backupSidxFile.c_str());
+    std::remove((backupFile + ".chain").c_str());
+    if(sidx.mask() != 0) copies.push_back({dbFilename + ".sidx", backupSidxFile, "secondary index"});
+    for(const std::string &f: ColumnStore::files(backupFile + ".col")) std::remove(f.c_str());
+    if(cols.enabled()) {
+        std::vector<std::string> src = ColumnStore::files(dbFilename + ".col");
+        std::vector<std::string> dst = ColumnStore::files(backupFile + ".col");
+        for(size_t i = 0; i < src.size(); i++) copies.push_back({src[i], dst[i], "column"});
+    }
+    if(progress) {
+        long long total = 0;
+        for(const Copy &c: copies) total += fileBytes(c.src);
+        progress->start(total);
     }
 
-    fm.seekToBegin();
-    long long off = 0;
-    StoredStudent rs;
-    while (fm.readNext((char*)&rs, sizeof(StoredStudent))){
-        if(rs.isActive == 0){ 
-            off += sizeof(StoredStudent); 
-            continue; 
-        }
-        
-        bool match = false;
-        if(field == "name"){
-            if(strcmp(value.c_str(), rs.name) == 0) match = true;
-        } else if(field == "isActive"){
-            bool val = (value == "1" || value == "true" || value == "True");
-            if(rs.isActive == (val ? 1 : 0)) match = true;
-        } else if(field == "averageGrade"){
-            double v = std::stod(value);
-            if(std::abs(rs.averageGrade - v) < 0.0001) match = true;
-        } else if(field == "cours"){
-            int v = std::stoi(value);
-            if(rs.cours == v) match = true;
-        }
-        
-        if(match){
-            if(markRecordDeleted(off)){
-                auto it = index.find(rs.id);
-                if(it != index.end()) {
-                    index.erase(it);
-                }
-                deleted++;
+    for(size_t i = 0; i < copies.size(); i++) {
+        if(!copyWithProgress(copies[i].src, copies[i].dst, progress)) {
+            if(progress && progress->cancelled()) {
+                LOG_INFO("Backup cancelled");
+                for(size_t k = 0; k < i; k++) std::remove(copies[k].dst.c_str());
+            } else {
+                LOG_ERROR("Failed to copy " << copies[i].what << " file");
             }
+            return false;
         }
-        off += sizeof(StoredStudent);
     }
-    
-    if(deleted > 0) {
-        persistIndex();
-    }
-    
-    return deleted;
-}
 
-bool Database::editRecordByKey(int keyId, const Student &newS){
-    auto it = index.find(keyId);
-    if(it == index.end()) {return false;}
-    StoredStudent rs;
-    if(!readRecordAt(it->second, rs)) {return false;}
-    if(rs.isActive==0) {return false;}
-    StoredStudent ns;
-    ns.id = newS.id;
-    strncpy(ns.name, newS.name, sizeof(ns.name));
-    ns.name[sizeof(ns.name)-1] = '\0';
-    ns.isActive = newS.isActive ? 1 : 0;
-    ns.averageGrade = newS.averageGrade;
-    ns.cours = newS.cours;
-    if(newS.id != keyId){
-        if(index.find(newS.id) != index.end()){return false;}
-        index.erase(it);
-        index[newS.id] = it->second;
+    // полная копия начинает новую цепочку дельт
+    std::random_device rd;
+    uint64_t chain = ((uint64_t)rd() << 32 | rd()) ^ (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+    DeltaHeader h;
+    memset(&h, 0, sizeof(h));
+    h.chain = chain ? chain : 1;
+    h.dataSize = (uint64_t)fileBytes(dbFilename);
+    h.idxSize = (uint64_t)fileBytes(idxFilename);
+    std::ofstream ofs(backupFile + ".chain", std::ios::binary | std::ios::trunc);
+    bool chained = ofs && writeDeltaHeader(ofs, h);
+    ofs.close();
+    if(!chained || ofs.fail()) {
+        LOG_WARN("Cannot start an incremental chain at " << backupFile << ", the next backup must be full");
+    } else {
+        backupChain = h.chain;
+        backupSeq = 0;
+        fm.clearChangedPages();
+        index.clearChangedPages();
+        backupMapDirty = true;
+        persistBackupMap();
     }
-    if(!fm.writeAt(it->second, (const char*)&ns, sizeof(ns))){return false;}
-    persistIndex();
+
+    LOG_INFO("Backup completed successfully");
     return true;
 }
 
-bool Database::backup(const std::string &backupFile){
-    if(!openFlag) {
-        std::cout << "Database is not open for backup" << std::endl;
+bool Database::backupIncremental(const std::string &deltaFile, Progress *progress){
+    Metrics::Timer timer(metrics, Metrics::OP_BACKUP);
+    std::lock_guard<std::mutex> guard(backupMutex);
+    std::unique_lock<RwLock> lock(rwLock);
+    if(!writable()) {
+        LOG_WARN("Database is not open for writing, cannot back it up");
         return false;
     }
-    
-
-    if(!persistIndex()) {
-        std::cout << "Failed to persist index for backup" << std::endl;
+    if(backupChain == 0) {
+        LOG_WARN("No full backup of " << dbFilename << " to build an incremental backup on");
         return false;
     }
-    
-    std::cout << "Creating backup to: " << backupFile << std::endl;
-    
-
-    if(!fm.copyTo(backupFile)) {
-        std::cout << "Failed to copy database file" << std::endl;
+    if(!checkpoint()) {
+        LOG_ERROR("Failed to persist index for backup");
         return false;
     }
 
-    std::string backupIdxFile = backupFile + ".idx";
-    if(!FileManager::copyFile(idxFilename, backupIdxFile)) {
-        std::cout << "Failed to copy index file" << std::endl;
+    // после контрольной точки файлы на диске полные, и страницы читаются прямо из них
+    // под общей блокировкой
+    DowngradedLock shared(lock);
+    long long dataSize = fileBytes(dbFilename), idxSize = fileBytes(idxFilename);
+    size_t dataPageSize = fm.getPageSize(), idxPageSize = index.filePageSize();
+    std::vector<uint64_t> dataPages = changedPageList(fm.changedPages(), dataSize, dataPageSize);
+    std::vector<uint64_t> idxPages = changedPageList(index.changedPages(), idxSize, idxPageSize);
+    size_t freeBytes = freeSlots.size() * sizeof(long long);
+
+    DeltaHeader h;
+    memset(&h, 0, sizeof(h));
+    h.chain = backupChain;
+    h.seq = backupSeq + 1;
+    h.sidxMask = sidx.mask();
+    h.columns = cols.enabled() ? 1 : 0;
+    h.dataPageSize = (uint32_t)dataPageSize;
+    h.idxPageSize = (uint32_t)idxPageSize;
+    h.dataSize = (uint64_t)dataSize;
+    h.idxSize = (uint64_t)idxSize;
+    h.dataPages = dataPages.size();
+    h.idxPages = idxPages.size();
+    h.freeBytes = freeBytes;
+    if(progress) {
+        long long total = (long long)freeBytes;
+        for(uint64_t p: dataPages) total += (long long)pageBytes(p, dataSize, dataPageSize);
+        for(uint64_t p: idxPages) total += (long long)pageBytes(p, idxSize, idxPageSize);
+        progress->start(total);
+    }
+
+    std::ofstream ofs(deltaFile, std::ios::binary | std::ios::trunc);
+    uint32_t crc = 0;
+    auto put = [&](const void *p, size_t n) {
+        crc = crc32(p, n, crc);
+        return (bool)ofs.write((const char*)p, n);
+    };
+    std::vector<char> page;
+    auto copyPages = [&](const std::string &path, const std::vector<uint64_t> &pages, long long size, size_t pageSize) {
+        std::ifstream in(path, std::ios::binary);
+        if(!in) return false;
+        page.resize(pageSize);
+        for(uint64_t p: pages) {
+            size_t n = pageBytes(p, size, pageSize);
+            if(!in.seekg((std::streamoff)(p * pageSize)) || !in.read(page.data(), n)) return false;
+            if(!put(&p, sizeof(p)) || !put(page.data(), n)) return false;
+            if(progress) {
+                progress->advance((long long)n);
+                if(progress->cancelled()) return false;
+            }
+        }
+        return true;
+    };
+    bool ok = ofs && writeDeltaHeader(ofs, h)
+           && copyPages(dbFilename, dataPages, dataSize, dataPageSize)
+           && copyPages(idxFilename, idxPages, idxSize, idxPageSize)
+           && put(freeSlots.data(), freeBytes);
+    ok = ok && ofs.write((const char*)&crc, sizeof(crc));
+    ofs.close();
+    ok = ok && !ofs.fail() && FileManager::syncPath(deltaFile);
+    if(!ok) {
+        std::remove(deltaFile.c_str());
+        if(progress && progress->cancelled()) LOG_INFO("Backup cancelled");
+        else LOG_ERROR("Failed to write incremental backup " << deltaFile);
         return false;
     }
-    
-    std::cout << "Backup completed successfully" << std::endl;
+
+    backupSeq++;
+    fm.clearChangedPages();
+    index.clearChangedPages();
+    backupMapDirty = true;
+    persistBackupMap();
+    LOG_INFO("Incremental backup " << backupSeq << " written to " << deltaFile << ": " << dataPages.size()
+             << " data pages, " << idxPages.size() << " index pages");
     return true;
 }
 
-bool Database::restoreFromBackup(const std::string &backupFile){
-    close();
-    
-    std::cout << "Restoring from backup: " << backupFile << std::endl;
-    struct stat buffer;
-    if (stat(backupFile.c_str(), &buffer) != 0) {
-        std::cout << "Backup file does not exist: " << backupFile << std::endl;
-        return false;
-    }
+bool Database::restoreFromBackup(const std::string &backupFile, Progress *progress){
+    return restoreFromBackup(backupFile, {}, progress);
+}
 
-    std::string restoredName;
+// восстановленная копия получает имя по имени полной копии
+static std::string restoredNameFor(const std::string &backupFile){
     size_t lastSlash = backupFile.find_last_of("/\\");
     std::string fileNameOnly = (lastSlash == std::string::npos) ? backupFile : backupFile.substr(lastSlash + 1);
-    
     size_t lastDot = fileNameOnly.find_last_of('.');
-    if (lastDot != std::string::npos) {
-        restoredName = fileNameOnly.substr(0, lastDot) + "_restored.db";
-    } else {
-        restoredName = fileNameOnly + ".db";
+    if (lastDot != std::string::npos) return fileNameOnly.substr(0, lastDot) + "_restored.db";
+    return fileNameOnly + ".db";
+}
+
+// файлы, которые восстановление кладёт под имя dbName (кроме колонок)
+static const char *const RESTORED_SUFFIXES[] = {"", ".idx", ".free", ".sidx"};
+
+// файлы прежней базы dbName, которые не должны попасть в открытие восстановленной
+static void removeStale(const std::string &dbName){
+    std::remove((dbName + ".idx.log").c_str());
+    std::remove((dbName + ".wal").c_str());
+    std::remove((dbName + ".bkmap").c_str());
+    std::remove((dbName + ".compact").c_str());
+    std::remove((dbName + ".idx.compact").c_str());
+    std::remove((dbName + ".compact.done").c_str());
+}
+
+static void removeRestored(const std::string &dbName){
+    for(const char *suffix: RESTORED_SUFFIXES) std::remove((dbName + suffix).c_str());
+    for(const std::string &f: ColumnStore::files(dbName + ".col")) std::remove(f.c_str());
+    removeStale(dbName);
+}
+
+// переносит собранные в stage файлы под имя dbName поверх прежних; файлов, которых
+// в stage нет, у dbName тоже не остаётся
+static bool installRestored(const std::string &stage, const std::string &dbName){
+    removeStale(dbName);
+    std::vector<std::string> from, to;
+    for(const char *suffix: RESTORED_SUFFIXES){
+        from.push_back(stage + suffix);
+        to.push_back(dbName + suffix);
     }
-    
-    dbFilename = restoredName;
-    idxFilename = dbFilename + ".idx";
-    
-    std::cout << "Restoring to: " << dbFilename << std::endl;
+    std::vector<std::string> colFrom = ColumnStore::files(stage + ".col"), colTo = ColumnStore::files(dbName + ".col");
+    from.insert(from.end(), colFrom.begin(), colFrom.end());
+    to.insert(to.end(), colTo.begin(), colTo.end());
+    struct stat st;
+    for(size_t i = 0; i < from.size(); i++){
+        if(stat(from[i].c_str(), &st) != 0) std::remove(to[i].c_str());
+        else if(std::rename(from[i].c_str(), to[i].c_str()) != 0){return false;}
+    }
+    return FileManager::syncDir(dbName);
+}
 
-    if(!FileManager::copyFile(backupFile, dbFilename)) {
-        std::cout << "Failed to copy backup file to " << dbFilename << std::endl;
+// собирает полную копию с дельтами в файлы stage; открытую базу не трогает.
+// Если что-то не удалось, файлы stage удаляются
+static bool restoreFiles(const std::string &backupFile, const std::vector<std::string> &deltas, const std::string &stage,
+                         std::vector<DeltaHeader> &heads, Progress *progress){
+    std::string idxName = stage + ".idx";
+    struct stat buffer;
+    if (stat(backupFile.c_str(), &buffer) != 0) {
+        LOG_WARN("Backup file does not exist: " << backupFile);
         return false;
     }
-    
+    // дельты должны продолжать цепочку именно этой полной копии и идти подряд
+    if (!deltas.empty()) {
+        DeltaHeader base;
+        if (!readDeltaHeader(backupFile + ".chain", base) || base.seq != 0) {
+            LOG_WARN("Backup " << backupFile << " does not start an incremental chain");
+            return false;
+        }
+        for (size_t i = 0; i < deltas.size(); i++) {
+            DeltaHeader h;
+            if (!readDeltaHeader(deltas[i], h) || h.chain != base.chain || h.seq != i + 1) {
+                LOG_WARN("Incremental backup " << deltas[i] << " does not follow " << (i ? deltas[i - 1] : backupFile));
+                return false;
+            }
+            heads.push_back(h);
+        }
+    }
+
+    LOG_INFO("Restoring into staging files: " << stage);
+    removeRestored(stage);
+
+    std::vector<std::string> colSrc = ColumnStore::files(backupFile + ".col");
+    std::vector<std::string> colDst = ColumnStore::files(stage + ".col");
+    if(progress) {
+        long long total = fileBytes(backupFile) + fileBytes(backupFile + ".idx") + fileBytes(backupFile + ".free")
+                        + fileBytes(backupFile + ".sidx");
+        for(const std::string &f: colSrc) total += fileBytes(f);
+        for(const std::string &f: deltas) total += fileBytes(f);
+        progress->start(total);
+    }
+    // неудавшееся или отменённое восстановление не оставляет частично собранных файлов
+    auto fail = [&]() {
+        if(progress && progress->cancelled()) LOG_INFO("Restore cancelled");
+        removeRestored(stage);
+        return false;
+    };
+
+    if(!copyWithProgress(backupFile, stage, progress)) {
+        LOG_ERROR("Failed to copy backup file to " << stage);
+        return fail();
+    }
 
     std::string backupIdxFile = backupFile + ".idx";
     if (stat(backupIdxFile.c_str(), &buffer) == 0) {
-        if(!FileManager::copyFile(backupIdxFile, idxFilename)) {
-            std::cout << "Failed to copy index file, will rebuild index" << std::endl;
+        if(!copyWithProgress(backupIdxFile, idxName, progress)) {
+            if(progress && progress->cancelled()) return fail();
+            std::remove(idxName.c_str());
+            LOG_WARN("Failed to copy index file, will rebuild index");
         } else {
-            std::cout << "Index file copied successfully" << std::endl;
+            LOG_DEBUG("Index file copied successfully");
         }
     } else {
-        std::cout << "No index file found, will rebuild index" << std::endl;
+        LOG_INFO("No index file found, will rebuild index");
     }
-    
-
-    if(!open(dbFilename)) {
-        std::cout << "Failed to open restored database" << std::endl;
-        return false;
+    if (stat((backupFile + ".free").c_str(), &buffer) == 0) {
+        copyWithProgress(backupFile + ".free", stage + ".free", progress);
     }
-    
+    if (stat((backupFile + ".sidx").c_str(), &buffer) == 0) {
+        copyWithProgress(backupFile + ".sidx", stage + ".sidx", progress);
+    }
+    if (ColumnStore::exists(backupFile + ".col")) {
+        for(size_t i = 0; i < colDst.size(); i++) copyWithProgress(colSrc[i], colDst[i], progress);
+    }
+    if(progress && progress->cancelled()) return fail();
 
-    std::cout << "Rebuilding index..." << std::endl;
-    index.clear();
-    fm.seekToBegin();
-    long long off = 0;
-    StoredStudent rs;
-    int recordsRebuilt = 0;
-    
-    while(fm.readNext((char*)&rs, sizeof(StoredStudent))){
-        if(rs.isActive) {
-            index[rs.id] = off;
-            recordsRebuilt++;
+    for (size_t i = 0; i < deltas.size(); i++) {
+        if (!applyDelta(deltas[i], heads[i], stage, idxName, progress)) {
+            LOG_ERROR("Failed to apply incremental backup " << deltas[i]);
+            return fail();
+        }
+    }
+    // вторичные индексы и колонки полной копии отстают от дельт
+    if (!deltas.empty()) {
+        std::remove((stage + ".sidx").c_str());
+        for(const std::string &f: colDst) std::remove(f.c_str());
+    }
+    for(const char *suffix: RESTORED_SUFFIXES){
+        if(stat((stage + suffix).c_str(), &buffer) == 0 && !FileManager::syncPath(stage + suffix)) {
+            LOG_ERROR("Failed to sync restored file " << stage + suffix);
+            return fail();
         }
-        off += sizeof(StoredStudent);
     }
-    
-    persistIndex();
-    std::cout << "Index rebuilt with " << recordsRebuilt << " active records" << std::endl;
-    std::cout << "Restore completed successfully" << std::endl;
-    
     return true;
 }
 
-bool Database::exportCSV(const std::string &csvFile){
+bool Database::restoreFromBackup(const std::string &backupFile, const std::vector<std::string> &deltas, Progress *progress){
+    Metrics::Timer timer(metrics, Metrics::OP_RESTORE);
+    std::lock_guard<std::mutex> guard(backupMutex);
+    LOG_INFO("Restoring from backup: " << backupFile);
+    std::string restoredName = restoredNameFor(backupFile);
+    std::string stage = restoredName + ".restore";
+    {
+        std::shared_lock<RwLock> lock(rwLock);
+        if(openFlag && readOnly){
+            // файлы базы принадлежат писателю другого процесса
+            LOG_WARN("Database is open read-only, cannot restore it");
+            return false;
+        }
+    }
+    // файлы собираются во временные без блокировки базы: открытая база, даже с тем же
+    // именем, продолжает работать, пока все дельты не применятся; исключительная
+    // блокировка берётся только для переименования и открытия
+    std::vector<DeltaHeader> heads;
+    bool ok = restoreFiles(backupFile, deltas, stage, heads, progress);
+
+    std::unique_lock<RwLock> lock(rwLock);
+    if(ok && openFlag && readOnly) {
+        LOG_WARN("Database was reopened read-only during restore, keeping it open");
+        removeRestored(stage);
+        ok = false;
+    }
+    if(ok) {
+        // копия ложится поверх файлов открытой базы: её придётся закрыть
+        if(openFlag && dbFilename == restoredName) closeLocked();
+        if(!installRestored(stage, restoredName)) {
+            LOG_ERROR("Failed to move restored files into place as " << restoredName);
+            removeRestored(stage);
+            ok = false;
+        }
+    }
+    if(ok && !openLocked(restoredName, Mode::ReadWrite)) {
+        LOG_ERROR("Failed to open restored database");
+        ok = false;
+    }
+    if(ok && !heads.empty()) {
+        sidx.setMask(heads.back().sidxMask);
+        rebuildSecondary();
+        cols.setEnabled(heads.back().columns != 0);
+        rebuildColumns();
+        checkpoint();
+        LOG_INFO("Applied " << deltas.size() << " incremental backups");
+    }
+    if(ok) {
+        // open() сверил поколение индекса с заголовком копии и перестроил только то,
+        // что с ним не сошлось; скопированные вторичные индексы и колонки проверяются так же
+        LOG_INFO("Restored index has " << index.size() << " active records");
+        LOG_INFO("Restore completed successfully");
+    }
+    lock.unlock();
+    notifyChanges();
+    return ok;
+}
+
+bool Database::exportCSV(const std::string &csvFile, Progress *progress){
+    Metrics::Timer timer(metrics, Metrics::OP_EXPORT);
+    refresh();
+    std::shared_lock<RwLock> lock(rwLock);
     if(!openFlag) return false;
     std::ofstream ofs(csvFile);
     if(!ofs) return false;
     ofs << "id,name,isActive,averageGrade,cours\n";
-    fm.seekToBegin();
-    StoredStudent rs;
-    while(fm.readNext((char*)&rs, sizeof(StoredStudent))){
-        if(rs.isActive==0) continue;
-        ofs << rs.id << ",\"" << rs.name << "\"," << (int)rs.isActive << "," << rs.averageGrade << "," << rs.cours << "\n";
+    // строки форматируются кусками параллельно и пишутся по порядку; окно ограничивает
+    // объём текста, одновременно находящегося в памяти
+    const size_t window = SCAN_CHUNK_RECORDS * 64;
+    RecordSpan records = scanRecords();
+    metrics.add(Metrics::RECORDS_SCANNED, records.size());
+    if(progress) progress->start((long long)records.size());
+    for(size_t base = 0; base < records.size(); base += window){
+        size_t n = std::min(window, records.size() - base);
+        if(progress && progress->cancelled()) break;
+        std::vector<std::string> parts = scanParts<std::string>(scanPool(), n, [&](size_t first, size_t last, std::string &part){
+            if(progress && progress->cancelled()) return;
+            std::ostringstream os;
+            for(size_t i = base + first; i < base + last; i++){
+                const StoredStudent &rs = records.data[i];
+                if(rs.isActive==0) continue;
+                os << rs.id << ",\"" << rs.name << "\"," << (int)rs.isActive << "," << rs.averageGrade << "," << rs.cours << "\n";
+            }
+            part = os.str();
+            if(progress) progress->advance((long long)(last - first));
+        });
+        for(const std::string &part: parts) ofs << part;
     }
-    return true;
+    if(progress && progress->cancelled()){
+        ofs.close();
+        std::remove(csvFile.c_str());
+        return false;
+    }
+    return (bool)ofs;
 }
 
 std::vector<Student> Database::getAll() {
     std::vector<Student> result;
     
-    std::cout << "=== GET ALL RECORDS ===" << std::endl;
-    std::cout << "Index size: " << index.size() << std::endl;
-    
-    fm.seekToBegin();
-    StoredStudent rs;
-    int recordsFound = 0;
-    
-    while(fm.readNext((char*)&rs, sizeof(StoredStudent))){
-        if(rs.isActive != 0) {
-            Student s;
-            s.id = rs.id;
-            strncpy(s.name, rs.name, sizeof(s.name));
-            s.name[sizeof(s.name)-1] = '\0';
-            s.isActive = (rs.isActive != 0);
-            s.averageGrade = rs.averageGrade;
-            s.cours = rs.cours;
-            result.push_back(s);
-            recordsFound++;
-            std::cout << "Active record - ID: " << rs.id << ", Name: " << rs.name << std::endl;
-        }
+    size_t indexed;
+    {
+        std::shared_lock<RwLock> lock(rwLock);
+        indexed = index.size();
+    }
+
+    result.reserve(indexed);
+    for(RecordCursor c = cursor(); c.next(); ){
+        result.push_back(toStudent(c.current()));
     }
     
-    std::cout << "Total active records found: " << recordsFound << std::endl;
+    LOG_DEBUG("getAll: " << result.size() << " active records, index size " << indexed);
     return result;
 }
 
+RecordCursor::RecordCursor(): db(nullptr), byId(false), filePos(0), nextId(0), lastId(INT_MAX), done(true), pos(0) {}
+
+bool RecordCursor::next(){
+    if(pos + 1 < window.size()){
+        pos++;
+        return true;
+    }
+    // окно может оказаться пустым, если условию не подошла ни одна запись в нём
+    while(!done){
+        db->fillCursor(*this);
+        pos = 0;
+        if(!window.empty()) return true;
+    }
+    window.clear();
+    return false;
+}
+
+RecordCursor Database::cursor(const Query &q){
+    RecordCursor c;
+    c.db = this;
+    c.filter = q;
+    c.done = !openFlag;
+    return c;
+}
+
+RecordCursor Database::cursorById(int fromId, const Query &q){
+    RecordCursor c = cursor(q);
+    c.byId = true;
+    c.nextId = fromId;
+    for(const Query::Condition &cond: q.conjuncts()){
+        double v;
+        if(cond.field != "id" || cond.op == Query::NE || cond.op == Query::PREFIX || !Query::toDouble(cond.value, v)) continue;
+        if(cond.op == Query::EQ || cond.op == Query::GE || cond.op == Query::GT){
+            c.nextId = std::max(c.nextId, (long long)std::ceil(std::min(v, (double)INT_MAX + 1)));
+        }
+        if(cond.op == Query::EQ || cond.op == Query::LE || cond.op == Query::LT){
+            c.lastId = std::min(c.lastId, (long long)std::floor(std::max(v, (double)INT_MIN - 1)));
+        }
+    }
+    return c;
+}
+
+void Database::fillCursor(RecordCursor &c){
+    Metrics::Timer timer(metrics, Metrics::OP_CURSOR);
+    refresh();
+    std::shared_lock<RwLock> lock(rwLock);
+    c.window.clear();
+    c.offsets.clear();
+    if(!openFlag){
+        c.done = true;
+        return;
+    }
+    // отображение действительно, пока держится блокировка: окно копируется из него
+    RecordSpan records = scanRecords();
+    auto take = [&](size_t row){
+        const StoredStudent &rs = records.data[row];
+        if(rs.isActive == 0 || !c.filter.matches(rs)) return;
+        c.window.push_back(rs);
+        c.offsets.push_back(rowOffset(row));
+    };
+
+    if(!c.byId){
+        size_t first = c.filePos > dataStart ? rowOf(c.filePos) : 0;
+        size_t last = std::min(records.size(), first + CURSOR_WINDOW);
+        for(size_t row = first; row < last; row++) take(row);
+        if(last > first) metrics.add(Metrics::RECORDS_SCANNED, last - first);
+        c.filePos = rowOffset(last);
+        c.done = last >= records.size();
+        return;
+    }
+
+    // по id окно начинается заново с ключа, следующего за последним прочитанным,
+    // поэтому изменения дерева между окнами курсору не мешают
+    size_t seen = 0;
+    c.done = true;
+    if(c.nextId > c.lastId) return;
+    for(BPlusTree::Iterator it = index.lowerBound((int)c.nextId); it.valid() && it.key() <= c.lastId; it.next()){
+        if(seen == CURSOR_WINDOW){
+            c.done = false;
+            break;
+        }
+        size_t row = rowOf(it.value());
+        if(row < records.size()) take(row);
+        c.nextId = (long long)it.key() + 1;
+        seen++;
+    }
+    metrics.add(Metrics::RECORDS_SCANNED, seen);
+}
+
+std::vector<Student> Database::getPage(size_t offset, size_t limit){
+    std::vector<Student> res;
+    if(limit == 0) return res;
+    refresh();
+    std::shared_lock<RwLock> lock(rwLock);
+    if(!openFlag) return res;
+    RecordSpan records = scanRecords();
+    BPlusTree::Iterator it = index.begin();
+    for(size_t skipped = 0; skipped < offset && it.valid(); skipped++) it.next();
+    for(; it.valid() && res.size() < limit; it.next()){
+        size_t row = rowOf(it.value());
+        if(row < records.size()) res.push_back(toStudent(records.data[row]));
+    }
+    return res;
+}
+
+std::vector<Student> Database::getPageAfter(int afterId, size_t limit){
+    std::vector<Student> res;
+    if(limit == 0 || afterId == INT_MAX) return res;
+    refresh();
+    std::shared_lock<RwLock> lock(rwLock);
+    if(!openFlag) return res;
+    RecordSpan records = scanRecords();
+    for(BPlusTree::Iterator it = index.lowerBound(afterId + 1); it.valid() && res.size() < limit; it.next()){
+        size_t row = rowOf(it.value());
+        if(row < records.size()) res.push_back(toStudent(records.data[row]));
+    }
+    return res;
+}
+
+void Database::debugIndex(){
+    if(!Log::enabled(LogLevel::Debug)) return;
+    std::shared_lock<RwLock> lock(rwLock);
+    LOG_DEBUG("Index of " << dbFilename << ": " << index.size() << " entries");
+    for(BPlusTree::Iterator it = index.begin(); it.valid(); it.next()){
+        LOG_DEBUG("ID: " << it.key() << " -> Offset: " << it.value());
+    }
+}
+
 bool Database::checkIntegrity() {
+    refresh();
+    std::shared_lock<RwLock> lock(rwLock);
     if (!openFlag) return false;
     
-    std::cout << "=== Database Integrity Check ===" << std::endl;
-    std::cout << "Index entries: " << index.size() << std::endl;
-    
+    // построчный отчёт о записях собирается, только если его кто-то увидит
+    bool detail = Log::enabled(LogLevel::Trace);
 
-    fm.seekToBegin();
-    StoredStudent rs;
-    long long offset = 0;
-    int fileRecords = 0;
-    int activeRecords = 0;
-    
-    while (fm.readNext((char*)&rs, sizeof(StoredStudent))) {
-        fileRecords++;
-        if (rs.isActive) {
-            activeRecords++;
-            std::cout << "Active record - ID: " << rs.id << ", Name: " << rs.name 
-                      << ", Offset: " << offset << std::endl;
+    // каждая активная запись должна быть той, на которую указывает индекс
+    std::vector<bool> live = liveSlots();
+    RecordSpan records = scanRecords();
+    struct Part {
+        size_t active = 0;
+        size_t unindexed = 0;
+        std::string report;
+    };
+    std::vector<Part> parts = scanParts<Part>(scanPool(), records.size(), [&](size_t first, size_t last, Part &part){
+        std::ostringstream os;
+        for (size_t i = first; i < last; i++) {
+            const StoredStudent &rs = records.data[i];
+            if (!rs.isActive) continue;
+            long long offset = rowOffset(i);
+            part.active++;
+            if (detail) os << "Active record - ID: " << rs.id << ", Name: " << rs.name
+                           << ", Offset: " << offset << "\n";
+            if (i >= live.size() || !live[i]) {
+                part.unindexed++;
+                LOG_WARN("Record at offset " << offset << " is not referenced by the index");
+            }
         }
-        offset += sizeof(StoredStudent);
+        part.report = os.str();
+    });
+    size_t fileRecords = records.size();
+    size_t activeRecords = 0, unindexed = 0;
+    for (const Part &p: parts) {
+        if (!p.report.empty()) LOG_TRACE(p.report);
+        activeRecords += p.active;
+        unindexed += p.unindexed;
     }
     
-    std::cout << "Total records in file: " << fileRecords << std::endl;
-    std::cout << "Active records in file: " << activeRecords << std::endl;
-    std::cout << "Records in index: " << index.size() << std::endl;
+    metrics.add(Metrics::RECORDS_SCANNED, fileRecords);
+    LOG_DEBUG("Integrity check: " << fileRecords << " records in file, " << activeRecords
+              << " active, " << index.size() << " in index");
     
-    return activeRecords == index.size();
+    return activeRecords == index.size() && unindexed == 0;
 }
 
 
@@ -3,8 +3,27 @@
 
 #include <string>
 #include <vector>
-#include <unordered_map>
+#include <fstream>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <map>
 #include "FileManager.h"
+#include "Wal.h"
+#include "SecondaryIndex.h"
+#include "BPlusTree.h"
+#include "ColumnStore.h"
+#include "ThreadPool.h"
+#include "Query.h"
+#include "Aggregate.h"
+#include "Progress.h"
+#include "RwLock.h"
+#include "SharedSegment.h"
+#include "Metrics.h"
+#include "IdHash.h"
 
 #pragma pack(push,1)
 struct StoredStudent {
@@ -14,47 +33,330 @@ struct StoredStudent {
     double averageGrade;
     int cours;
 };
+#pragma pack(pop)
 
+// Заголовок файла данных, записи идут сразу за ним. Поколение растёт при каждой
+// контрольной точке, изменившей файл, и при его замене (clear, сжатие); индекс хранит
+// поколение и число записей, с которыми он согласован, и без них перестраивается.
+// Файл старого формата (без заголовка) переписывается при открытии на запись.
+#pragma pack(push,1)
+struct DataHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;  // sizeof(StoredStudent)
+    uint32_t reserved0;
+    uint64_t generation;
+    uint64_t records;     // число записей на момент последней контрольной точки
+    unsigned char reserved[28];
+    uint32_t crc;         // по всем полям выше
+};
+#pragma pack(pop)
+static_assert(sizeof(DataHeader) == 64, "data file header is 64 bytes");
+
+// Изменение в журнале WAL: образ записи по смещению либо операция над индексом
+// WAL_APPEND: за заголовком следуют id записей StoredStudent подряд начиная с offset
+enum : unsigned char { WAL_RECORD = 1, WAL_INDEX = 2, WAL_APPEND = 3 };
+#pragma pack(push,1)
+struct WalEntry {
+    unsigned char type;
+    long long offset;     // для WAL_INDEX: offset < 0 - удаление id
+    int id;
+    StoredStudent image;  // только для WAL_RECORD
+};
+#pragma pack(pop)
+
+// Записи файла данных, отображённые в память: проход без копирования
+struct RecordSpan {
+    const StoredStudent *data;
+    size_t count;
+    const StoredStudent *begin() const { return data; }
+    const StoredStudent *end() const { return data + count; }
+    size_t size() const { return count; }
+};
+
+// Изменение одной записи для подписчика базы. RESET означает, что прежние
+// смещения и содержимое недействительны (создание, открытие, clear, сжатие).
+struct Change {
+    enum Kind { INSERTED, UPDATED, DELETED, RESET };
+    Kind kind;
+    int id;               // для UPDATED - новый id, прежний в before.id
+    long long offset;
+    StoredStudent before; // UPDATED и DELETED
+    StoredStudent after;  // INSERTED и UPDATED
+};
+
+class Database;
+
+// Проход по активным записям без сборки всего результата в памяти. Записи читаются
+// окнами по нескольку сотен, так что память не зависит от размера таблицы, а первая
+// запись доступна сразу. current() ссылается на запись внутри окна и действительна
+// до следующего next(). Курсор не должен переживать свою базу.
+//   for(RecordCursor c = db.cursor(q); c.next(); ) use(c.current());
+class RecordCursor {
+    public:
+        RecordCursor();
+        bool next(); // false - записей больше нет
+        const StoredStudent &current() const { return window[pos]; }
+        long long offset() const { return offsets[pos]; }
+    private:
+        friend class Database;
+        Database *db;
+        Query filter;
+        bool byId;              // порядок по id (по B+-дереву), иначе порядок файла
+        long long filePos;      // первая непрочитанная запись файла
+        long long nextId;       // первый непрочитанный ключ; long long, чтобы вместить INT_MAX + 1
+        long long lastId;       // последний ключ, допустимый условием на id
+        bool done;
+        std::vector<StoredStudent> window;
+        std::vector<long long> offsets;
+        size_t pos;
+};
+
+// Базу можно использовать из нескольких потоков. Чтения (поиск, агрегаты, курсоры,
+// страницы, экспорт, проверка) идут параллельно под общей блокировкой и видят
+// согласованное состояние на время вызова; изменения выполняются по одному под
+// исключительной. Ожидание записи журнала (commit) и сбор удаляемых записей идут
+// без исключительной блокировки, так что читатели не ждут fsync пишущих.
+//
+// Между процессами: писатель у файла один (flock на <db>.shm), остальные процессы
+// открывают базу в Mode::ReadOnly. Писатель публикует снимок индекса при каждой
+// контрольной точке (и по setPublishInterval); читатели отображают неизменяемый файл
+// снимка (копию дерева или наложение изменённых с неё страниц) вместо загрузки индекса
+// и переходят на новый снимок при следующем чтении.
+// Читатель видит записи, попавшие в снимок, в их текущем на диске виде.
 class Database {
+    friend class RecordCursor;
+    public:
+        enum class Mode { ReadWrite, ReadOnly };
     private:
+        Metrics metrics; // первым: fm, index и wal обновляют его до своего разрушения
         FileManager fm;
         std::string dbFilename;
         std::string idxFilename;
-        bool openFlag;
-        std::unordered_map<int, long long> index;
-        bool loadIndex(); //открывает, читает, заполняет, возвращает
-        bool persistIndex();//открывает, записывает в файл, возвращает
-        long long appendRecordToFile(const StoredStudent &rs); //добавляет запись в окнец
-        bool markRecordDeleted(long long offset); //помечает запись как удаленное
+        std::atomic<bool> openFlag;
+        bool readOnly;
+        SharedSegment shm;       // <db>.shm: блокировка писателя и номер опубликованного снимка
+        bool unpublished;        // писатель: индекс менялся после последней публикации
+        int publishMs;           // 0 - публикация только в контрольных точках
+        uint64_t snapshotBase;   // писатель: поколение полной копии дерева под наложениями, 0 - ещё нет
+        std::chrono::steady_clock::time_point lastPublish;
+        uint64_t attachedSeq;    // читатель: публикация, на которой он сейчас
+        long long publishedBytes; // читатель: часть файла данных, покрытая снимком
+        long long dataStart;     // смещение первой записи: размер заголовка, 0 у файла старого формата
+        uint64_t generation;     // поколение файла данных
+        bool generationDirty;    // файл данных менялся после последней отметки поколения
+        uint64_t backupChain;    // цепочка копий: полная копия и её дельты, 0 - копий не было
+        uint32_t backupSeq;      // номер последней копии в цепочке, 0 - полная
+        bool backupMapDirty;     // <db>.bkmap отстаёт от учёта изменённых страниц
+        BPlusTree index; // id -> смещение записи, файл <db>.idx
+        // Точечные поиски по id идут в плоскую хеш-таблицу в памяти; дерево остаётся
+        // для диапазонов, обхода по порядку и хранения. Таблица - кэш дерева у писателя:
+        // при открытии она пуста и заполняется промахами, изменения пишутся в неё сразу.
+        // Когда в ней все ключи дерева, промах окончателен. У читателя снимка её нет.
+        IdHash ids;
+        bool idsOn;
+        std::shared_mutex idsMutex; // заполнение промахами идёт под общей блокировкой rwLock
+        Wal wal;
+        mutable RwLock rwLock; // читатели - общая блокировка, изменения - исключительная
+        std::mutex poolMutex;   // ленивое создание пула параллельными читателями
+        std::mutex statsMutex;  // перестройка статистики читателем
+        std::mutex changeMutex; // changeHook и pendingChanges
+        std::mutex backupMutex; // копии и восстановление идут по одному: копирование - под общей блокировкой
+        double autoCompactRatio; // 0 - автоматическое сжатие выключено
+        std::vector<long long> freeSlots; // смещения удалённых записей для повторного использования
+        bool freeDirty;
+        SecondaryIndexes sidx; // включённые вторичные индексы, <db>.sidx
+        bool sidxDirty;
+        ColumnStore cols; // колонки cours/averageGrade/isActive для фильтров, <db>.col.*
+        bool colsDirty;
+        std::unique_ptr<ThreadPool> pool; // потоки для проходов по файлу, создаются при первом проходе
+        size_t scanThreads;
+        std::function<void(const std::vector<Change>&)> changeHook;
+        std::vector<Change> pendingChanges; // накоплены под блокировкой, отдаются после неё
+        CoursStats stats; // агрегаты по курсам, строятся при первом запросе и поддерживаются при изменениях
+        bool loadIndex(); //false, если дерево надо перестроить по файлу данных
+        bool rebuildIndex(); //индекс заново по активным записям файла
+        void resetIds(); //пустая хеш-таблица id, заполняется промахами findId
+        // первичный индекс: дерево и хеш-таблица меняются вместе
+        bool findId(int id, long long &offset); // с учётом в INDEX_HITS/INDEX_MISSES
+        bool lookupId(int id, long long &offset);
+        void indexPut(int id, long long offset);
+        void indexErase(int id);
+        void idsPut(int id, long long offset);
+        std::vector<bool> liveSlots(); //по номеру записи: указывает ли на неё индекс
+        unsigned long long logMutation(const std::vector<WalEntry> &ops); //запись в WAL, возвращает LSN
+        bool applyWalRecord(const char *payload, size_t size); //повтор записи WAL при восстановлении
+        bool checkpoint(); //WAL -> данные -> индекс на диск, WAL очищается
+        void maybeCheckpoint();
+        long long appendRecordToFile(const StoredStudent &rs, unsigned long long lsn); //добавляет запись в окнец
+        bool markRecordDeleted(long long offset, unsigned long long lsn); //помечает запись как удаленное
         bool readRecordAt(long long offset, StoredStudent &out);//чтение на указанной позиции
+        RecordSpan scanRecords(); //все записи файла через mmap
+        // смещение записи по её номеру и обратно; число записей в файле
+        long long rowOffset(size_t row) const { return dataStart + (long long)row * (long long)sizeof(StoredStudent); }
+        size_t rowOf(long long offset) const { return (size_t)((offset - dataStart) / (long long)sizeof(StoredStudent)); }
+        long long recordCount() const {
+            return fm.size() > dataStart ? (fm.size() - dataStart) / (long long)sizeof(StoredStudent) : 0;
+        }
+        static bool writeDataHeader(FileManager &file, uint64_t generation, long long records);
+        bool readDataHeader(); //dataStart и generation по заголовку; false - заголовок повреждён
+        bool stampGeneration(); //новое поколение в заголовке файла данных и в индексе
+        bool upgradeDataFile(); //переписывает файл старого формата с заголовком
+        // <db>.bkmap: цепочка копий и страницы, изменённые после последней копии;
+        // страницы индекса берутся, только если дерево не перестраивалось при открытии
+        bool loadBackupMap(bool indexValid);
+        bool persistBackupMap();
+        ThreadPool *scanPool(); //nullptr - проходы в одном потоке
+        // активные записи, подходящие под запрос, одним параллельным проходом в порядке файла
+        std::vector<std::pair<long long, StoredStudent>> scanMatches(const Query &q, Progress *progress = nullptr);
+        // кандидаты по индексу для условий верхнего уровня; false - нужен полный проход
+        bool queryCandidates(const Query &q, std::vector<long long> &offsets, std::string &plan);
+        std::vector<std::pair<long long, StoredStudent>> collectQuery(const Query &q, Progress *progress = nullptr);
+        bool loadFreeList(); //список свободных мест из <db>.free
+        bool persistFreeList();
+        void rebuildFreeList(); //свободные места по проходу файла
+        bool takeFreeSlot(long long &offset); //проверенное свободное место либо false
+        void secondaryInsert(const StoredStudent &rs, long long offset);
+        void secondaryErase(const StoredStudent &rs, long long offset);
+        void rebuildSecondary();
+        bool persistSecondary();
+        void columnsPut(const StoredStudent &rs, long long offset);
+        void rebuildColumns();
+        bool persistColumns();
+        // смещения активных записей с lo <= field <= hi по колонкам; false, если колонок нет
+        bool columnOffsets(const std::string &field, double lo, double hi, std::vector<long long> &offsets);
+        // активные записи с lo <= field <= hi; false, если поле не поддерживает диапазон
+        // или числовая граница разбирается не целиком (как значение в Query)
+        bool collectRange(const std::string &field, const std::string &lo, const std::string &hi,
+                          std::vector<std::pair<long long, StoredStudent>> &out);
+        // удаление собранных записей одной записью журнала; снимает блокировку на время commit
+        // записи, изменившиеся после сбора, пропускаются
+        size_t deleteRecords(const std::vector<std::pair<long long, StoredStudent>> &victims, std::unique_lock<RwLock> &lock);
+        void statsInsert(const StoredStudent &rs);
+        void statsErase(const StoredStudent &rs);
+        void rebuildStats();
+        // агрегаты поля по курсам среди записей под q; false, если поле не числовое
+        bool aggregateGroups(const std::string &field, const Query &q, std::map<int, Aggregate> &out, Progress *progress);
+        void fillCursor(RecordCursor &c); //следующее окно курсора
+        void noteChange(Change::Kind kind, long long offset, const StoredStudent *before, const StoredStudent *after);
+        void notifyChanges(); //вызывается без блокировки rwLock
+        long long compactLocked();
+        bool writable() const { return openFlag && !readOnly; }
+        std::string snapshotFile(uint64_t generation) const; // <db>.idx.<поколение>
+        bool publishSnapshot(); //писатель: копия индекса для читателей, если он менялся
+        bool attachSnapshot();  //читатель: последний опубликованный снимок
+        bool openWriterLocked(const std::string &filename);
+        bool openReaderLocked(const std::string &filename);
+        bool openLocked(const std::string &filename, Mode mode);
+        bool closeLocked();
+        void releaseLocked(); //закрывает файлы без контрольной точки
+        void maybeAutoCompact();
+        static bool finishCompaction(const std::string &filename); //довершает прерванное сжатие
     public:
         Database();
         ~Database();
         bool create(const std::string &filename);
-        bool open(const std::string &filename);
+        // ReadWrite не открывается, пока базу пишет другой процесс (writerActive);
+        // ReadOnly требует снимка, опубликованного писателем хотя бы раз
+        bool open(const std::string &filename, Mode mode = Mode::ReadWrite);
+        bool isReadOnly() const { return readOnly; }
+        static bool writerActive(const std::string &filename);
+        // Писатель: опубликовать снимок сейчас, если что-то менялось / не реже чем раз в ms после изменений.
+        // Читатель: refresh() переходит на последний снимок (true - он сменился);
+        // чтения делают это и сами.
+        bool publish();
+        void setPublishInterval(int ms) { publishMs = ms; }
+        bool refresh();
         bool close();
         bool removeDB(const std::string &filename);
         bool clear();
         bool save();
+        void setDurability(Wal::Durability d, int batchMs = 10);
+        // Счётчики и задержки операций с создания объекта или resetMetrics()
+        Metrics::Snapshot metricsSnapshot() const { return metrics.snapshot(); }
+        std::string metricsJson() const { return metrics.snapshot().toJson(); }
+        void resetMetrics() { metrics.reset(); }
+        // Потоки для полных проходов по файлу (поиск, удаление, экспорт, проверка, перестройка индекса):
+        // 0 - по числу ядер, 1 - без пула.
+        void setScanThreads(size_t threads);
+
+        // Подписчик получает изменения пакетом на каждую операцию после её commit,
+        // в потоке, выполнившем операцию, и без блокировки базы: из него можно читать базу.
+        void setChangeHook(const std::function<void(const std::vector<Change>&)> &hook);
 
         bool addRecord(const Student &s, std::string &err);
-        size_t deleteByField(const std::string &field, const std::string &value);
-        std::vector<Student> searchByField(const std::string &field, const std::string &value);
+        // Пакетная вставка: одна запись в файл, одна запись WAL, индекс обновляется один раз.
+        // Строки с повторяющимся id пропускаются и описываются в errors.
+        size_t addRecords(const std::vector<Student> &students, std::vector<std::string> &errors);
+        // Поиск и удаление по условию: search(Query::parse("cours = 3 AND averageGrade >= 4.5")).
+        // Условия верхнего уровня по id, name, cours и averageGrade выбирают индекс или колонки,
+        // остальное проверяется скомпилированным предикатом при проходе по файлу.
+        // progress (необязателен) получает число просмотренных записей и позволяет отменить
+        // операцию: search тогда возвращает пустой результат, deleteWhere ничего не удаляет.
+        // Удаления возвращают число удалённых записей; 0 и при ошибке синхронизации журнала.
+        std::vector<Student> search(const Query &q, Progress *progress = nullptr);
+        size_t deleteWhere(const Query &q, Progress *progress = nullptr);
+        // равенство по одному полю: обёртки над search/deleteWhere
+        size_t deleteByField(const std::string &field, const std::string &value, Progress *progress = nullptr);
+        std::vector<Student> searchByField(const std::string &field, const std::string &value, Progress *progress = nullptr);
         bool editRecordByKey(int keyId, const Student &newS);
-        bool backup(const std::string &backupFile);
-        bool restoreFromBackup(const std::string &backupFile);
-        bool exportCSV(const std::string &csvFile);
+        // Диапазон lo <= field <= hi по id, cours, averageGrade или name; пустая граница не ограничивает.
+        // id идёт по B+-дереву, cours и averageGrade - по вторичным индексам, если они включены,
+        // иначе выполняется один проход по файлу с проверкой условия.
+        std::vector<Student> searchRange(const std::string &field, const std::string &lo, const std::string &hi);
+        size_t deleteRange(const std::string &field, const std::string &lo, const std::string &hi);
+        // count/sum/avg/min/max по averageGrade или cours среди записей под q, с группировкой
+        // по cours или без неё. Значения берутся прямо из записей файла без создания Student.
+        // Без условия ответ даёт статистика, которая обновляется при добавлении, изменении
+        // и удалении, поэтому файл не читается. false - поле не averageGrade и не cours
+        // либо проход отменён через progress.
+        bool aggregate(const std::string &field, const Query &q, Aggregate &out, Progress *progress = nullptr);
+        bool aggregateByCours(const std::string &field, const Query &q, std::map<int, Aggregate> &out, Progress *progress = nullptr);
+        // Копирование с ходом в байтах; отменённая операция удаляет уже скопированные файлы
+        bool backup(const std::string &backupFile, Progress *progress = nullptr);
+        bool restoreFromBackup(const std::string &backupFile, Progress *progress = nullptr);
+        // Инкрементальная копия (дельта): страницы файла данных и индекса, изменённые после
+        // предыдущей копии этой базы, полной или инкрементальной, и список свободных мест.
+        // Нужна хотя бы одна полная backup(); восстановление - полная копия и её дельты по порядку.
+        bool backupIncremental(const std::string &deltaFile, Progress *progress = nullptr);
+        bool restoreFromBackup(const std::string &backupFile, const std::vector<std::string> &deltas,
+                               Progress *progress = nullptr);
+        bool exportCSV(const std::string &csvFile, Progress *progress = nullptr);
         bool isOpen() const { return openFlag; }
-        std::string getFilename() const { return dbFilename; }
+        std::string getFilename() const {
+            std::shared_lock<RwLock> lock(rwLock);
+            return dbFilename;
+        }
         std::vector<Student> getAll();
+        // Курсоры: в порядке файла с условием и в порядке id начиная с fromId.
+        // Границы id из условий верхнего уровня сужают проход по дереву.
+        RecordCursor cursor(const Query &q = Query());
+        RecordCursor cursorById(int fromId, const Query &q = Query());
+        // Страница в порядке id: пропуск offset записей по листьям B+-дерева либо
+        // продолжение после последнего показанного id (keyset), что не зависит от номера страницы.
+        std::vector<Student> getPage(size_t offset, size_t limit);
+        std::vector<Student> getPageAfter(int afterId, size_t limit);
         bool checkIntegrity(); 
-        void debugIndex() { // добавить в публичную секцию
-            std::cout << "=== INDEX DEBUG ===" << std::endl;
-            std::cout << "Index size: " << index.size() << std::endl;
-            for (const auto& pair : index) {
-                std::cout << "ID: " << pair.first << " -> Offset: " << pair.second << std::endl;
-        }
-    }
+
+        // Сжатие: живые записи переписываются в новый файл, который атомарно
+        // подменяет старый; индекс строится заново. Возвращает освобождённые байты или -1.
+        long long compact();
+        // Автоматическое сжатие после удалений, когда доля мёртвых записей больше ratio (0 - выключено)
+        void setAutoCompact(double ratio) { autoCompactRatio = ratio; }
+        double deadRatio();
+
+        // Вторичные индексы на name (хеш), cours (списки) и averageGrade (упорядоченный).
+        // Поддерживаются при изменениях и используются searchByField/deleteByField автоматически.
+        bool createIndex(const std::string &field);
+        bool dropIndex(const std::string &field);
+        bool hasIndex(const std::string &field) const;
+
+        // Колоночная копия id/cours/averageGrade/isActive (<db>.col.*): поиск по cours и
+        // averageGrade без индекса фильтрует колонки векторными ядрами вместо прохода по записям.
+        bool setColumnStore(bool enabled);
+        bool hasColumnStore() const { return cols.enabled(); }
+        // Содержимое первичного индекса в журнал на уровне Debug; без него дерево не обходится
+        void debugIndex();
 };
 
 #endif
\ No newline at end of file
@@ -1,62 +1,66 @@
 #include "FileManager.h"
+#include "Log.h"
 #include<cstdio>
 #include<sys/stat.h>
 #include <cstring>
-
-
-FileManager::FileManager(){}
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+
+FileManager::FileManager(size_t pageSize_, size_t cachePages)
+    : fd(-1), fileSize(0), diskSize(0), dirtyPages(0), metrics(nullptr), mapData(nullptr), mapSize(0), mapPrivate(false), mapStale(false), readOnly(false) {
+    // размер страницы - степень двойки в пределах 4..64 KiB
+    pageSize = MIN_PAGE_SIZE;
+    while(pageSize < pageSize_ && pageSize < MAX_PAGE_SIZE) pageSize <<= 1;
+    maxPages = cachePages > 0 ? cachePages : 1;
+}
 FileManager::~FileManager(){
     closeFile();
 }
 
 bool FileManager::createFile(const std::string &filename_) {
-    closeFile();
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    closeLocked();
 
-    std::ofstream ofs(filename_, std::ios::binary | std::ios::trunc);
-    if (!ofs) return false;
-    ofs.close();
+    fd = ::open(filename_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    readOnly = false;
 
     filename = filename_;
-
-    fs.open(filename_, std::ios::in |
-                       std::ios::out |
-                       std::ios::binary |
-                       std::ios::ate);
-
-    return fs.is_open();
+    fileSize = diskSize = 0;
+    for(Changes &c: changed) c = Changes();
+    return true;
 }
 
 
 
-bool FileManager::openFile(const std::string &filename_) {
-    closeFile();
+bool FileManager::openFile(const std::string &filename_, bool readOnly_) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    closeLocked();
 
     filename = filename_;
+    readOnly = readOnly_;
 
-
-    std::ifstream test(filename_);
-    bool exists = test.good();
-    test.close();
-
-
-    if (!exists) {
-        std::ofstream ofs(filename_, std::ios::binary | std::ios::trunc);
-        if (!ofs) return false;
-        ofs.close();
-    }
-
-
-    fs.open(filename_, std::ios::in |
-                       std::ios::out |
-                       std::ios::binary |
-                       std::ios::ate);
-
-    if (!fs.is_open())
+    fd = readOnly ? ::open(filename_.c_str(), O_RDONLY) : ::open(filename_.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
         return false;
 
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
 
-    fs.seekg(0);
-
+    fileSize = diskSize = st.st_size;
+    for(Changes &c: changed) c = Changes();
     return true;
 }
 
@@ -64,137 +68,393 @@ bool FileManager::openFile(const std::string &filename_) {
 
 
 void FileManager::closeFile(){
-    if(fs.is_open()){
-        fs.close();
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    closeLocked();
+}
+
+void FileManager::closeLocked(){
+    if(fd >= 0){
+        unmapLocked();
+        flushDirty();
+        dropCache();
+        ::close(fd);
+        fd = -1;
     }
 }
 
 bool FileManager::truncate(){
-    closeFile();
-    std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
-    if(!ofs){return false;}
-    ofs.close();
-    fs.open(filename, std::ios::in | std::ios::out | std::ios::binary);
-    return fs.good();
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if(fd < 0 || readOnly){return false;}
+    unmapLocked();
+    dropCache();
+    // ftruncate на месте отняло бы страницы у отображений других процессов (SIGBUS),
+    // поэтому пустой файл создаётся рядом и атомарно подменяет прежний
+    std::string tmp = filename + ".truncate";
+    int nfd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(nfd < 0){return false;}
+    if(std::rename(tmp.c_str(), filename.c_str()) != 0){
+        ::close(nfd);
+        std::remove(tmp.c_str());
+        return false;
+    }
+    ::close(fd);
+    fd = nfd;
+    fileSize = diskSize = 0;
+    for(Changes &c: changed) c = Changes();
+    return true;
 }
 
-long long FileManager::append(const char *buf, size_t size){
-    if(!fs.is_open()){
-        std::cerr << "File not open in append!" << std::endl;
-        return -1;
+bool FileManager::sync(){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if(fd < 0){return false;}
+    if(readOnly){return true;}
+    if(!flushDirty()){return false;}
+    if(metrics) metrics->add(Metrics::FSYNCS);
+    return fsync(fd) == 0;
+}
+
+const char *FileManager::mapView(size_t &size){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return mapLocked(size);
+}
+
+const char *FileManager::mapLocked(size_t &size){
+    size = 0;
+    if(fd < 0){return nullptr;}
+    // отображение файла видит всё, что записано pwrite; собранное из кэша - только
+    // состояние на момент сборки
+    bool current = mapPrivate ? !mapStale : dirtyPages == 0;
+    if(mapData && mapSize == (size_t)fileSize && current){
+        size = mapSize;
+        return mapData;
+    }
+    unmapLocked();
+    if(fileSize == 0){return nullptr;}
+
+    if(readOnly || (dirtyPages == 0 && fileSize <= diskSize)){
+        void *p = mmap(nullptr, (size_t)fileSize, PROT_READ, MAP_SHARED, fd, 0);
+        if(p == MAP_FAILED){
+            LOG_ERROR("mmap failed on " << filename);
+            return nullptr;
+        }
+        madvise(p, (size_t)fileSize, MADV_SEQUENTIAL);
+        mapData = (char*)p;
+    } else if(!(mapData = mapWithCache())){
+        return nullptr;
     }
+    mapSize = (size_t)fileSize;
+    size = mapSize;
+    return mapData;
+}
 
-    if (fs.fail()) {
-        std::cerr << "File stream in fail state!" << std::endl;
-        fs.clear(); 
+// Грязные страницы не записываются ради чтения: иначе проход читателя ждал бы
+// fdatasync журнала через walHook. Файл отображается приватно, за его концом -
+// анонимная память, и поверх кладутся копии грязных страниц кэша; копирование
+// при записи затрагивает только эти страницы.
+char *FileManager::mapWithCache(){
+    void *p = mmap(nullptr, (size_t)fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED){
+        LOG_ERROR("mmap failed on " << filename);
+        return nullptr;
     }
-    
-    fs.seekp(0, std::ios::end);
-    long long pos = fs.tellp();
-    
-    if (fs.fail()) {
-        std::cerr << "seekp/tellp failed!" << std::endl;
-        return -1;
+    size_t onDisk = (size_t)std::min(diskSize, fileSize);
+    if(onDisk > 0 && mmap(p, onDisk, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED){
+        LOG_ERROR("mmap failed on " << filename);
+        munmap(p, (size_t)fileSize);
+        return nullptr;
     }
-    
-    fs.write(buf, size);
-    
-    if (fs.fail()) {
-        std::cerr << "write failed!" << std::endl;
-        return -1;
+    char *view = (char*)p;
+    for(const Page &page: lru){
+        if(!page.dirty) continue;
+        long long start = page.number * (long long)pageSize;
+        if(start >= fileSize) continue;
+        size_t len = (size_t)std::min<long long>((long long)pageSize, fileSize - start);
+        memcpy(view + start, page.data.data(), len);
     }
-    
-    fs.flush();
-    return pos;
+    mprotect(p, (size_t)fileSize, PROT_READ);
+    madvise(p, (size_t)fileSize, MADV_SEQUENTIAL);
+    mapPrivate = true;
+    mapStale = false;
+    return view;
 }
 
-bool FileManager::writeAt(long long offset, const char *buf, size_t size){
-    if(!fs.is_open()){
-        return false;
+void FileManager::unmapView(){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    unmapLocked();
+}
+
+void FileManager::unmapLocked(){
+    if(mapData){
+        munmap(mapData, mapSize);
+        mapData = nullptr;
+        mapSize = 0;
     }
-    fs.seekp(offset);
-    fs.write(buf, size);
-    fs.flush();
-    return true;
+    mapPrivate = false;
 }
 
-bool FileManager::readAt(long long offset, char *buf, size_t size){
-    if(!fs.is_open()){
+void FileManager::dropCache(){
+    lru.clear();
+    pages.clear();
+    dirtyPages = 0;
+}
+
+bool FileManager::writeBack(Page &p){
+    if(p.lsn != 0 && walHook && !walHook(p.lsn)){
+        LOG_ERROR("journal is behind page " << p.number << " of " << filename);
         return false;
     }
-    fs.seekg(offset);
-    fs.read(buf, size);
-    return fs.good();
+    long long start = p.number * (long long)pageSize;
+    size_t len = (size_t)std::min<long long>((long long)pageSize, fileSize - start);
+    size_t done = 0;
+    while(done < len){
+        ssize_t n = pwrite(fd, p.data.data() + done, len - done, start + done);
+        if(n < 0){
+            LOG_ERROR("pwrite failed on " << filename);
+            return false;
+        }
+        done += n;
+    }
+    if(metrics) metrics->add(Metrics::BYTES_WRITTEN, len);
+    diskSize = std::max(diskSize, start + (long long)len);
+    p.dirty = false;
+    dirtyPages--;
+    p.lsn = 0;
+    return true;
 }
 
-void FileManager::seekToBegin(){
-    if(fs.is_open()){
-        fs.seekg(0, std::ios::beg);
+bool FileManager::flushDirty(){
+    if(dirtyPages == 0){return true;}
+    bool ok = true;
+    for(auto &p: lru){
+        if(p.dirty && !writeBack(p)) ok = false;
     }
+    return ok;
 }
 
-bool FileManager::readNext(char* buf, size_t size){
-    if(!fs.is_open()){
-        return false;
+FileManager::Page *FileManager::getPage(long long number, bool wholePageWrite){
+    auto it = pages.find(number);
+    if(it != pages.end()){
+        lru.splice(lru.begin(), lru, it->second);
+        return &*it->second;
     }
-    
 
-    if (fs.eof()) {
-        fs.clear();
+    // вытесняем самую старую страницу и переиспользуем её буфер
+    if(pages.size() >= maxPages){
+        Page &victim = lru.back();
+        if(victim.dirty && !writeBack(victim)){return nullptr;}
+        pages.erase(victim.number);
+        lru.splice(lru.begin(), lru, std::prev(lru.end()));
+    } else {
+        lru.emplace_front();
+        lru.front().data.resize(pageSize);
     }
-    
 
-    std::streampos current = fs.tellg();
-    fs.seekg(0, std::ios::end);
-    std::streampos end = fs.tellg();
-    fs.seekg(current); 
-    
-    if (current == end) {
-        return false; 
+    Page &p = lru.front();
+    p.number = number;
+    p.dirty = false;
+    p.lsn = 0;
+
+    long long start = number * (long long)pageSize;
+    size_t have = 0;
+    if(!wholePageWrite && start < diskSize){
+        size_t want = (size_t)std::min<long long>((long long)pageSize, diskSize - start);
+        while(have < want){
+            ssize_t n = pread(fd, p.data.data() + have, want - have, start + have);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0){
+                // нули вместо данных не отдаются: пустой буфер уходит в конец списка
+                // и будет вытеснен первым
+                LOG_ERROR("pread failed on " << filename << " at page " << number
+                          << (n < 0 ? ": " + std::string(strerror(errno)) : std::string(": file is shorter than expected")));
+                p.number = -1;
+                lru.splice(lru.end(), lru, lru.begin());
+                return nullptr;
+            }
+            have += n;
+        }
+        if(metrics) metrics->add(Metrics::BYTES_READ, have);
     }
-    
-    if (end - current < static_cast<std::streampos>(size)) {
-        return false; 
+    if(have < pageSize) memset(p.data.data() + have, 0, pageSize - have);
+
+    pages[number] = lru.begin();
+    return &p;
+}
+
+long long FileManager::append(const char *buf, size_t size, unsigned long long lsn){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if(fd < 0){
+        LOG_ERROR("File not open in append!");
+        return -1;
     }
 
-    fs.read(buf, size);
-    
+    long long pos = fileSize;
+    if(readOnly || !writeLocked(pos, buf, size, lsn)){
+        LOG_ERROR("write failed on " << filename);
+        return -1;
+    }
+    return pos;
+}
 
-    if (fs.gcount() != static_cast<std::streamsize>(size)) {
+bool FileManager::writeAt(long long offset, const char *buf, size_t size, unsigned long long lsn){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return writeLocked(offset, buf, size, lsn);
+}
+
+bool FileManager::writeLocked(long long offset, const char *buf, size_t size, unsigned long long lsn){
+    if(fd < 0 || offset < 0 || readOnly){
         return false;
     }
-    
+    while(size > 0){
+        long long number = offset / (long long)pageSize;
+        size_t inPage = (size_t)(offset % (long long)pageSize);
+        size_t chunk = std::min(size, pageSize - inPage);
+        // страница за концом файла, перезаписываемая целиком, не читается с диска
+        bool whole = chunk == pageSize || number * (long long)pageSize >= diskSize;
+        Page *p = getPage(number, whole);
+        if(!p){return false;}
+        memcpy(p->data.data() + inPage, buf, chunk);
+        for(Changes &c: changed){
+            if(c.all) continue;
+            size_t word = (size_t)(number / 64);
+            if(word >= c.bits.size()) c.bits.resize(word + 1, 0);
+            c.bits[word] |= 1ull << (number % 64);
+        }
+        if(!p->dirty) dirtyPages++;
+        p->dirty = true;
+        mapStale = true;
+        p->lsn = std::max(p->lsn, lsn);
+        offset += chunk;
+        buf += chunk;
+        size -= chunk;
+        fileSize = std::max(fileSize, offset);
+    }
     return true;
 }
-bool FileManager::copyTo(const std::string &dest){
-    return copyFile(filename, dest);
+
+bool FileManager::readAt(long long offset, char *buf, size_t size){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if(fd < 0 || offset < 0){
+        return false;
+    }
+    if(offset + (long long)size > fileSize){
+        return false;
+    }
+    if(readOnly){
+        size_t mapped;
+        const char *p = mapLocked(mapped);
+        if(!p){return false;}
+        memcpy(buf, p + offset, size);
+        if(metrics) metrics->add(Metrics::BYTES_READ, size);
+        return true;
+    }
+    while(size > 0){
+        long long number = offset / (long long)pageSize;
+        size_t inPage = (size_t)(offset % (long long)pageSize);
+        size_t chunk = std::min(size, pageSize - inPage);
+        Page *p = getPage(number, false);
+        if(!p){return false;}
+        memcpy(buf, p->data.data() + inPage, chunk);
+        offset += chunk;
+        buf += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+FileManager::Changes FileManager::changedPages(Tracker t){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return changed[t];
+}
+
+void FileManager::setChangedPages(const Changes &c, Tracker t){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    changed[t] = c;
+}
+
+void FileManager::clearChangedPages(Tracker t){
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    changed[t].all = false;
+    changed[t].bits.clear();
+}
+
+bool FileManager::copyTo(const std::string &dest, const std::function<bool(long long)> &onBytes){
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if(fd >= 0 && !flushDirty()){return false;}
+    }
+    return copyFile(filename, dest, onBytes);
 }
-bool FileManager::copyFile(const std::string &src, const std::string &dest){
-    std::ifstream ifs(src, std::ios::binary);
-    if(!ifs){
-        std::cerr << "Cannot open source file: " << src << std::endl;
+bool FileManager::copyFile(const std::string &src, const std::string &dest, const std::function<bool(long long)> &onBytes){
+    int in = ::open(src.c_str(), O_RDONLY);
+    if(in < 0){
+        LOG_ERROR("Cannot open source file: " << src);
         return false;
     }
-    
-    std::ofstream ofs(dest, std::ios::binary | std::ios::trunc);
-    if(!ofs){
-        std::cerr << "Cannot create destination file: " << dest << std::endl;
-        ifs.close();
+    int out = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out < 0){
+        LOG_ERROR("Cannot create destination file: " << dest);
+        ::close(in);
         return false;
     }
-    
-    ofs << ifs.rdbuf();
-    
-    bool success = !ifs.fail() && !ofs.fail();
-    
-    ifs.close();
-    ofs.close();
-    
+
+    struct stat st;
+    bool success = fstat(in, &st) == 0, stopped = false;
+    long long total = success ? (long long)st.st_size : 0, done = 0;
+#ifdef __linux__
+    if(success && total > 0 && ioctl(out, FICLONE, in) == 0){
+        done = total;
+        if(onBytes && !onBytes(total)) stopped = true;
+    }
+    // кусками, чтобы между ними сообщать о ходе копирования и проверять отмену;
+    // файловая система без copy_file_range отказывает на первом куске
+    while(success && !stopped && done < total){
+        loff_t inPos = done, outPos = done;
+        ssize_t n = copy_file_range(in, &inPos, out, &outPos, (size_t)std::min<long long>(COPY_CHUNK, total - done), 0);
+        if(n < 0 && done == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) break;
+        if(n < 0){success = false; break;}
+        if(n == 0) break; // файл стал короче
+        done += n;
+        if(onBytes && !onBytes((long long)n)) stopped = true;
+    }
+#endif
+    std::vector<char> buf;
+    while(success && !stopped && done < total){
+        buf.resize(COPY_CHUNK);
+        ssize_t got = pread(in, buf.data(), (size_t)std::min<long long>(COPY_CHUNK, total - done), done);
+        if(got < 0){success = false; break;}
+        if(got == 0) break;
+        for(ssize_t put = 0; put < got; ){
+            ssize_t n = pwrite(out, buf.data() + put, (size_t)(got - put), done + put);
+            if(n < 0){success = false; break;}
+            put += n;
+        }
+        if(!success) break;
+        done += got;
+        if(onBytes && !onBytes((long long)got)) stopped = true;
+    }
+    success = success && !stopped;
+
+    ::close(in);
+    if(::close(out) != 0) success = false;
+
     if(!success){
-        std::cerr << "File copy failed from " << src << " to " << dest << std::endl;
+        if(!stopped) LOG_ERROR("File copy failed from " << src << " to " << dest);
         std::remove(dest.c_str());
     }
-    
+
     return success;
 }
 
+bool FileManager::syncPath(const std::string &path){
+    int f = ::open(path.c_str(), O_RDONLY);
+    if(f < 0){return false;}
+    bool ok = fsync(f) == 0;
+    ::close(f);
+    return ok;
+}
+
+bool FileManager::syncDir(const std::string &path){
+    size_t slash = path.find_last_of('/');
+    if(slash == std::string::npos) return syncPath(".");
+    return syncPath(slash == 0 ? "/" : path.substr(0, slash));
+}
@@ -3,6 +3,11 @@
 #include<iostream>
 #include<fstream>
 #include <vector>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include "Metrics.h"
 
 struct Student
 {
@@ -17,30 +22,112 @@ struct Student
     }
 };
 
+// Файл читается и пишется через кэш страниц фиксированного размера (LRU).
+// Изменённые страницы попадают на диск при вытеснении, closeFile() или sync().
+// Чтение и запись позиционные (pread/pwrite по смещению), общего курсора нет;
+// кэш защищён мьютексом, так что читать можно из нескольких потоков сразу.
 class FileManager{
+    public:
+        // Страницы, изменённые записью с последнего clearChangedPages(), - основа
+        // инкрементальных копий. all - изменения неизвестны (файл только что открыт,
+        // создан или заменён), и копировать надо весь файл.
+        struct Changes {
+            bool all = true;
+            std::vector<uint64_t> bits; // бит на страницу
+        };
+        // Учёт ведётся независимо для копий и для снимков, которые писатель публикует читателям
+        enum Tracker { TRACK_BACKUP, TRACK_PUBLISH, TRACKERS };
     private:
+        struct Page {
+            long long number;       // номер страницы в файле
+            bool dirty;
+            unsigned long long lsn; // последняя запись журнала, изменившая страницу
+            std::vector<char> data;
+        };
+
         std::string filename;
-        std::fstream fs;
+        int fd;
+        long long fileSize;         // логический размер, включая ещё не записанные страницы
+        long long diskSize;         // размер файла на диске
+        size_t pageSize;
+        size_t maxPages;
+        std::list<Page> lru;        // в начале - последние использованные
+        std::unordered_map<long long, std::list<Page>::iterator> pages;
+        size_t dirtyPages;          // mapView без записей между вызовами не обходит кэш
+        std::function<bool(unsigned long long)> walHook;
+        Metrics *metrics;           // байты pread/pwrite и fsync, может быть nullptr
+        char *mapData;              // отображение файла для последовательных проходов
+        size_t mapSize;
+        bool mapPrivate;            // собрано mapWithCache(), а не общее отображение файла
+        bool mapStale;              // после сборки были записи
+        std::mutex cacheMutex;      // страницы, отображение и размеры
+        bool readOnly;              // чтение прямо из отображения, без кэша страниц
+        Changes changed[TRACKERS];
+
+        // вызываются под cacheMutex
+        Page *getPage(long long number, bool wholePageWrite);
+        bool writeBack(Page &p);
+        bool flushDirty();
+        void dropCache();
+        void closeLocked();
+        void unmapLocked();
+        const char *mapLocked(size_t &size);
+        char *mapWithCache();
+        bool writeLocked(long long offset, const char *buf, size_t size, unsigned long long lsn);
     public:
-        FileManager();
+        static constexpr size_t MIN_PAGE_SIZE = 4 * 1024;
+        static constexpr size_t MAX_PAGE_SIZE = 64 * 1024;
+        static constexpr size_t DEFAULT_PAGE_SIZE = 16 * 1024;
+        static constexpr size_t DEFAULT_CACHE_PAGES = 256;
+
+        FileManager(size_t pageSize = DEFAULT_PAGE_SIZE, size_t cachePages = DEFAULT_CACHE_PAGES);
         ~FileManager();
+        FileManager(const FileManager&) = delete;
+        FileManager &operator=(const FileManager&) = delete;
 
         bool createFile(const std::string &filename);
-        bool openFile(const std::string &filename);
+        // readOnly: файл может одновременно писать другой процесс, поэтому страницы
+        // не кэшируются, а читаются из общего отображения; запись невозможна
+        bool openFile(const std::string &filename, bool readOnly = false);
         void closeFile();
-        bool truncate(); 
+        bool truncate(); // файл заменяется пустым: у читателей других процессов остаётся прежний
+        bool sync(); // записывает грязные страницы и делает fsync
 
-        long long append(const char *buf, size_t size);
-        bool writeAt(long long offset, const char *buf, size_t size);
+        // Перед записью страницы на диск журнал должен быть записан до её lsn
+        // (правило WAL); хук вызывается для каждой страницы с ненулевым lsn.
+        void setWalHook(const std::function<bool(unsigned long long)> &hook){ walHook = hook; }
+        void setMetrics(Metrics *m){ metrics = m; }
+
+        long long append(const char *buf, size_t size, unsigned long long lsn = 0);
+        bool writeAt(long long offset, const char *buf, size_t size, unsigned long long lsn = 0);
         bool readAt(long long offset, char *buf, size_t size);
-        void seekToBegin();
-        bool readNext(char* buf, size_t size);
+        long long size() const { return fileSize; }
+        size_t getPageSize() const { return pageSize; }
+
+        Changes changedPages(Tracker t = TRACK_BACKUP);
+        void setChangedPages(const Changes &c, Tracker t = TRACK_BACKUP); // учёт, сохранённый с прошлого открытия
+        void clearChangedPages(Tracker t = TRACK_BACKUP);
+
+        // Отображает весь файл в память только для чтения. Грязные страницы на диск
+        // не пишутся (это потребовало бы синхронизации журнала), а копируются поверх
+        // приватного отображения; после записей и при росте файла отображение
+        // пересоздаётся. Указатель действителен до следующей записи/truncate:
+        // параллельные читатели без записей между ними получают одно и то же отображение.
+        const char *mapView(size_t &size);
+        void unmapView();
 
-        bool copyTo(const std::string &dest);
-        static bool copyFile(const std::string &src, const std::string &dest);
+        // onBytes получает размер каждого скопированного куска; false - прервать копирование.
+        // Копия делится с исходным файлом блоками (FICLONE), если файловая система это
+        // умеет, иначе данные копирует ядро (copy_file_range), в крайнем случае - pread/pwrite.
+        static constexpr size_t COPY_CHUNK = 1024 * 1024;
+        bool copyTo(const std::string &dest, const std::function<bool(long long)> &onBytes = nullptr);
+        static bool copyFile(const std::string &src, const std::string &dest,
+                             const std::function<bool(long long)> &onBytes = nullptr);
+        static bool syncPath(const std::string &path); // fsync файла по имени
+        static bool syncDir(const std::string &path);  // fsync каталога файла path: rename переживёт сбой
 
 };
 
 
 
-#endif
\ No newline at end of file
+#endif
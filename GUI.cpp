@@ -1,17 +1,50 @@
 #include "GUI.h"
+#include "Log.h"
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QHeaderView>
+#include <stdexcept>
+
+// все поля, кроме name, числовые; пустая граница допустима
+static bool boundsAreNumbers(const QString &field, const QString &a, const QString &b) {
+    if (field == "name") return true;
+    bool ok = true;
+    if (!a.isEmpty()) a.toDouble(&ok);
+    if (ok && !b.isEmpty()) b.toDouble(&ok);
+    return ok;
+}
+
+// равенство либо диапазон [from, to] по полю панели поиска;
+// для averageGrade границы диапазона с той же погрешностью, что в searchRange
+static Query panelQuery(const QString &field, const QString &from, const QString &to, bool range) {
+    std::string f = field.toStdString();
+    if (!range) return Query::where(f, Query::EQ, from.toStdString());
+    std::string lo = from.toStdString(), hi = to.toStdString();
+    if (field == "averageGrade") {
+        if (!from.isEmpty()) lo = QString::number(from.toDouble() - 0.0001, 'g', 17).toStdString();
+        if (!to.isEmpty()) hi = QString::number(to.toDouble() + 0.0001, 'g', 17).toStdString();
+    }
+    Query q;
+    if (!from.isEmpty()) q = Query::where(f, Query::GE, lo);
+    if (!to.isEmpty()) q = q && Query::where(f, Query::LE, hi);
+    return q;
+}
 
-GUI::GUI(QWidget *parent) : QMainWindow(parent) {
+GUI::GUI(QWidget *parent) : QMainWindow(parent), async(db) {
     QWidget *central = new QWidget(this);
     setCentralWidget(central);
 
     QVBoxLayout *mainLayout = new QVBoxLayout();
 
-    table = new QTableWidget();
-    table->setColumnCount(5);
-    table->setHorizontalHeaderLabels({"ID","Name","Active","AvgGrade","Course"});
+    // строки читаются из базы по мере прокрутки, а не все сразу
+    model = new StudentModel(db, this);
+    table = new QTableView();
+    table->setModel(model);
+    // после изменения база сообщает о нём, и таблица правит только затронутые строки;
+    // вызов из другого потока переносится в поток интерфейса
+    db.setChangeHook([this](const std::vector<Change> &changes) {
+        QMetaObject::invokeMethod(this, [this, changes]() { model->applyChanges(changes); });
+    });
     table->horizontalHeader()->setStretchLastSection(true);
 
     QHBoxLayout *form = new QHBoxLayout();
@@ -31,10 +64,14 @@ GUI::GUI(QWidget *parent) : QMainWindow(parent) {
 
     searchValueInput = new QLineEdit();
     searchValueInput->setPlaceholderText("Search value");
+    // заполненное поле "To" превращает поиск в диапазон [value, to]
+    searchToInput = new QLineEdit();
+    searchToInput->setPlaceholderText("To (range, optional)");
 
     searchForm->addWidget(new QLabel("Search by:"));
     searchForm->addWidget(searchFieldCombo);
     searchForm->addWidget(searchValueInput);
+    searchForm->addWidget(searchToInput);
 
     QHBoxLayout *buttons = new QHBoxLayout();
     QPushButton *createBtn = new QPushButton("Create DB");
@@ -42,27 +79,55 @@ GUI::GUI(QWidget *parent) : QMainWindow(parent) {
     QPushButton *addBtn = new QPushButton("Add Record");
     QPushButton *searchBtn = new QPushButton("Search");
     QPushButton *deleteBtn = new QPushButton("Delete");
+    QPushButton *deleteRangeBtn = new QPushButton("Delete Range");
     QPushButton *editBtn = new QPushButton("Edit");
     QPushButton *backupBtn = new QPushButton("Backup");
     QPushButton *restoreBtn = new QPushButton("Restore");
+    QPushButton *statsBtn = new QPushButton("Statistics");
 
     buttons->addWidget(createBtn);
     buttons->addWidget(openBtn);
     buttons->addWidget(addBtn);
     buttons->addWidget(searchBtn);
     buttons->addWidget(deleteBtn);
+    buttons->addWidget(deleteRangeBtn);
     buttons->addWidget(editBtn);
     buttons->addWidget(backupBtn);
     buttons->addWidget(restoreBtn);
+    buttons->addWidget(statsBtn);
 
     connect(createBtn, &QPushButton::clicked, this, &GUI::onCreateDB);
     connect(openBtn, &QPushButton::clicked, this, &GUI::onOpenDB);
     connect(addBtn, &QPushButton::clicked, this, &GUI::onAddRecord);
     connect(searchBtn, &QPushButton::clicked, this, &GUI::onSearch);
     connect(deleteBtn, &QPushButton::clicked, this, &GUI::onDelete);
+    connect(deleteRangeBtn, &QPushButton::clicked, this, &GUI::onDeleteRange);
     connect(editBtn, &QPushButton::clicked, this, &GUI::onEdit);
     connect(backupBtn, &QPushButton::clicked, this, &GUI::onBackup);
     connect(restoreBtn, &QPushButton::clicked, this, &GUI::onRestore);
+    connect(statsBtn, &QPushButton::clicked, this, &GUI::onStats);
+
+    // пока идёт фоновая операция, остальные кнопки выключены
+    actionButtons = {createBtn, openBtn, addBtn, searchBtn, deleteBtn, deleteRangeBtn,
+                     editBtn, backupBtn, restoreBtn, statsBtn};
+
+    progressBar = new QProgressBar();
+    progressBar->setMaximumWidth(200);
+    progressBar->hide();
+    cancelTaskBtn = new QPushButton("Cancel");
+    cancelTaskBtn->hide();
+    statusBar()->addPermanentWidget(progressBar);
+    statusBar()->addPermanentWidget(cancelTaskBtn);
+    connect(cancelTaskBtn, &QPushButton::clicked, this, &GUI::onCancelTask);
+
+    // готовность future проверяется по таймеру, поток интерфейса не блокируется
+    taskTimer = new QTimer(this);
+    taskTimer->setInterval(50);
+    connect(taskTimer, &QTimer::timeout, this, &GUI::onTaskTick);
+
+    refreshTimer = new QTimer(this);
+    refreshTimer->setInterval(1000);
+    connect(refreshTimer, &QTimer::timeout, this, &GUI::onRefreshTick);
 
     mainLayout->addLayout(form);
     mainLayout->addLayout(searchForm);
@@ -75,26 +140,15 @@ GUI::GUI(QWidget *parent) : QMainWindow(parent) {
     resize(800, 600);
 }
 
-void GUI::refreshTable() {
-    table->setRowCount(0);
-    auto all = db.getAll();
-
-    for (size_t i = 0; i < all.size(); i++) {
-        table->insertRow(i);
-        table->setItem(i, 0, new QTableWidgetItem(QString::number(all[i].id)));
-        table->setItem(i, 1, new QTableWidgetItem(all[i].name));
-        table->setItem(i, 2, new QTableWidgetItem(all[i].isActive ? "1" : "0"));
-        table->setItem(i, 3, new QTableWidgetItem(QString::number(all[i].averageGrade)));
-        table->setItem(i, 4, new QTableWidgetItem(QString::number(all[i].cours)));
-    }
-}
-
 void GUI::onCreateDB() {
     QString path = QFileDialog::getSaveFileName(this, "Create DB", "", "DB Files (*.db)");
     if(path.isEmpty()) return;
 
     if(db.create(path.toStdString())) {
-        refreshTable();
+        refreshTimer->stop();
+        // поиск по имени из панели поиска - самый частый запрос
+        db.createIndex("name");
+        db.setPublishInterval(1000);
         QMessageBox::information(this, "Success", "Database created successfully.");
     } else {
         QMessageBox::warning(this, "Error", "Failed to create database.");
@@ -105,9 +159,19 @@ void GUI::onOpenDB() {
     QString path = QFileDialog::getOpenFileName(this, "Open DB", "", "DB Files (*.db)");
     if(path.isEmpty()) return;
 
-    if(db.open(path.toStdString())) {
-        refreshTable();
-        QMessageBox::information(this, "Success", "Database opened successfully.");
+    // базу уже пишет другой процесс: открываем её только для чтения
+    bool readOnly = Database::writerActive(path.toStdString());
+    if(db.open(path.toStdString(), readOnly ? Database::Mode::ReadOnly : Database::Mode::ReadWrite)) {
+        if (readOnly) {
+            refreshTimer->start();
+            QMessageBox::information(this, "Success",
+                "Database is being written by another process and was opened read-only.");
+        } else {
+            refreshTimer->stop();
+            db.createIndex("name");
+            db.setPublishInterval(1000);
+            QMessageBox::information(this, "Success", "Database opened successfully.");
+        }
     } else {
         QMessageBox::warning(this, "Error", "Failed to open database.");
     }
@@ -132,7 +196,6 @@ void GUI::onAddRecord() {
 
     std::string err;
     if(db.addRecord(st, err)) {
-        refreshTable();
         idInput->clear();
         nameInput->clear();
         gradeInput->clear();
@@ -146,37 +209,48 @@ void GUI::onAddRecord() {
 void GUI::onSearch() {
     QString field = searchFieldCombo->currentText();
     QString value = searchValueInput->text();
+    QString to = searchToInput->text();
 
-    if (value.isEmpty()) {
+    if (value.isEmpty() && to.isEmpty()) {
         QMessageBox::warning(this, "Search", "Please enter search value.");
         return;
     }
 
-    auto results = db.searchByField(field.toStdString(), value.toStdString());
+    if (!boundsAreNumbers(field, value, to)) {
+        QMessageBox::warning(this, "Search", "Search value must be a number.");
+        return;
+    }
 
-    if(results.empty()) {
-        QMessageBox::information(this, "Search", "No records found.");
+    Query q;
+    try {
+        q = panelQuery(field, value, to, !to.isEmpty());
+    } catch (const std::invalid_argument &e) {
+        QMessageBox::warning(this, "Search", e.what());
         return;
     }
 
+    // сначала в фоне считается число совпадений, окно результатов потом читает их страницами
+    auto progress = std::make_shared<Progress>();
+    runTask<Aggregate>("Searching...", async.aggregate("cours", q, progress), progress, [this, q](Aggregate found) {
+        if (found.count == 0) {
+            QMessageBox::information(this, "Search", "No records found.");
+            return;
+        }
+        showResults(q, found.count);
+    });
+}
+
+void GUI::showResults(const Query &q, long long count) {
+    StudentModel results(db);
+    results.setQuery(q);
+
     QDialog dialog(this);
-    dialog.setWindowTitle("Search Results");
+    dialog.setWindowTitle(QString("Search Results (%1)").arg(count));
     dialog.resize(600, 300);
 
     QVBoxLayout layout(&dialog);
-    QTableWidget tableR;
-    tableR.setColumnCount(5);
-    tableR.setHorizontalHeaderLabels({"ID","Name","Active","AvgGrade","Course"});
-    tableR.setRowCount(results.size());
-
-    for (size_t i = 0; i < results.size(); i++) {
-        tableR.setItem(i, 0, new QTableWidgetItem(QString::number(results[i].id)));
-        tableR.setItem(i, 1, new QTableWidgetItem(results[i].name));
-        tableR.setItem(i, 2, new QTableWidgetItem(results[i].isActive ? "1" : "0"));
-        tableR.setItem(i, 3, new QTableWidgetItem(QString::number(results[i].averageGrade)));
-        tableR.setItem(i, 4, new QTableWidgetItem(QString::number(results[i].cours)));
-    }
-
+    QTableView tableR;
+    tableR.setModel(&results);
     tableR.horizontalHeader()->setStretchLastSection(true);
     layout.addWidget(&tableR);
 
@@ -195,15 +269,48 @@ void GUI::onDelete() {
 
     int id = idInput->text().toInt();
 
-    size_t deleted = db.deleteByField("id", std::to_string(id));
+    auto progress = std::make_shared<Progress>();
+    Query q = Query::where("id", Query::EQ, std::to_string(id));
+    runTask<size_t>("Deleting...", async.deleteWhere(q, progress), progress, [this](size_t deleted) {
+        if(deleted > 0) {
+            idInput->clear();
+            QMessageBox::information(this, "Success", "Record deleted.");
+        } else {
+            QMessageBox::warning(this, "Error", "Record not found.");
+        }
+    });
+}
 
-    if(deleted > 0) {
-        refreshTable();
-        idInput->clear();
-        QMessageBox::information(this, "Success", "Record deleted.");
-    } else {
-        QMessageBox::warning(this, "Error", "Record not found.");
+void GUI::onDeleteRange() {
+    QString field = searchFieldCombo->currentText();
+    QString from = searchValueInput->text();
+    QString to = searchToInput->text();
+
+    if (from.isEmpty() && to.isEmpty()) {
+        QMessageBox::warning(this, "Delete Range", "Enter the range bounds in the search panel.");
+        return;
     }
+    if (!boundsAreNumbers(field, from, to)) {
+        QMessageBox::warning(this, "Delete Range", "Range bounds must be numbers.");
+        return;
+    }
+
+    QString range = QString("%1 in [%2, %3]").arg(field, from.isEmpty() ? QString("-inf") : from, to.isEmpty() ? QString("+inf") : to);
+    if (QMessageBox::question(this, "Delete Range", "Delete all records with " + range + "?") != QMessageBox::Yes) {
+        return;
+    }
+
+    Query q;
+    try {
+        q = panelQuery(field, from, to, true);
+    } catch (const std::invalid_argument &e) {
+        QMessageBox::warning(this, "Delete Range", e.what());
+        return;
+    }
+    auto progress = std::make_shared<Progress>();
+    runTask<size_t>("Deleting...", async.deleteWhere(q, progress), progress, [this](size_t deleted) {
+        QMessageBox::information(this, "Delete Range", QString("%1 record(s) deleted.").arg(deleted));
+    });
 }
 
 void GUI::onEdit() {
@@ -222,7 +329,6 @@ void GUI::onEdit() {
     st.isActive = true;
 
     if(db.editRecordByKey(st.id, st)) {
-        refreshTable();
         idInput->clear();
         nameInput->clear();
         gradeInput->clear();
@@ -242,23 +348,121 @@ void GUI::onBackup() {
         path += ".db";
     }
 
-    if(db.backup(path.toStdString())) {
-        QMessageBox::information(this, "Success", "Backup created.");
-    } else {
-        QMessageBox::warning(this, "Error", "Backup failed.");
-    }
+    auto progress = std::make_shared<Progress>();
+    runTask<bool>("Creating backup...", async.backup(path.toStdString(), progress), progress, [this](bool ok) {
+        if(ok) {
+            QMessageBox::information(this, "Success", "Backup created.");
+        } else {
+            QMessageBox::warning(this, "Error", "Backup failed.");
+        }
+    });
 }
 
 void GUI::onRestore() {
     QString path = QFileDialog::getOpenFileName(this, "Restore DB", "", "DB Files (*.db);;Backup Files (*.db *.backup);;All Files (*)");
     if(path.isEmpty()) return;
 
-    std::cout << "Attempting to restore from: " << path.toStdString() << std::endl;
+    LOG_INFO("Attempting to restore from: " << path.toStdString());
 
-    if(db.restoreFromBackup(path.toStdString())) {
-        refreshTable(); 
-        QMessageBox::information(this, "Success", "Database restored successfully.");
-    } else {
-        QMessageBox::warning(this, "Error", "Restore failed. Check console for details.");
+    auto progress = std::make_shared<Progress>();
+    runTask<bool>("Restoring...", async.restoreFromBackup(path.toStdString(), progress), progress, [this](bool ok) {
+        if(ok) {
+            QMessageBox::information(this, "Success", "Database restored successfully.");
+        } else {
+            QMessageBox::warning(this, "Error", "Restore failed. Check console for details.");
+        }
+    });
+}
+
+// число студентов и оценки по курсам считает база, записи в интерфейс не загружаются
+void GUI::onStats() {
+    if(!db.isOpen()) {
+        QMessageBox::warning(this, "Statistics", "Database is not open.");
+        return;
+    }
+    auto progress = std::make_shared<Progress>();
+    runTask<std::map<int, Aggregate>>("Computing statistics...",
+                                      async.aggregateByCours("averageGrade", Query(), progress), progress,
+                                      [this](std::map<int, Aggregate> groups) { showStats(groups); });
+}
+
+void GUI::showStats(const std::map<int, Aggregate> &groups) {
+    if(groups.empty()) {
+        QMessageBox::information(this, "Statistics", "No records.");
+        return;
+    }
+
+    QDialog dialog(this);
+    dialog.setWindowTitle("Statistics by course");
+    QVBoxLayout layout(&dialog);
+    QTableWidget tableS;
+    tableS.setColumnCount(5);
+    tableS.setHorizontalHeaderLabels({"Course","Students","AvgGrade","MinGrade","MaxGrade"});
+    tableS.setRowCount((int)groups.size() + 1);
+    Aggregate total;
+    int row = 0;
+    auto fill = [&](const QString &name, const Aggregate &a) {
+        tableS.setItem(row, 0, new QTableWidgetItem(name));
+        tableS.setItem(row, 1, new QTableWidgetItem(QString::number(a.count)));
+        tableS.setItem(row, 2, new QTableWidgetItem(QString::number(a.avg(), 'f', 2)));
+        tableS.setItem(row, 3, new QTableWidgetItem(QString::number(a.min)));
+        tableS.setItem(row, 4, new QTableWidgetItem(QString::number(a.max)));
+        row++;
+    };
+    for(const auto &kv: groups) {
+        fill(QString::number(kv.first), kv.second);
+        total.merge(kv.second);
     }
-}
\ No newline at end of file
+    fill("All", total);
+    tableS.horizontalHeader()->setStretchLastSection(true);
+    layout.addWidget(&tableS);
+    dialog.resize(500, 300);
+    dialog.exec();
+}
+
+void GUI::startTask(const QString &title, const std::shared_ptr<Progress> &progress,
+                    const std::function<bool()> &ready, const std::function<void()> &done) {
+    taskProgress = progress;
+    taskReady = ready;
+    taskDone = done;
+    for (QPushButton *b : actionButtons) b->setEnabled(false);
+    progressBar->setRange(0, 0); // пока объём неизвестен - бегущая полоса
+    progressBar->show();
+    cancelTaskBtn->setEnabled(true);
+    cancelTaskBtn->setVisible(progress != nullptr);
+    statusBar()->showMessage(title);
+    taskTimer->start();
+}
+
+void GUI::onTaskTick() {
+    if (taskProgress && taskProgress->total() > 0) {
+        progressBar->setRange(0, 1000);
+        progressBar->setValue((int)(1000.0 * taskProgress->done() / taskProgress->total()));
+    }
+    if (!taskReady || !taskReady()) return;
+
+    taskTimer->stop();
+    progressBar->hide();
+    cancelTaskBtn->hide();
+    statusBar()->clearMessage();
+    for (QPushButton *b : actionButtons) b->setEnabled(true);
+
+    std::function<void()> done = taskDone;
+    taskReady = nullptr;
+    taskDone = nullptr;
+    taskProgress.reset();
+    done();
+}
+
+void GUI::onCancelTask() {
+    if (!taskProgress) return;
+    taskProgress->cancel();
+    cancelTaskBtn->setEnabled(false);
+    statusBar()->showMessage("Cancelling...");
+}
+
+void GUI::onRefreshTick() {
+    // во время фоновой операции переход на новый снимок ждал бы её окончания
+    if (taskTimer->isActive() || !db.isOpen() || !db.isReadOnly()) return;
+    if (db.refresh()) statusBar()->showMessage("Loaded new data from the writer", 2000);
+}
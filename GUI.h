@@ -3,6 +3,7 @@
 
 #include <QMainWindow>
 #include <QTableWidget>
+#include <QTableView>
 #include <QLineEdit>
 #include <QPushButton>
 #include <QVBoxLayout>
@@ -11,7 +12,15 @@
 #include <QDialog>
 #include <QComboBox>
 #include <QLabel>
+#include <QProgressBar>
+#include <QTimer>
+#include <QStatusBar>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include "Database.h"
+#include "AsyncDatabase.h"
+#include "StudentModel.h"
 
 class GUI : public QMainWindow {
     Q_OBJECT
@@ -25,20 +34,60 @@ private slots:
     void onAddRecord();
     void onSearch();
     void onDelete();
+    void onDeleteRange();
     void onEdit();
     void onBackup();
     void onRestore();
-    void refreshTable();
+    void onStats();
+    void onTaskTick();
+    void onCancelTask();
+    void onRefreshTick();
 
 private:
     Database db;
-    QTableWidget *table;
+    AsyncDatabase async; // долгие операции идут в его потоке, окно остаётся отзывчивым
+    QTableView *table;
+    StudentModel *model;
     QLineEdit *idInput;
     QLineEdit *nameInput;
     QLineEdit *courseInput;
     QLineEdit *gradeInput;
     QComboBox *searchFieldCombo;
     QLineEdit *searchValueInput;
+    QLineEdit *searchToInput;
+
+    QProgressBar *progressBar;
+    QPushButton *cancelTaskBtn;
+    QTimer *taskTimer;
+    QTimer *refreshTimer; // открытая только для чтения база подхватывает снимки писателя
+    QList<QPushButton*> actionButtons;
+    std::shared_ptr<Progress> taskProgress;
+    std::function<bool()> taskReady;
+    std::function<void()> taskDone;
+
+    void showResults(const Query &q, long long count);
+    void showStats(const std::map<int, Aggregate> &groups);
+    void startTask(const QString &title, const std::shared_ptr<Progress> &progress,
+                   const std::function<bool()> &ready, const std::function<void()> &done);
+
+    // Операция на потоке AsyncDatabase: кнопки выключены, полоса в строке состояния
+    // показывает ход, done получает результат в потоке интерфейса.
+    template<typename T>
+    void runTask(const QString &title, std::future<T> future, const std::shared_ptr<Progress> &progress,
+                 const std::function<void(T)> &done) {
+        auto f = std::make_shared<std::future<T>>(std::move(future));
+        startTask(title, progress,
+                  [f]() { return f->wait_for(std::chrono::seconds(0)) == std::future_status::ready; },
+                  [this, f, done]() {
+                      try {
+                          done(f->get());
+                      } catch (const OperationCancelled &) {
+                          statusBar()->showMessage("Cancelled", 3000);
+                      } catch (const std::exception &e) {
+                          QMessageBox::warning(this, "Error", e.what());
+                      }
+                  });
+    }
 };
 
 #endif
\ No newline at end of file
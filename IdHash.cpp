@@ -0,0 +1,136 @@
+#include "IdHash.h"
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define IDHASH_SSE2 1
+#endif
+
+IdHash::IdHash(): groupMask(0), count(0), growthLeft(0) {}
+
+void IdHash::clear(){
+    std::vector<int8_t>().swap(ctrl);
+    std::vector<int32_t>().swap(keys);
+    std::vector<uint32_t>().swap(rows);
+    groupMask = 0;
+    count = 0;
+    growthLeft = 0;
+}
+
+uint64_t IdHash::hash(int id){
+    // перемешивание из MurmurHash3: соседние id расходятся по разным группам
+    uint64_t x = (uint32_t)id;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+uint32_t IdHash::matchByte(const int8_t *group, int8_t b){
+#ifdef IDHASH_SSE2
+    __m128i g = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(b)));
+#else
+    uint32_t m = 0;
+    for(size_t i = 0; i < GROUP; i++) m |= (uint32_t)(group[i] == b) << i;
+    return m;
+#endif
+}
+
+long long IdHash::findSlot(int id, uint64_t h) const {
+    if(ctrl.empty()){return -1;}
+    int8_t tag = (int8_t)(h & 0x7F);
+    size_t g = (size_t)(h >> 7) & groupMask;
+    // треугольные шаги по группам обходят все группы, когда их число - степень двойки
+    for(size_t step = 1; step <= groupMask + 1; step++){
+        const int8_t *group = ctrl.data() + g * GROUP;
+        for(uint32_t m = matchByte(group, tag); m != 0; m &= m - 1){
+            size_t slot = g * GROUP + (size_t)__builtin_ctz(m);
+            if(keys[slot] == id){return (long long)slot;}
+        }
+        // в группе со свободным слотом цепочка поиска заканчивается
+        if(matchByte(group, EMPTY) != 0){return -1;}
+        g = (g + step) & groupMask;
+    }
+    return -1;
+}
+
+bool IdHash::find(int id, uint32_t &row) const {
+    long long slot = findSlot(id, hash(id));
+    if(slot < 0){return false;}
+    row = rows[(size_t)slot];
+    return true;
+}
+
+void IdHash::place(int id, uint32_t row, uint64_t h){
+    size_t g = (size_t)(h >> 7) & groupMask;
+    for(size_t step = 1; ; step++){
+        const int8_t *group = ctrl.data() + g * GROUP;
+        uint32_t freeSlots = matchByte(group, EMPTY) | matchByte(group, DELETED);
+        if(freeSlots != 0){
+            size_t slot = g * GROUP + (size_t)__builtin_ctz(freeSlots);
+            if(ctrl[slot] == EMPTY) growthLeft--;
+            ctrl[slot] = (int8_t)(h & 0x7F);
+            keys[slot] = id;
+            rows[slot] = row;
+            count++;
+            return;
+        }
+        g = (g + step) & groupMask;
+    }
+}
+
+void IdHash::rehash(size_t capacity){
+    std::vector<int8_t> oldCtrl(capacity, EMPTY);
+    std::vector<int32_t> oldKeys(capacity);
+    std::vector<uint32_t> oldRows(capacity);
+    oldCtrl.swap(ctrl);
+    oldKeys.swap(keys);
+    oldRows.swap(rows);
+    groupMask = capacity / GROUP - 1;
+    count = 0;
+    growthLeft = capacity - capacity / 8; // заполнение не выше 7/8
+    for(size_t i = 0; i < oldCtrl.size(); i++){
+        if(oldCtrl[i] >= 0) place(oldKeys[i], oldRows[i], hash(oldKeys[i]));
+    }
+}
+
+void IdHash::reserve(size_t entries){
+    size_t capacity = GROUP;
+    while(capacity - capacity / 8 < entries) capacity *= 2;
+    if(capacity > ctrl.size()) rehash(capacity);
+}
+
+void IdHash::insert(int id, uint32_t row){
+    uint64_t h = hash(id);
+    long long slot = findSlot(id, h);
+    if(slot >= 0){
+        rows[(size_t)slot] = row;
+        return;
+    }
+    if(growthLeft == 0){
+        // места съели удалённые слоты - таблица чистится на том же размере, иначе растёт
+        size_t capacity = std::max(GROUP, ctrl.size());
+        if(count >= capacity * 7 / 16) capacity *= 2;
+        rehash(capacity);
+    }
+    place(id, row, h);
+}
+
+bool IdHash::erase(int id){
+    long long slot = findSlot(id, hash(id));
+    if(slot < 0){return false;}
+    // группа, в которой есть свободный слот, никогда не была полной, так что цепочки
+    // поиска через неё не проходят и слот можно сразу освободить
+    const int8_t *group = ctrl.data() + (size_t)slot / GROUP * GROUP;
+    if(matchByte(group, EMPTY) != 0){
+        ctrl[(size_t)slot] = EMPTY;
+        growthLeft++;
+    } else {
+        ctrl[(size_t)slot] = DELETED;
+    }
+    count--;
+    return true;
+}
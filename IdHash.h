@@ -0,0 +1,47 @@
+#ifndef IDHASH_H
+#define IDHASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Плоская хеш-таблица id -> номер записи с открытой адресацией, копия первичного
+// индекса в памяти для точечных поисков. Ключи, номера записей и управляющие байты
+// лежат в трёх отдельных массивах (SoA); управляющий байт хранит 7 бит хеша, так что
+// группа из 16 слотов отсеивается одним сравнением SSE2, а ключи читаются только
+// у совпавших слотов. Номер записи - номер в файле данных (без заголовка), 32 бита.
+// Чтение из нескольких потоков безопасно, изменение - только без читателей.
+class IdHash {
+    public:
+        static constexpr size_t GROUP = 16;
+
+        IdHash();
+
+        void clear();                   // вместе с памятью
+        void reserve(size_t entries);   // ёмкость без перестроения до entries ключей
+        bool find(int id, uint32_t &row) const;
+        void insert(int id, uint32_t row); // вставка или замена
+        bool erase(int id);
+        size_t size() const { return count; }
+        size_t memoryBytes() const { return ctrl.size() + keys.size() * sizeof(int32_t) + rows.size() * sizeof(uint32_t); }
+
+    private:
+        static constexpr int8_t EMPTY = -128;
+        static constexpr int8_t DELETED = -2;
+
+        std::vector<int8_t> ctrl;       // EMPTY, DELETED или 7 младших бит хеша занятого слота
+        std::vector<int32_t> keys;
+        std::vector<uint32_t> rows;
+        size_t groupMask;               // число групп - 1, групп - степень двойки
+        size_t count;
+        size_t growthLeft;              // свободных слотов до перестроения (с учётом DELETED)
+
+        static uint64_t hash(int id);
+        // битовая маска слотов группы, у которых управляющий байт равен b
+        static uint32_t matchByte(const int8_t *group, int8_t b);
+        long long findSlot(int id, uint64_t h) const; // -1, если ключа нет
+        void rehash(size_t capacity);
+        void place(int id, uint32_t row, uint64_t h);
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include "Log.h"
+#include <iostream>
+#include <mutex>
+
+std::atomic<int> Log::threshold((int)LogLevel::Warn);
+
+static std::mutex &sinkMutex(){
+    static std::mutex m;
+    return m;
+}
+
+static Log::Sink &sinkFn(){
+    static Log::Sink sink;
+    return sink;
+}
+
+void Log::setSink(const Sink &sink){
+    std::lock_guard<std::mutex> lock(sinkMutex());
+    sinkFn() = sink;
+}
+
+void Log::write(LogLevel level, const std::string &message){
+    std::lock_guard<std::mutex> lock(sinkMutex());
+    if(sinkFn()){
+        sinkFn()(level, message);
+        return;
+    }
+    std::cerr << "[" << name(level) << "] " << message << std::endl;
+}
+
+const char *Log::name(LogLevel level){
+    switch(level){
+        case LogLevel::Trace: return "trace";
+        case LogLevel::Debug: return "debug";
+        case LogLevel::Info: return "info";
+        case LogLevel::Warn: return "warn";
+        case LogLevel::Error: return "error";
+        case LogLevel::Off: return "off";
+    }
+    return "?";
+}
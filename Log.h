@@ -0,0 +1,51 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <functional>
+#include <sstream>
+#include <string>
+
+enum class LogLevel { Trace, Debug, Info, Warn, Error, Off };
+
+// Уровни ниже FILEDB_LOG_MIN_LEVEL (0 - Trace ... 5 - Off) вырезаются при компиляции.
+#ifndef FILEDB_LOG_MIN_LEVEL
+#define FILEDB_LOG_MIN_LEVEL 0
+#endif
+
+// Журнал сообщений движка. Уровень проверяется до форматирования: выключенное
+// сообщение стоит одного чтения атомарной переменной, аргументы не вычисляются.
+// По умолчанию пишутся Warn и выше в std::cerr; setSink перенаправляет вывод.
+// Sink вызывается в потоке, записавшем сообщение, под внутренним мьютексом.
+class Log {
+    public:
+        typedef std::function<void(LogLevel level, const std::string &message)> Sink;
+
+        static bool enabled(LogLevel level) {
+            return (int)level >= FILEDB_LOG_MIN_LEVEL && (int)level >= threshold.load(std::memory_order_relaxed);
+        }
+        static void setLevel(LogLevel level) { threshold.store((int)level, std::memory_order_relaxed); }
+        static LogLevel level() { return (LogLevel)threshold.load(std::memory_order_relaxed); }
+        static void setSink(const Sink &sink); // пустой sink - снова std::cerr
+        static void write(LogLevel level, const std::string &message);
+        static const char *name(LogLevel level);
+
+    private:
+        static std::atomic<int> threshold;
+};
+
+#define FILEDB_LOG(level, expr) do { \
+        if(Log::enabled(level)){ \
+            std::ostringstream logStream_; \
+            logStream_ << expr; \
+            Log::write(level, logStream_.str()); \
+        } \
+    } while(0)
+
+#define LOG_TRACE(expr) FILEDB_LOG(LogLevel::Trace, expr)
+#define LOG_DEBUG(expr) FILEDB_LOG(LogLevel::Debug, expr)
+#define LOG_INFO(expr) FILEDB_LOG(LogLevel::Info, expr)
+#define LOG_WARN(expr) FILEDB_LOG(LogLevel::Warn, expr)
+#define LOG_ERROR(expr) FILEDB_LOG(LogLevel::Error, expr)
+
+#endif
@@ -0,0 +1,124 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <sstream>
+
+Metrics::Metrics(){
+    reset();
+}
+
+Metrics::Timer::~Timer(){
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    metrics.record(op, (uint64_t)us);
+}
+
+void Metrics::record(Op op, uint64_t us){
+    int bucket = 0;
+    while(bucket < BUCKETS - 1 && us >= (1ull << bucket)) bucket++;
+    AtomicHistogram &h = ops[op];
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.sumUs.fetch_add(us, std::memory_order_relaxed);
+    h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    uint64_t seen = h.maxUs.load(std::memory_order_relaxed);
+    while(us > seen && !h.maxUs.compare_exchange_weak(seen, us, std::memory_order_relaxed)){}
+}
+
+Metrics::Snapshot Metrics::snapshot() const {
+    Snapshot s;
+    for(int c = 0; c < COUNTER_COUNT; c++) s.counters[c] = counters[c].load(std::memory_order_relaxed);
+    for(int o = 0; o < OP_COUNT; o++){
+        const AtomicHistogram &h = ops[o];
+        s.ops[o].count = h.count.load(std::memory_order_relaxed);
+        s.ops[o].sumUs = h.sumUs.load(std::memory_order_relaxed);
+        s.ops[o].maxUs = h.maxUs.load(std::memory_order_relaxed);
+        for(int b = 0; b < BUCKETS; b++) s.ops[o].buckets[b] = h.buckets[b].load(std::memory_order_relaxed);
+    }
+    return s;
+}
+
+void Metrics::reset(){
+    for(int c = 0; c < COUNTER_COUNT; c++) counters[c].store(0, std::memory_order_relaxed);
+    for(int o = 0; o < OP_COUNT; o++){
+        AtomicHistogram &h = ops[o];
+        h.count.store(0, std::memory_order_relaxed);
+        h.sumUs.store(0, std::memory_order_relaxed);
+        h.maxUs.store(0, std::memory_order_relaxed);
+        for(int b = 0; b < BUCKETS; b++) h.buckets[b].store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t Metrics::Histogram::percentileUs(double p) const {
+    if(count == 0){return 0;}
+    uint64_t rank = (uint64_t)(p * (double)(count - 1)) + 1, seen = 0;
+    for(int b = 0; b < BUCKETS; b++){
+        seen += buckets[b];
+        // граница корзины не больше наблюдавшегося максимума
+        if(seen >= rank) return b == BUCKETS - 1 ? maxUs : std::min<uint64_t>(1ull << b, maxUs);
+    }
+    return maxUs;
+}
+
+std::string Metrics::Snapshot::toJson() const {
+    std::ostringstream os;
+    os << "{\"counters\":{";
+    for(int c = 0; c < COUNTER_COUNT; c++){
+        if(c) os << ",";
+        os << "\"" << counterName((Counter)c) << "\":" << counters[c];
+    }
+    os << "},\"latency_us\":{";
+    bool first = true;
+    for(int o = 0; o < OP_COUNT; o++){
+        const Histogram &h = ops[o];
+        if(h.count == 0) continue;
+        if(!first) os << ",";
+        first = false;
+        os << "\"" << opName((Op)o) << "\":{\"count\":" << h.count
+           << ",\"avg\":" << h.avgUs()
+           << ",\"p50\":" << h.percentileUs(0.5)
+           << ",\"p99\":" << h.percentileUs(0.99)
+           << ",\"max\":" << h.maxUs
+           << ",\"buckets\":[";
+        // корзины до последней непустой: i-я считает задержки меньше 2^i мкс
+        int last = BUCKETS - 1;
+        while(last > 0 && h.buckets[last] == 0) last--;
+        for(int b = 0; b <= last; b++){
+            if(b) os << ",";
+            os << h.buckets[b];
+        }
+        os << "]}";
+    }
+    os << "}}";
+    return os.str();
+}
+
+const char *Metrics::counterName(Counter c){
+    switch(c){
+        case RECORDS_SCANNED: return "records_scanned";
+        case BYTES_READ: return "bytes_read";
+        case BYTES_WRITTEN: return "bytes_written";
+        case INDEX_HITS: return "index_hits";
+        case INDEX_MISSES: return "index_misses";
+        case FSYNCS: return "fsyncs";
+        case COUNTER_COUNT: break;
+    }
+    return "?";
+}
+
+const char *Metrics::opName(Op op){
+    switch(op){
+        case OP_ADD: return "add";
+        case OP_ADD_BATCH: return "add_batch";
+        case OP_SEARCH: return "search";
+        case OP_SEARCH_RANGE: return "search_range";
+        case OP_AGGREGATE: return "aggregate";
+        case OP_DELETE: return "delete";
+        case OP_EDIT: return "edit";
+        case OP_CURSOR: return "cursor";
+        case OP_EXPORT: return "export";
+        case OP_CHECKPOINT: return "checkpoint";
+        case OP_COMPACT: return "compact";
+        case OP_BACKUP: return "backup";
+        case OP_RESTORE: return "restore";
+        case OP_COUNT: break;
+    }
+    return "?";
+}
@@ -0,0 +1,85 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Счётчики и гистограммы задержек одной базы. Обновления - relaxed атомарные
+// операции без блокировок, так что писать в них можно из любого потока прохода;
+// snapshot() читает значения по отдельности и может слегка расходиться между ними.
+class Metrics {
+    public:
+        enum Counter {
+            RECORDS_SCANNED,  // записи, просмотренные проходом или проверенные как кандидаты
+            BYTES_READ,       // прочитано из файлов мимо отображения (pread, readAt)
+            BYTES_WRITTEN,    // записано в файлы данных, индекса и журнала
+            INDEX_HITS,       // поиск id в первичном индексе нашёл ключ
+            INDEX_MISSES,
+            FSYNCS,           // fsync и fdatasync
+            COUNTER_COUNT
+        };
+        enum Op {
+            OP_ADD, OP_ADD_BATCH, OP_SEARCH, OP_SEARCH_RANGE, OP_AGGREGATE, OP_DELETE, OP_EDIT,
+            OP_CURSOR, OP_EXPORT, OP_CHECKPOINT, OP_COMPACT, OP_BACKUP, OP_RESTORE,
+            OP_COUNT
+        };
+        // корзина k - задержки меньше 2^k мкс, последняя - всё остальное
+        static constexpr int BUCKETS = 32;
+
+        struct Histogram {
+            uint64_t count = 0;
+            uint64_t sumUs = 0;
+            uint64_t maxUs = 0;
+            uint64_t buckets[BUCKETS] = {};
+
+            double avgUs() const { return count ? (double)sumUs / count : 0; }
+            uint64_t percentileUs(double p) const; // верхняя граница корзины, p в [0, 1]
+        };
+
+        struct Snapshot {
+            uint64_t counters[COUNTER_COUNT] = {};
+            Histogram ops[OP_COUNT];
+
+            std::string toJson() const;
+        };
+
+        // Замер одной операции от конструктора до деструктора
+        class Timer {
+            public:
+                Timer(Metrics &metrics, Op op): metrics(metrics), op(op), start(std::chrono::steady_clock::now()) {}
+                ~Timer();
+                Timer(const Timer&) = delete;
+                Timer &operator=(const Timer&) = delete;
+            private:
+                Metrics &metrics;
+                Op op;
+                std::chrono::steady_clock::time_point start;
+        };
+
+        Metrics();
+        Metrics(const Metrics&) = delete;
+        Metrics &operator=(const Metrics&) = delete;
+
+        void add(Counter c, uint64_t n = 1) { counters[c].fetch_add(n, std::memory_order_relaxed); }
+        void record(Op op, uint64_t us);
+        Snapshot snapshot() const;
+        void reset();
+
+        static const char *counterName(Counter c);
+        static const char *opName(Op op);
+
+    private:
+        struct AtomicHistogram {
+            std::atomic<uint64_t> count;
+            std::atomic<uint64_t> sumUs;
+            std::atomic<uint64_t> maxUs;
+            std::atomic<uint64_t> buckets[BUCKETS];
+        };
+
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        AtomicHistogram ops[OP_COUNT];
+};
+
+#endif
@@ -0,0 +1,14 @@
+#include "Progress.h"
+
+Progress::Progress(const Callback &callback): doneCount(0), totalCount(0), stop(false), callback(callback) {}
+
+void Progress::start(long long total){
+    totalCount.store(total);
+    doneCount.store(0);
+    if(callback) callback(0, total);
+}
+
+void Progress::advance(long long n){
+    long long d = doneCount.fetch_add(n) + n;
+    if(callback) callback(d, totalCount.load(std::memory_order_relaxed));
+}
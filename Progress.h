@@ -0,0 +1,32 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <functional>
+
+// Ход длительной операции и её отмена. Операция вызывает start() в начале каждой
+// стадии и advance() по мере работы (записи или байты), в том числе из нескольких
+// потоков прохода; отмена проверяется между кусками работы, частичный результат
+// при этом отбрасывается. Callback вызывается в потоке, выполнившем кусок.
+class Progress {
+    public:
+        typedef std::function<void(long long done, long long total)> Callback;
+
+        explicit Progress(const Callback &callback = Callback());
+
+        void start(long long total);
+        void advance(long long n);
+        long long done() const { return doneCount.load(std::memory_order_relaxed); }
+        long long total() const { return totalCount.load(std::memory_order_relaxed); }
+
+        void cancel() { stop.store(true); }
+        bool cancelled() const { return stop.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<long long> doneCount;
+        std::atomic<long long> totalCount;
+        std::atomic<bool> stop;
+        Callback callback;
+};
+
+#endif
@@ -0,0 +1,402 @@
+#include "Query.h"
+#include "Database.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+class Query::Node {
+    public:
+        enum Kind { LEAF, AND, OR, NOT };
+
+        explicit Node(Kind k): kind(k) {}
+        virtual ~Node() {}
+        virtual bool test(const StoredStudent &rs) const = 0;
+        virtual std::string text() const = 0;
+
+        const Kind kind;
+};
+
+namespace {
+
+typedef std::shared_ptr<const Query::Node> NodePtr;
+
+const char *opName(Query::Op op){
+    switch(op){
+        case Query::EQ: return "=";
+        case Query::NE: return "!=";
+        case Query::LT: return "<";
+        case Query::LE: return "<=";
+        case Query::GT: return ">";
+        case Query::GE: return ">=";
+        case Query::PREFIX: return "prefix";
+    }
+    return "?";
+}
+
+// Сравнение по операции, выбранной на этапе компиляции
+template<Query::Op O> struct Cmp;
+template<> struct Cmp<Query::EQ> {
+    template<typename T> static bool apply(const T &a, const T &b){ return a == b; }
+    static bool apply(double a, double b){ return std::abs(a - b) < 0.0001; }
+};
+template<> struct Cmp<Query::NE> {
+    template<typename T> static bool apply(const T &a, const T &b){ return !Cmp<Query::EQ>::apply(a, b); }
+};
+template<> struct Cmp<Query::LT> {
+    template<typename T> static bool apply(const T &a, const T &b){ return a < b; }
+};
+template<> struct Cmp<Query::LE> {
+    template<typename T> static bool apply(const T &a, const T &b){ return a <= b; }
+};
+template<> struct Cmp<Query::GT> {
+    template<typename T> static bool apply(const T &a, const T &b){ return a > b; }
+};
+template<> struct Cmp<Query::GE> {
+    template<typename T> static bool apply(const T &a, const T &b){ return a >= b; }
+};
+
+int parseInt(const std::string &v){
+    size_t pos = 0;
+    int r = std::stoi(v, &pos);
+    if(pos != v.size()) throw std::invalid_argument("not an integer: " + v);
+    return r;
+}
+
+double parseDouble(const std::string &v){
+    size_t pos = 0;
+    double r = std::stod(v, &pos);
+    if(pos != v.size()) throw std::invalid_argument("not a number: " + v);
+    return r;
+}
+
+// Поля записи: тип значения, чтение из записи и разбор константы
+struct IdField {
+    typedef int type;
+    static int get(const StoredStudent &rs){ return rs.id; }
+    static int parse(const std::string &v){ return parseInt(v); }
+};
+struct CoursField {
+    typedef int type;
+    static int get(const StoredStudent &rs){ return rs.cours; }
+    static int parse(const std::string &v){ return parseInt(v); }
+};
+struct GradeField {
+    typedef double type;
+    static double get(const StoredStudent &rs){ return rs.averageGrade; }
+    static double parse(const std::string &v){ return parseDouble(v); }
+};
+struct ActiveField {
+    typedef bool type;
+    static bool get(const StoredStudent &rs){ return rs.isActive != 0; }
+    static bool parse(const std::string &v){ return v == "1" || v == "true" || v == "True"; }
+};
+
+class Leaf : public Query::Node {
+    public:
+        explicit Leaf(const Query::Condition &c): Node(LEAF), cond(c) {}
+        std::string text() const override {
+            std::string v = cond.field == "name" ? "\"" + cond.value + "\"" : cond.value;
+            return cond.field + " " + opName(cond.op) + " " + v;
+        }
+        const Query::Condition cond;
+};
+
+template<typename F, Query::Op O>
+class FieldLeaf : public Leaf {
+    public:
+        FieldLeaf(const Query::Condition &c, typename F::type v): Leaf(c), value(v) {}
+        bool test(const StoredStudent &rs) const override { return Cmp<O>::apply(F::get(rs), value); }
+    private:
+        const typename F::type value;
+};
+
+// имя сравнивается так же, как в поиске по равенству: strncmp в пределах поля
+template<Query::Op O>
+class NameLeaf : public Leaf {
+    public:
+        explicit NameLeaf(const Query::Condition &c): Leaf(c) {}
+        bool test(const StoredStudent &rs) const override {
+            return Cmp<O>::apply(strncmp(rs.name, cond.value.c_str(), sizeof(rs.name)), 0);
+        }
+};
+
+class NamePrefixLeaf : public Leaf {
+    public:
+        explicit NamePrefixLeaf(const Query::Condition &c): Leaf(c) {}
+        bool test(const StoredStudent &rs) const override {
+            return strncmp(rs.name, cond.value.c_str(), std::min(cond.value.size(), sizeof(rs.name))) == 0;
+        }
+};
+
+template<typename F>
+NodePtr makeLeaf(const Query::Condition &c){
+    typename F::type v = F::parse(c.value);
+    switch(c.op){
+        case Query::EQ: return std::make_shared<FieldLeaf<F, Query::EQ>>(c, v);
+        case Query::NE: return std::make_shared<FieldLeaf<F, Query::NE>>(c, v);
+        case Query::LT: return std::make_shared<FieldLeaf<F, Query::LT>>(c, v);
+        case Query::LE: return std::make_shared<FieldLeaf<F, Query::LE>>(c, v);
+        case Query::GT: return std::make_shared<FieldLeaf<F, Query::GT>>(c, v);
+        case Query::GE: return std::make_shared<FieldLeaf<F, Query::GE>>(c, v);
+        case Query::PREFIX: break;
+    }
+    throw std::invalid_argument("prefix applies to name only");
+}
+
+NodePtr makeNameLeaf(const Query::Condition &c){
+    switch(c.op){
+        case Query::EQ: return std::make_shared<NameLeaf<Query::EQ>>(c);
+        case Query::NE: return std::make_shared<NameLeaf<Query::NE>>(c);
+        case Query::LT: return std::make_shared<NameLeaf<Query::LT>>(c);
+        case Query::LE: return std::make_shared<NameLeaf<Query::LE>>(c);
+        case Query::GT: return std::make_shared<NameLeaf<Query::GT>>(c);
+        case Query::GE: return std::make_shared<NameLeaf<Query::GE>>(c);
+        case Query::PREFIX: return std::make_shared<NamePrefixLeaf>(c);
+    }
+    throw std::invalid_argument("unknown operator");
+}
+
+NodePtr compileCondition(const Query::Condition &c){
+    if(c.field == "id") return makeLeaf<IdField>(c);
+    if(c.field == "cours") return makeLeaf<CoursField>(c);
+    if(c.field == "averageGrade") return makeLeaf<GradeField>(c);
+    if(c.field == "isActive") return makeLeaf<ActiveField>(c);
+    if(c.field == "name") return makeNameLeaf(c);
+    throw std::invalid_argument("unknown field: " + c.field);
+}
+
+class Junction : public Query::Node {
+    public:
+        Junction(Kind k, std::vector<NodePtr> c): Node(k), children(std::move(c)) {}
+        bool test(const StoredStudent &rs) const override {
+            if(kind == AND){
+                for(const NodePtr &n: children) if(!n->test(rs)) return false;
+                return true;
+            }
+            for(const NodePtr &n: children) if(n->test(rs)) return true;
+            return false;
+        }
+        std::string text() const override {
+            std::string s = "(";
+            for(size_t i = 0; i < children.size(); i++){
+                if(i) s += kind == AND ? " AND " : " OR ";
+                s += children[i]->text();
+            }
+            return s + ")";
+        }
+        const std::vector<NodePtr> children;
+};
+
+class Negation : public Query::Node {
+    public:
+        explicit Negation(const NodePtr &c): Node(NOT), child(c) {}
+        bool test(const StoredStudent &rs) const override { return !child->test(rs); }
+        std::string text() const override { return "NOT " + child->text(); }
+        const NodePtr child;
+};
+
+// вложенные AND (OR) одного вида сливаются в один узел
+NodePtr join(Query::Node::Kind kind, const NodePtr &a, const NodePtr &b){
+    if(!a) return b;
+    if(!b) return a;
+    std::vector<NodePtr> children;
+    for(const NodePtr &n: {a, b}){
+        if(n->kind == kind){
+            const Junction *j = static_cast<const Junction*>(n.get());
+            children.insert(children.end(), j->children.begin(), j->children.end());
+        } else {
+            children.push_back(n);
+        }
+    }
+    return std::make_shared<Junction>(kind, std::move(children));
+}
+
+// Разбор рекурсивным спуском:
+//   expr := and (OR and)*      and := unary (AND unary)*
+//   unary := NOT unary | '(' expr ')' | field op value
+class Parser {
+    public:
+        explicit Parser(const std::string &t): text(t), pos(0) {}
+
+        NodePtr parseAll(){
+            NodePtr n = parseOr();
+            skipSpace();
+            if(pos != text.size()) fail("unexpected input");
+            return n;
+        }
+
+    private:
+        const std::string &text;
+        size_t pos;
+
+        [[noreturn]] void fail(const std::string &what){
+            throw std::invalid_argument("query: " + what + " at position " + std::to_string(pos));
+        }
+
+        void skipSpace(){
+            while(pos < text.size() && std::isspace((unsigned char)text[pos])) pos++;
+        }
+
+        // ключевое слово без учёта регистра, отделённое от следующего слова
+        bool keyword(const char *kw, const char *symbol){
+            skipSpace();
+            size_t n = strlen(symbol);
+            if(n && text.compare(pos, n, symbol) == 0 && (n > 1 || pos + 1 >= text.size() || text[pos + 1] != '=')){
+                pos += n;
+                return true;
+            }
+            size_t k = strlen(kw);
+            if(pos + k > text.size()) return false;
+            for(size_t i = 0; i < k; i++){
+                if(std::toupper((unsigned char)text[pos + i]) != kw[i]) return false;
+            }
+            if(pos + k < text.size() && (std::isalnum((unsigned char)text[pos + k]) || text[pos + k] == '_')) return false;
+            pos += k;
+            return true;
+        }
+
+        NodePtr parseOr(){
+            NodePtr n = parseAnd();
+            while(keyword("OR", "||")) n = join(Query::Node::OR, n, parseAnd());
+            return n;
+        }
+
+        NodePtr parseAnd(){
+            NodePtr n = parseUnary();
+            while(keyword("AND", "&&")) n = join(Query::Node::AND, n, parseUnary());
+            return n;
+        }
+
+        NodePtr parseUnary(){
+            if(keyword("NOT", "!")) return std::make_shared<Negation>(parseUnary());
+            skipSpace();
+            if(pos < text.size() && text[pos] == '('){
+                pos++;
+                NodePtr n = parseOr();
+                skipSpace();
+                if(pos >= text.size() || text[pos] != ')') fail("expected ')'");
+                pos++;
+                return n;
+            }
+            Query::Condition c;
+            c.field = word();
+            if(c.field.empty()) fail("expected field name");
+            c.op = parseOp();
+            c.value = value();
+            return compileCondition(c);
+        }
+
+        std::string word(){
+            skipSpace();
+            size_t start = pos;
+            while(pos < text.size() && (std::isalnum((unsigned char)text[pos]) || text[pos] == '_')) pos++;
+            return text.substr(start, pos - start);
+        }
+
+        Query::Op parseOp(){
+            skipSpace();
+            static const struct { const char *s; Query::Op op; } ops[] = {
+                {"<=", Query::LE}, {">=", Query::GE}, {"!=", Query::NE}, {"==", Query::EQ},
+                {"<", Query::LT}, {">", Query::GT}, {"=", Query::EQ}
+            };
+            for(auto &o: ops){
+                size_t n = strlen(o.s);
+                if(text.compare(pos, n, o.s) == 0){
+                    pos += n;
+                    return o.op;
+                }
+            }
+            if(keyword("PREFIX", "")) return Query::PREFIX;
+            fail("expected operator");
+        }
+
+        std::string value(){
+            skipSpace();
+            if(pos < text.size() && (text[pos] == '"' || text[pos] == '\'')){
+                char quote = text[pos++];
+                size_t end = text.find(quote, pos);
+                if(end == std::string::npos) fail("unterminated string");
+                std::string v = text.substr(pos, end - pos);
+                pos = end + 1;
+                return v;
+            }
+            size_t start = pos;
+            while(pos < text.size() && !std::isspace((unsigned char)text[pos]) && text[pos] != '(' && text[pos] != ')') pos++;
+            if(start == pos) fail("expected value");
+            return text.substr(start, pos - start);
+        }
+};
+
+}
+
+Query::Query() {}
+
+Query::Query(const std::shared_ptr<const Node> &node): root(node) {}
+
+Query Query::parse(const std::string &text){
+    return Query(Parser(text).parseAll());
+}
+
+Query Query::where(const std::string &field, Op op, const std::string &value){
+    return Query(compileCondition(Condition{field, op, value}));
+}
+
+bool Query::isField(const std::string &field){
+    return field == "id" || field == "name" || field == "isActive" || field == "averageGrade" || field == "cours";
+}
+
+bool Query::toInt(const std::string &text, int &out){
+    try {
+        out = parseInt(text);
+        return true;
+    } catch(const std::logic_error &) {
+        return false;
+    }
+}
+
+bool Query::toDouble(const std::string &text, double &out){
+    try {
+        out = parseDouble(text);
+        return true;
+    } catch(const std::logic_error &) {
+        return false;
+    }
+}
+
+Query Query::operator&&(const Query &other) const {
+    return Query(join(Node::AND, root, other.root));
+}
+
+Query Query::operator||(const Query &other) const {
+    // пустой запрос истинен, поэтому и дизъюнкция с ним истинна
+    if(!root || !other.root) return Query();
+    return Query(join(Node::OR, root, other.root));
+}
+
+Query Query::operator!() const {
+    if(!root) throw std::invalid_argument("query: cannot negate an empty query");
+    return Query(std::make_shared<Negation>(root));
+}
+
+bool Query::matches(const StoredStudent &rs) const {
+    return !root || root->test(rs);
+}
+
+std::vector<Query::Condition> Query::conjuncts() const {
+    std::vector<Condition> res;
+    if(!root) return res;
+    if(root->kind == Node::LEAF){
+        res.push_back(static_cast<const Leaf*>(root.get())->cond);
+    } else if(root->kind == Node::AND){
+        for(const NodePtr &n: static_cast<const Junction*>(root.get())->children){
+            if(n->kind == Node::LEAF) res.push_back(static_cast<const Leaf*>(n.get())->cond);
+        }
+    }
+    return res;
+}
+
+std::string Query::toString() const {
+    return root ? root->text() : std::string("(all)");
+}
@@ -0,0 +1,55 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+struct StoredStudent;
+
+// Условие на записи: сравнения полей (= != < <= > >= prefix), объединённые AND/OR/NOT.
+// Выражение разбирается один раз и компилируется в дерево типизированных предикатов,
+// поэтому при проходе по записям нет ни разбора значения, ни сравнения имени поля.
+//   Query::parse("cours >= 3 AND (name prefix \"Iva\" OR NOT averageGrade < 4.5)")
+// Поля: id, name, isActive, averageGrade, cours; prefix - только для name.
+// averageGrade = и != сравниваются с погрешностью 0.0001, как в searchByField.
+class Query {
+    public:
+        enum Op { EQ, NE, LT, LE, GT, GE, PREFIX };
+
+        struct Condition {
+            std::string field;
+            Op op;
+            std::string value;
+        };
+
+        class Node; // скомпилированный предикат
+
+        Query(); // пустой запрос - подходит любая запись
+
+        // ошибки разбора и неверные значения - std::invalid_argument
+        static Query parse(const std::string &text);
+        static Query where(const std::string &field, Op op, const std::string &value);
+        static bool isField(const std::string &field);
+        // Разбор значения так же строго, как в условиях, но без исключений:
+        // false, если строка не число целиком или не помещается в тип
+        static bool toInt(const std::string &text, int &out);
+        static bool toDouble(const std::string &text, double &out);
+
+        Query operator&&(const Query &other) const;
+        Query operator||(const Query &other) const;
+        Query operator!() const;
+
+        bool empty() const { return !root; }
+        bool matches(const StoredStudent &rs) const;
+        // условия верхнего уровня, соединённые AND: по ним выбирается индекс
+        std::vector<Condition> conjuncts() const;
+        std::string toString() const;
+
+    private:
+        std::shared_ptr<const Node> root;
+
+        explicit Query(const std::shared_ptr<const Node> &node);
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include "RwLock.h"
+
+RwLock::RwLock(): readers(0), waitingWriters(0), downgraded(0), writer(false) {}
+
+void RwLock::lock(){
+    std::unique_lock<std::mutex> g(m);
+    waitingWriters++;
+    writersCv.wait(g, [this]{ return !writer && readers == 0; });
+    waitingWriters--;
+    writer = true;
+}
+
+bool RwLock::try_lock(){
+    std::lock_guard<std::mutex> g(m);
+    if(writer || readers > 0) return false;
+    writer = true;
+    return true;
+}
+
+void RwLock::unlock(){
+    std::lock_guard<std::mutex> g(m);
+    writer = false;
+    // следующий писатель идёт раньше ожидающих читателей
+    if(waitingWriters > 0) writersCv.notify_one();
+    else readersCv.notify_all();
+}
+
+void RwLock::lock_shared(){
+    std::unique_lock<std::mutex> g(m);
+    readersCv.wait(g, [this]{ return !writer && (waitingWriters == 0 || downgraded > 0); });
+    readers++;
+}
+
+bool RwLock::try_lock_shared(){
+    std::lock_guard<std::mutex> g(m);
+    if(writer || (waitingWriters > 0 && downgraded == 0)) return false;
+    readers++;
+    return true;
+}
+
+void RwLock::unlock_shared(){
+    std::lock_guard<std::mutex> g(m);
+    if(--readers == 0 && waitingWriters > 0) writersCv.notify_one();
+}
+
+void RwLock::downgrade(){
+    std::lock_guard<std::mutex> g(m);
+    writer = false;
+    readers++;
+    downgraded++;
+    readersCv.notify_all();
+}
+
+void RwLock::unlock_downgraded(){
+    std::lock_guard<std::mutex> g(m);
+    downgraded--;
+    if(--readers == 0 && waitingWriters > 0) writersCv.notify_one();
+}
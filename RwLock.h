@@ -0,0 +1,41 @@
+#ifndef RWLOCK_H
+#define RWLOCK_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+// Блокировка читатели-писатель с приоритетом писателя: пока писатель ждёт, новые
+// читатели не входят, поэтому непрерывный поток чтений не откладывает изменения
+// бесконечно (std::shared_mutex в glibc пропускает читателей вперёд).
+// Имена методов - как у std::shared_mutex, чтобы работали std::unique_lock и std::shared_lock.
+// Не рекурсивна: читатель не должен повторно брать общую блокировку.
+class RwLock {
+    public:
+        RwLock();
+        RwLock(const RwLock&) = delete;
+        RwLock &operator=(const RwLock&) = delete;
+
+        void lock();
+        bool try_lock();
+        void unlock();
+        void lock_shared();
+        bool try_lock_shared();
+        void unlock_shared();
+        // писатель становится читателем, не отпуская блокировку; пока такой читатель
+        // внутри (долгое чтение вроде резервной копии), новые читатели входят и при
+        // ждущих писателях - писатель всё равно ждёт его. Отпускается unlock_downgraded()
+        void downgrade();
+        void unlock_downgraded();
+
+    private:
+        std::mutex m;
+        std::condition_variable readersCv;
+        std::condition_variable writersCv;
+        size_t readers;        // читатели внутри
+        size_t waitingWriters;
+        size_t downgraded;     // из них вошедших через downgrade()
+        bool writer;           // писатель внутри
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include "SecondaryIndex.h"
+#include "FileManager.h"
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+
+namespace {
+
+const uint32_t SIDX_MAGIC = 0x58444953; // "SIDX"
+
+struct SidxHeader {
+    uint32_t magic;
+    uint32_t mask;
+    int64_t recordCount;
+    uint64_t generation; // поколение файла данных, как в отметке B+-дерева
+};
+
+std::string nameKey(const char *name){
+    return std::string(name, strnlen(name, 50));
+}
+
+template<typename T>
+void put(std::ofstream &ofs, const T &v){
+    ofs.write((const char*)&v, sizeof(v));
+}
+
+template<typename T>
+bool get(std::ifstream &ifs, T &v){
+    return (bool)ifs.read((char*)&v, sizeof(v));
+}
+
+}
+
+SecondaryIndexes::SecondaryIndexes(): enabledMask(0) {}
+
+unsigned SecondaryIndexes::fieldFromName(const std::string &field){
+    if(field == "name") return NAME;
+    if(field == "cours") return COURS;
+    if(field == "averageGrade") return GRADE;
+    return 0;
+}
+
+void SecondaryIndexes::setMask(unsigned mask){
+    enabledMask = mask & (NAME | COURS | GRADE);
+    if(!enabled(NAME)) nameIndex.clear();
+    if(!enabled(COURS)) coursIndex.clear();
+    if(!enabled(GRADE)) gradeIndex.clear();
+}
+
+void SecondaryIndexes::clear(){
+    nameIndex.clear();
+    coursIndex.clear();
+    gradeIndex.clear();
+}
+
+void SecondaryIndexes::insert(const char *name, int cours, double grade, long long offset){
+    if(enabled(NAME)) nameIndex[nameKey(name)].push_back(offset);
+    if(enabled(COURS)) coursIndex[cours].insert(offset);
+    if(enabled(GRADE)) gradeIndex.insert({grade, offset});
+}
+
+void SecondaryIndexes::erase(const char *name, int cours, double grade, long long offset){
+    if(enabled(NAME)){
+        auto it = nameIndex.find(nameKey(name));
+        if(it != nameIndex.end()){
+            auto &v = it->second;
+            auto pos = std::find(v.begin(), v.end(), offset);
+            if(pos != v.end()){
+                *pos = v.back();
+                v.pop_back();
+            }
+            if(v.empty()) nameIndex.erase(it);
+        }
+    }
+    if(enabled(COURS)){
+        auto it = coursIndex.find(cours);
+        if(it != coursIndex.end()){
+            it->second.erase(offset);
+            if(it->second.empty()) coursIndex.erase(it);
+        }
+    }
+    if(enabled(GRADE)) gradeIndex.erase({grade, offset});
+}
+
+std::vector<long long> SecondaryIndexes::findName(const std::string &name) const {
+    std::vector<long long> res;
+    auto it = nameIndex.find(name);
+    if(it != nameIndex.end()){
+        res = it->second;
+        std::sort(res.begin(), res.end());
+    }
+    return res;
+}
+
+std::vector<long long> SecondaryIndexes::findCours(int lo, int hi) const {
+    std::vector<long long> res;
+    for(auto it = coursIndex.lower_bound(lo); it != coursIndex.end() && it->first <= hi; ++it){
+        res.insert(res.end(), it->second.begin(), it->second.end());
+    }
+    if(lo != hi) std::sort(res.begin(), res.end());
+    return res;
+}
+
+std::vector<long long> SecondaryIndexes::findGrade(double lo, double hi) const {
+    std::vector<long long> res;
+    auto it = gradeIndex.lower_bound({lo, std::numeric_limits<long long>::min()});
+    for(; it != gradeIndex.end() && it->first <= hi; ++it){
+        res.push_back(it->second);
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+bool SecondaryIndexes::save(const std::string &path, long long recordCount, uint64_t generation) const {
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if(!ofs){return false;}
+        SidxHeader h{SIDX_MAGIC, enabledMask, recordCount, generation};
+        put(ofs, h);
+        if(enabled(NAME)){
+            put(ofs, (uint64_t)nameIndex.size());
+            for(auto &p: nameIndex){
+                put(ofs, (uint8_t)p.first.size());
+                ofs.write(p.first.data(), p.first.size());
+                put(ofs, (uint64_t)p.second.size());
+                ofs.write((const char*)p.second.data(), p.second.size() * sizeof(long long));
+            }
+        }
+        if(enabled(COURS)){
+            put(ofs, (uint64_t)coursIndex.size());
+            for(auto &p: coursIndex){
+                put(ofs, (int32_t)p.first);
+                put(ofs, (uint64_t)p.second.size());
+                for(long long off: p.second) put(ofs, off);
+            }
+        }
+        if(enabled(GRADE)){
+            put(ofs, (uint64_t)gradeIndex.size());
+            for(auto &p: gradeIndex){
+                put(ofs, p.first);
+                put(ofs, p.second);
+            }
+        }
+        ofs.close();
+        if(!ofs){return false;}
+    }
+    // содержимое на диске раньше переименования, само переименование - в каталоге
+    if(!FileManager::syncPath(tmp) || std::rename(tmp.c_str(), path.c_str()) != 0){return false;}
+    return FileManager::syncDir(path);
+}
+
+bool SecondaryIndexes::load(const std::string &path, long long recordCount, uint64_t generation){
+    clear();
+    std::ifstream ifs(path, std::ios::binary);
+    SidxHeader h;
+    if(!ifs || !get(ifs, h) || h.magic != SIDX_MAGIC){return false;}
+    setMask(h.mask);
+    if(h.recordCount != recordCount || h.generation != generation){return false;}
+    // длины списков берутся из файла: каждая сверяется с тем, что в нём осталось
+    ifs.seekg(0, std::ios::end);
+    const uint64_t fileSize = (uint64_t)ifs.tellg();
+    ifs.seekg(sizeof(h));
+    auto fits = [&](uint64_t n, uint64_t itemBytes){
+        std::streamoff pos = ifs.tellg();
+        return pos >= 0 && n <= (fileSize - (uint64_t)pos) / itemBytes;
+    };
+
+    bool ok = true;
+    if(enabled(NAME)){
+        uint64_t keys = 0;
+        ok = ok && get(ifs, keys) && fits(keys, sizeof(uint8_t) + sizeof(uint64_t));
+        for(uint64_t k = 0; ok && k < keys; k++){
+            uint8_t len = 0;
+            uint64_t n = 0;
+            ok = get(ifs, len);
+            std::string name(len, '\0');
+            ok = ok && ifs.read(&name[0], len) && get(ifs, n) && fits(n, sizeof(long long));
+            if(!ok) break;
+            std::vector<long long> &v = nameIndex[name];
+            v.resize(n);
+            ok = (bool)ifs.read((char*)v.data(), n * sizeof(long long));
+        }
+    }
+    if(ok && enabled(COURS)){
+        uint64_t keys = 0;
+        ok = get(ifs, keys) && fits(keys, sizeof(int32_t) + sizeof(uint64_t));
+        for(uint64_t k = 0; ok && k < keys; k++){
+            int32_t cours = 0;
+            uint64_t n = 0;
+            ok = get(ifs, cours) && get(ifs, n) && fits(n, sizeof(long long));
+            if(!ok) break;
+            std::set<long long> &posting = coursIndex[cours];
+            for(uint64_t i = 0; ok && i < n; i++){
+                long long off;
+                ok = get(ifs, off);
+                if(ok) posting.insert(posting.end(), off);
+            }
+        }
+    }
+    if(ok && enabled(GRADE)){
+        uint64_t n = 0;
+        ok = get(ifs, n) && fits(n, sizeof(double) + sizeof(long long));
+        for(uint64_t i = 0; ok && i < n; i++){
+            double g;
+            long long off;
+            ok = get(ifs, g) && get(ifs, off);
+            if(ok) gradeIndex.insert(gradeIndex.end(), {g, off});
+        }
+    }
+    if(!ok) clear();
+    return ok;
+}
+
+unsigned SecondaryIndexes::readMask(const std::string &path){
+    std::ifstream ifs(path, std::ios::binary);
+    SidxHeader h;
+    if(!ifs || !get(ifs, h) || h.magic != SIDX_MAGIC){return 0;}
+    return h.mask & (NAME | COURS | GRADE);
+}
@@ -0,0 +1,49 @@
+#ifndef SECONDARYINDEX_H
+#define SECONDARYINDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+// Вторичные индексы по полям записи, включаются по отдельности:
+//   name         - хеш-индекс имя -> смещения
+//   cours        - списки смещений (posting lists) по номеру курса
+//   averageGrade - упорядоченный индекс (оценка, смещение)
+// Индексы хранят только активные записи; результаты отдаются в порядке смещений.
+class SecondaryIndexes {
+    public:
+        enum Field : unsigned { NAME = 1, COURS = 2, GRADE = 4 };
+
+        SecondaryIndexes();
+
+        static unsigned fieldFromName(const std::string &field); // 0, если поле не индексируется
+        unsigned mask() const { return enabledMask; }
+        bool enabled(unsigned field) const { return (enabledMask & field) != 0; }
+        void setMask(unsigned mask);
+        void clear(); // очищает содержимое, набор включённых индексов сохраняется
+
+        void insert(const char *name, int cours, double grade, long long offset);
+        void erase(const char *name, int cours, double grade, long long offset);
+
+        std::vector<long long> findName(const std::string &name) const;
+        std::vector<long long> findCours(int lo, int hi) const;        // lo <= cours <= hi
+        std::vector<long long> findGrade(double lo, double hi) const;  // lo <= grade <= hi
+
+        // Файл <db>.sidx: набор индексов и их содержимое на момент контрольной точки.
+        // recordCount и generation - число записей и поколение файла данных; при
+        // несовпадении любого из них load() возвращает false.
+        bool save(const std::string &path, long long recordCount, uint64_t generation) const;
+        bool load(const std::string &path, long long recordCount, uint64_t generation);
+        static unsigned readMask(const std::string &path);
+
+    private:
+        unsigned enabledMask;
+        std::unordered_map<std::string, std::vector<long long>> nameIndex;
+        std::map<int, std::set<long long>> coursIndex;
+        std::set<std::pair<double, long long>> gradeIndex;
+};
+
+#endif
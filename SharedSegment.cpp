@@ -0,0 +1,136 @@
+#include "SharedSegment.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+SharedSegment::SharedSegment(): fd(-1), header(nullptr), writer(false) {}
+
+SharedSegment::~SharedSegment(){
+    detach();
+}
+
+bool SharedSegment::attach(const std::string &path, bool writer_){
+    detach();
+    fd = ::open(path.c_str(), writer_ ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if(fd < 0){return false;}
+
+    if(writer_){
+        // writerActive() на мгновение берёт общую блокировку, поэтому неудача
+        // повторяется несколько раз, прежде чем считать базу занятой
+        bool locked = false;
+        for(int attempt = 0; attempt < 20 && !locked; attempt++){
+            if(flock(fd, LOCK_EX | LOCK_NB) == 0) locked = true;
+            else if(errno != EWOULDBLOCK) break;
+            else std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        if(!locked){
+            detach();
+            return false;
+        }
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        detach();
+        return false;
+    }
+    if(writer_ && (size_t)st.st_size < sizeof(Header)){
+        // новый сегмент: ftruncate заполняет его нулями, seq = 0
+        if(ftruncate(fd, sizeof(Header)) != 0){
+            detach();
+            return false;
+        }
+    } else if((size_t)st.st_size < sizeof(Header)){
+        detach();
+        return false;
+    }
+
+    void *p = mmap(nullptr, sizeof(Header), writer_ ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED){
+        detach();
+        return false;
+    }
+    header = (Header*)p;
+    writer = writer_;
+    if(writer && (header->magic != MAGIC || header->version != VERSION)){
+        memset((void*)header, 0, sizeof(Header));
+        header->magic = MAGIC;
+        header->version = VERSION;
+    }
+    if(writer){
+        // нечётный seq остался от писателя, упавшего посреди публикации: раз flock
+        // теперь у нас, никто другой заголовок не меняет, и seq делается чётным
+        uint64_t s = header->seq.load(std::memory_order_relaxed);
+        if(s & 1) header->seq.store(s + 1, std::memory_order_release);
+    }
+    if(!writer && (header->magic != MAGIC || header->version != VERSION)){
+        detach();
+        return false;
+    }
+    return true;
+}
+
+void SharedSegment::detach(){
+    if(header){
+        munmap((void*)header, sizeof(Header));
+        header = nullptr;
+    }
+    if(fd >= 0){
+        ::close(fd); // вместе с дескриптором снимается и flock
+        fd = -1;
+    }
+    writer = false;
+}
+
+uint64_t SharedSegment::seq() const {
+    return header ? header->seq.load(std::memory_order_acquire) : 0;
+}
+
+bool SharedSegment::read(State &out) const {
+    if(!header){return false;}
+    // публикация - несколько записей в память; если seq не меняется так долго,
+    // писатель, скорее всего, умер посреди неё, и ждать его нельзя
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(READ_WAIT_MS);
+    for(;;){
+        uint64_t before = header->seq.load(std::memory_order_acquire);
+        if(before & 1){
+            if(std::chrono::steady_clock::now() > deadline){return false;}
+            std::this_thread::yield();
+            continue;
+        }
+        out.generation = header->generation;
+        out.dataSize = header->dataSize;
+        out.entries = header->entries;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(header->seq.load(std::memory_order_relaxed) != before) continue;
+        out.seq = before;
+        return out.generation != 0;
+    }
+}
+
+uint64_t SharedSegment::publish(long long dataSize, uint64_t entries){
+    if(!header || !writer){return 0;}
+    uint64_t s = header->seq.load(std::memory_order_relaxed);
+    header->seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    header->generation++;
+    header->dataSize = dataSize;
+    header->entries = entries;
+    uint64_t generation = header->generation;
+    header->seq.store(s + 2, std::memory_order_release);
+    return generation;
+}
+
+bool SharedSegment::writerActive(const std::string &path){
+    int f = ::open(path.c_str(), O_RDONLY);
+    if(f < 0){return false;}
+    bool busy = flock(f, LOCK_SH | LOCK_NB) != 0 && errno == EWOULDBLOCK;
+    ::close(f);
+    return busy;
+}
@@ -0,0 +1,66 @@
+#ifndef SHAREDSEGMENT_H
+#define SHAREDSEGMENT_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Общий для процессов файл <db>.shm, отображённый MAP_SHARED. Через него писатель
+// сообщает читателям о новом снимке индекса: номер поколения (по нему каждый процесс
+// находит неизменяемый файл снимка <db>.idx.<поколение>), размер данных и число
+// записей на момент публикации. Заголовок меняется под seqlock:
+// нечётный seq - идёт обновление, читатель повторяет чтение.
+// Писатель держит на файле flock(LOCK_EX) всё время, пока база открыта, поэтому
+// второй процесс-писатель открыть базу не может; читатели блокировку не берут.
+class SharedSegment {
+    public:
+        struct State {
+            uint64_t seq;          // меняется при каждой публикации
+            uint64_t generation;
+            long long dataSize;    // байт файла данных, покрытых снимком
+            uint64_t entries;
+        };
+
+        SharedSegment();
+        ~SharedSegment();
+        SharedSegment(const SharedSegment&) = delete;
+        SharedSegment &operator=(const SharedSegment&) = delete;
+
+        // writer: создаёт файл при необходимости и берёт блокировку писателя;
+        // false, если её держит другой процесс
+        bool attach(const std::string &path, bool writer);
+        void detach();
+        bool attached() const { return header != nullptr; }
+        bool isWriter() const { return writer; }
+
+        // false - ещё ничего не опубликовано или публикация не завершилась за READ_WAIT_MS
+        bool read(State &out) const;
+        uint64_t seq() const;         // дешёвая проверка, не было ли новой публикации
+        uint64_t generation() const { return header ? header->generation : 0; } // для писателя
+        // только писатель; возвращает номер нового поколения, 0 - ошибка
+        uint64_t publish(long long dataSize, uint64_t entries);
+
+        // открыта ли база на запись другим процессом
+        static bool writerActive(const std::string &path);
+
+    private:
+        static constexpr uint32_t MAGIC = 0x4D485344; // "DSHM"
+        static constexpr uint32_t VERSION = 1;
+        static constexpr int READ_WAIT_MS = 1000;
+
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            std::atomic<uint64_t> seq;
+            uint64_t generation;
+            int64_t dataSize;
+            uint64_t entries;
+        };
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "seq must be lock-free to be shared between processes");
+
+        int fd;
+        Header *header;
+        bool writer;
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include "StudentModel.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+StudentModel::StudentModel(Database &db, QObject *parent)
+    : QAbstractTableModel(parent), db(db), nextId(INT_MIN), atEnd(false), totalRows(0) {}
+
+void StudentModel::setQuery(const Query &q) {
+    query = q;
+    reload();
+}
+
+void StudentModel::reload() {
+    beginResetModel();
+    pages.clear();
+    cache.clear();
+    nextId = INT_MIN;
+    atEnd = !db.isOpen();
+    totalRows = 0;
+    endResetModel();
+}
+
+int StudentModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : totalRows;
+}
+
+int StudentModel::columnCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : 5;
+}
+
+QVariant StudentModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (role != Qt::DisplayRole) return QVariant();
+    if (orientation == Qt::Vertical) return section + 1;
+    static const char *names[] = {"ID", "Name", "Active", "AvgGrade", "Course"};
+    return (section >= 0 && section < 5) ? QVariant(names[section]) : QVariant();
+}
+
+QVariant StudentModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || role != Qt::DisplayRole) return QVariant();
+    const StoredStudent *rs = rowAt(index.row());
+    if (!rs) return QVariant();
+    switch (index.column()) {
+        case 0: return rs->id;
+        case 1: return QString::fromUtf8(rs->name, (int)strnlen(rs->name, sizeof(rs->name)));
+        case 2: return QString(rs->isActive ? "1" : "0");
+        case 3: return rs->averageGrade;
+        case 4: return rs->cours;
+    }
+    return QVariant();
+}
+
+bool StudentModel::canFetchMore(const QModelIndex &parent) const {
+    return !parent.isValid() && !atEnd;
+}
+
+void StudentModel::fetchMore(const QModelIndex &parent) {
+    if (parent.isValid() || atEnd) return;
+    long long from = nextId;
+    std::vector<StoredStudent> rows = readRows(from, (long long)INT_MAX + 1, PAGE_ROWS);
+    // неполная страница - последняя
+    if ((int)rows.size() < PAGE_ROWS) atEnd = true;
+    if (rows.empty()) return;
+
+    int count = (int)rows.size();
+    beginInsertRows(QModelIndex(), totalRows, totalRows + count - 1);
+    pages.push_back(Page{from, count, totalRows});
+    totalRows += count;
+    nextId = (long long)rows.back().id + 1;
+    remember(pages.size() - 1, std::move(rows));
+    endInsertRows();
+}
+
+std::vector<StoredStudent> StudentModel::readRows(long long fromId, long long untilId, size_t limit) const {
+    std::vector<StoredStudent> rows;
+    if (fromId > INT_MAX || fromId >= untilId) return rows;
+    for (RecordCursor c = db.cursorById((int)fromId, query); rows.size() < limit && c.next(); ) {
+        if (c.current().id >= untilId) break;
+        rows.push_back(c.current());
+    }
+    return rows;
+}
+
+long long StudentModel::pageEnd(size_t number) const {
+    if (number + 1 < pages.size()) return pages[number + 1].firstId;
+    // за последней страницей - всё, что ещё не загружено, либо до конца, если загружено всё
+    return atEnd ? (long long)INT_MAX + 1 : nextId;
+}
+
+bool StudentModel::pageOf(int id, size_t &number) const {
+    if (pages.empty() || id >= pageEnd(pages.size() - 1)) return false;
+    auto it = std::upper_bound(pages.begin(), pages.end(), (long long)id,
+                               [](long long key, const Page &p) { return key < p.firstId; });
+    if (it == pages.begin()) return false;
+    number = (size_t)(it - pages.begin()) - 1;
+    return true;
+}
+
+StudentModel::CachedPage *StudentModel::cachedPage(size_t number) const {
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->number == number) {
+            cache.splice(cache.begin(), cache, it);
+            return &cache.front();
+        }
+    }
+    return nullptr;
+}
+
+const StoredStudent *StudentModel::rowAt(int row) const {
+    if (row < 0 || row >= totalRows) return nullptr;
+    // последняя страница с началом не дальше row; пустые страницы пропускаются сами
+    auto it = std::upper_bound(pages.begin(), pages.end(), row,
+                               [](int r, const Page &p) { return r < p.start; });
+    size_t number = (size_t)(it - pages.begin()) - 1;
+    size_t inPage = (size_t)(row - pages[number].start);
+    CachedPage *page = cachedPage(number);
+    if (!page) {
+        remember(number, readRows(pages[number].firstId, pageEnd(number), (size_t)INT_MAX));
+        page = &cache.front();
+    }
+    return inPage < page->rows.size() ? &page->rows[inPage] : nullptr;
+}
+
+void StudentModel::remember(size_t number, std::vector<StoredStudent> &&rows) const {
+    if (cache.size() >= MAX_CACHED_PAGES) cache.pop_back();
+    cache.push_front(CachedPage{number, std::move(rows)});
+}
+
+void StudentModel::renumber(size_t fromPage) {
+    int start = fromPage == 0 ? 0 : pages[fromPage - 1].start + pages[fromPage - 1].rows;
+    for (size_t i = fromPage; i < pages.size(); i++) {
+        pages[i].start = start;
+        start += pages[i].rows;
+    }
+    totalRows = start;
+}
+
+void StudentModel::applyChanges(const std::vector<Change> &changes) {
+    if (changes.size() > MAX_INCREMENTAL_CHANGES) {
+        reload();
+        return;
+    }
+    // неактивные записи RecordCursor пропускает, значит, и в модели их быть не должно
+    auto visible = [this](const StoredStudent &rs) { return rs.isActive != 0 && query.matches(rs); };
+    for (const Change &c : changes) {
+        switch (c.kind) {
+            case Change::RESET:
+                reload();
+                break;
+            case Change::INSERTED:
+                if (visible(c.after)) insertRow(c.after);
+                break;
+            case Change::DELETED:
+                if (visible(c.before)) removeRow(c.before);
+                break;
+            case Change::UPDATED: {
+                bool was = visible(c.before), is = visible(c.after);
+                // новый id - новое место в порядке строк
+                if (was && is && c.before.id == c.after.id) {
+                    updateRow(c.after);
+                } else {
+                    if (was) removeRow(c.before);
+                    if (is) insertRow(c.after);
+                }
+                break;
+            }
+        }
+    }
+}
+
+void StudentModel::insertRow(const StoredStudent &rs) {
+    size_t number;
+    if (!pageOf(rs.id, number)) {
+        // пустая полностью загруженная таблица получает первую страницу
+        if (!pages.empty() || !atEnd) return;
+        pages.push_back(Page{INT_MIN, 0, 0});
+        number = 0;
+    }
+    CachedPage *page = cachedPage(number);
+    if (!page) {
+        resizePage(number, pages[number].rows + 1);
+        return;
+    }
+    auto pos = std::lower_bound(page->rows.begin(), page->rows.end(), rs.id,
+                                [](const StoredStudent &a, int id) { return a.id < id; });
+    int inPage = (int)(pos - page->rows.begin());
+    int row = pages[number].start + inPage;
+    beginInsertRows(QModelIndex(), row, row);
+    page->rows.insert(pos, rs);
+    pages[number].rows++;
+    renumber(number);
+    endInsertRows();
+}
+
+void StudentModel::removeRow(const StoredStudent &rs) {
+    size_t number;
+    if (!pageOf(rs.id, number) || pages[number].rows == 0) return;
+    CachedPage *page = cachedPage(number);
+    if (!page) {
+        resizePage(number, pages[number].rows - 1);
+        return;
+    }
+    auto pos = std::lower_bound(page->rows.begin(), page->rows.end(), rs.id,
+                                [](const StoredStudent &a, int id) { return a.id < id; });
+    if (pos == page->rows.end() || pos->id != rs.id) return;
+    int row = pages[number].start + (int)(pos - page->rows.begin());
+    beginRemoveRows(QModelIndex(), row, row);
+    page->rows.erase(pos);
+    pages[number].rows--;
+    renumber(number);
+    endRemoveRows();
+}
+
+void StudentModel::resizePage(size_t number, int rows) {
+    // у страницы вне кэша известен только размер, места строки в ней не знаем:
+    // строки страницы объявляются удалёнными и вставленными заново, а сами
+    // записи будут прочитаны при следующем обращении
+    if (pages[number].rows > 0) {
+        beginRemoveRows(QModelIndex(), pages[number].start, pages[number].start + pages[number].rows - 1);
+        pages[number].rows = 0;
+        renumber(number);
+        endRemoveRows();
+    }
+    if (rows > 0) {
+        beginInsertRows(QModelIndex(), pages[number].start, pages[number].start + rows - 1);
+        pages[number].rows = rows;
+        renumber(number);
+        endInsertRows();
+    }
+}
+
+void StudentModel::updateRow(const StoredStudent &rs) {
+    size_t number;
+    if (!pageOf(rs.id, number)) return;
+    // страница вне кэша будет прочитана заново уже с новым значением
+    CachedPage *page = cachedPage(number);
+    if (!page) return;
+    auto pos = std::lower_bound(page->rows.begin(), page->rows.end(), rs.id,
+                                [](const StoredStudent &a, int id) { return a.id < id; });
+    if (pos == page->rows.end() || pos->id != rs.id) return;
+    *pos = rs;
+    int row = pages[number].start + (int)(pos - page->rows.begin());
+    emit dataChanged(index(row, 0), index(row, columnCount() - 1));
+}
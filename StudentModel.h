@@ -0,0 +1,70 @@
+#ifndef STUDENTMODEL_H
+#define STUDENTMODEL_H
+
+#include <QAbstractTableModel>
+#include <list>
+#include <vector>
+#include "Database.h"
+
+// Модель таблицы студентов в порядке id, читающая базу страницами по требованию.
+// Представление само вызывает fetchMore при прокрутке к концу; в памяти держится
+// не больше MAX_CACHED_PAGES страниц, а для остальных хранятся только первый id
+// и число строк: страница i - это записи с id из [firstId(i), firstId(i + 1)).
+// Изменения базы применяются построчно через applyChanges, без перечитывания таблицы.
+class StudentModel : public QAbstractTableModel {
+    Q_OBJECT
+
+public:
+    static const int PAGE_ROWS = 256;
+    static const size_t MAX_CACHED_PAGES = 64;
+    // пакет больше этого проще показать заново, чем вставлять по строке
+    static const size_t MAX_INCREMENTAL_CHANGES = 1024;
+
+    explicit StudentModel(Database &db, QObject *parent = nullptr);
+
+    void setQuery(const Query &q); // пустой запрос - все записи
+    void reload();                 // сбросить страницы и читать заново
+    void applyChanges(const std::vector<Change> &changes);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+
+private:
+    struct Page {
+        long long firstId;
+        int rows;
+        int start; // номер первой строки страницы в модели
+    };
+    struct CachedPage {
+        size_t number;
+        std::vector<StoredStudent> rows;
+    };
+
+    Database &db;
+    Query query;
+    std::vector<Page> pages;
+    long long nextId;  // первый id после загруженных страниц
+    bool atEnd;
+    int totalRows;
+    mutable std::list<CachedPage> cache; // в начале - последние использованные
+
+    // записи с fromId <= id < untilId, не больше limit
+    std::vector<StoredStudent> readRows(long long fromId, long long untilId, size_t limit) const;
+    const StoredStudent *rowAt(int row) const;
+    CachedPage *cachedPage(size_t number) const; // nullptr, если страницы нет в кэше
+    void remember(size_t number, std::vector<StoredStudent> &&rows) const;
+    long long pageEnd(size_t number) const;      // первый id за страницей
+    // страница, в диапазон которой попадает id; false - id за пределами загруженного
+    bool pageOf(int id, size_t &number) const;
+    void renumber(size_t fromPage);
+    void insertRow(const StoredStudent &rs);
+    void removeRow(const StoredStudent &rs);
+    void resizePage(size_t number, int rows); // страница вне кэша с новым числом строк
+    void updateRow(const StoredStudent &rs);
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+#include "Database.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Общее для проверок, которые запускает ctest: CHECK считает неудачи, не прерывая
+// проверку, testResult() даёт код возврата main. Файлы баз создаются в рабочем
+// каталоге и удаляются после проверки.
+
+inline int &testFailures(){
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond) do { \
+    if(!(cond)){ std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); testFailures()++; } \
+} while(0)
+
+inline int testResult(){
+    if(testFailures()) std::fprintf(stderr, "%d checks failed\n", testFailures());
+    else std::printf("all checks passed\n");
+    return testFailures() ? 1 : 0;
+}
+
+typedef std::tuple<int, std::string, double, int> TestRow;
+
+inline Student testStudent(int id, int cours){
+    Student s;
+    s.id = id;
+    std::snprintf(s.name, sizeof(s.name), "student%d", id);
+    s.averageGrade = (id % 41) / 10.0 + 1.0;
+    s.cours = cours;
+    return s;
+}
+
+// содержимое базы, упорядоченное для сравнения
+inline std::vector<TestRow> testRows(Database &db){
+    std::vector<TestRow> out;
+    for(const Student &s: db.getAll()) out.push_back(TestRow(s.id, s.name, s.averageGrade, s.cours));
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+// вставки пачкой и по одной, правки и удаление диапазона с id от base
+inline void testMutate(Database &db, int base){
+    std::vector<Student> batch;
+    for(int i = 0; i < 500; i++) batch.push_back(testStudent(base + i, 1 + i % 5));
+    std::vector<std::string> errors;
+    db.addRecords(batch, errors);
+    std::string err;
+    for(int i = 500; i < 520; i++) db.addRecord(testStudent(base + i, 2), err);
+    for(int i = 0; i < 50; i++) db.editRecordByKey(base + i * 3, testStudent(base + i * 3, 4));
+    db.deleteRange("id", std::to_string(base + 100), std::to_string(base + 149));
+}
+
+// добавляет в model записи, которые оставляет testMutate(base)
+inline void testExpect(std::vector<TestRow> &model, int base){
+    for(int i = 0; i < 520; i++){
+        if(i >= 100 && i <= 149) continue;
+        Student s = testStudent(base + i, i < 500 ? 1 + i % 5 : 2);
+        if(i % 3 == 0 && i / 3 < 50) s.cours = 4;
+        model.push_back(TestRow(s.id, s.name, s.averageGrade, s.cours));
+    }
+    std::sort(model.begin(), model.end());
+}
+
+inline void testRemoveDb(const std::string &file){
+    Database db;
+    db.removeDB(file);
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+ThreadPool::ThreadPool(size_t threads): stopping(false) {
+    if(threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    workers.reserve(threads);
+    for(size_t i = 0; i < threads; i++){
+        workers.emplace_back([this]{ workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for(std::thread &t: workers) t.join();
+}
+
+void ThreadPool::workerLoop(){
+    for(;;){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]{ return stopping || !tasks.empty(); });
+            if(tasks.empty()) return; // stopping и очередь разобрана
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)> &fn){
+    if(n == 0) return;
+    if(n == 1 || workers.empty()){
+        for(size_t i = 0; i < n; i++) fn(i);
+        return;
+    }
+
+    // части раздаются через общий счётчик, поэтому медленная часть не задерживает остальные.
+    // Помощник, не успевший начать до конца работы, просто выходит: ждать его нельзя,
+    // иначе parallelFor из задачи этого же пула мог бы ждать сам себя.
+    struct State {
+        std::atomic<size_t> next{0};
+        std::mutex m;
+        std::condition_variable done;
+        size_t active = 0;
+        bool closed = false;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<State>();
+    const std::function<void(size_t)> *body = &fn;
+    auto drain = [state, n, body]{
+        for(size_t i = state->next++; i < n; i = state->next++){
+            try {
+                (*body)(i);
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(state->m);
+                if(!state->error) state->error = std::current_exception();
+            }
+        }
+    };
+
+    size_t helpers = std::min(workers.size(), n - 1);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(size_t h = 0; h < helpers; h++){
+            tasks.push_back([state, drain]{
+                {
+                    std::lock_guard<std::mutex> lock(state->m);
+                    if(state->closed) return;
+                    state->active++;
+                }
+                drain();
+                std::lock_guard<std::mutex> lock(state->m);
+                if(--state->active == 0) state->done.notify_all();
+            });
+        }
+    }
+    cv.notify_all();
+
+    drain();
+    std::unique_lock<std::mutex> lock(state->m);
+    state->closed = true;
+    state->done.wait(lock, [&]{ return state->active == 0; });
+    if(state->error) std::rethrow_exception(state->error);
+}
@@ -0,0 +1,51 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул рабочих потоков фиксированного размера с общей очередью задач.
+class ThreadPool {
+    public:
+        explicit ThreadPool(size_t threads = 0); // 0 - по числу ядер
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool &operator=(const ThreadPool&) = delete;
+
+        size_t size() const { return workers.size(); }
+
+        template<typename F>
+        auto submit(F &&f) -> std::future<decltype(f())> {
+            typedef decltype(f()) R;
+            auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+            std::future<R> res = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back([task]{ (*task)(); });
+            }
+            cv.notify_one();
+            return res;
+        }
+
+        // fn(i) для i из [0, n); вызывающий поток тоже выполняет части и ждёт завершения всех.
+        // Первое исключение из fn пробрасывается после того, как все части закончились.
+        void parallelFor(size_t n, const std::function<void(size_t)> &fn);
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stopping;
+
+        void workerLoop();
+};
+
+#endif
@@ -0,0 +1,223 @@
+#include "Wal.h"
+#include "Checksum.h"
+#include "Log.h"
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+struct WalFrame {
+    uint32_t size;
+    uint32_t crc;
+};
+
+bool writeAll(int fd, const char *buf, size_t size){
+    while(size > 0){
+        ssize_t n = ::write(fd, buf, size);
+        if(n < 0){return false;}
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+}
+
+Wal::Wal(): fd(-1), durability(Durability::OnCommit), batchMs(10), metrics(nullptr),
+    nextLsn(1), writtenLsn(0), syncedLsn(0), fileBytes(0),
+    flushing(false), failed(false), stopFlusher(false) {}
+
+Wal::~Wal(){
+    close();
+}
+
+bool Wal::open(const std::string &filename_){
+    close();
+    fd = ::open(filename_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(fd < 0){
+        LOG_ERROR("Cannot open journal: " << filename_);
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    filename = filename_;
+    fileBytes = st.st_size;
+    failed = false;
+    pending.clear();
+    writtenLsn = syncedLsn = nextLsn - 1;
+    if(durability == Durability::Batched) startFlusher();
+    return true;
+}
+
+void Wal::close(){
+    if(fd < 0) return;
+    stopFlusherThread();
+    flushTo(lastLsn(), durability != Durability::None);
+    ::close(fd);
+    fd = -1;
+}
+
+bool Wal::replay(const ReplayFn &fn){
+    if(fd < 0){return false;}
+    std::vector<char> data((size_t)fileBytes);
+    size_t have = 0;
+    while(have < data.size()){
+        ssize_t n = pread(fd, data.data() + have, data.size() - have, have);
+        if(n <= 0) break;
+        have += n;
+    }
+
+    size_t pos = 0;
+    while(pos + sizeof(WalFrame) <= have){
+        WalFrame f;
+        memcpy(&f, data.data() + pos, sizeof(f));
+        const char *payload = data.data() + pos + sizeof(f);
+        if(f.size > have - pos - sizeof(f)) break;
+        if(crc32(payload, f.size, f.size) != f.crc) break;
+        if(!fn(payload, f.size)){return false;}
+        pos += sizeof(f) + f.size;
+    }
+
+    // недописанный хвост после сбоя отрезается, чтобы новые записи шли за целыми
+    if(pos < fileBytes){
+        LOG_WARN("Journal " << filename << ": dropping " << (fileBytes - pos) << " bytes of torn tail");
+        if(ftruncate(fd, pos) != 0){return false;}
+        fileBytes = pos;
+    }
+    return true;
+}
+
+unsigned long long Wal::append(const char *payload, size_t size){
+    std::lock_guard<std::mutex> lock(m);
+    if(fd < 0 || failed){return 0;}
+    WalFrame f;
+    f.size = (uint32_t)size;
+    f.crc = crc32(payload, size, f.size);
+    const char *fp = (const char*)&f;
+    pending.insert(pending.end(), fp, fp + sizeof(f));
+    pending.insert(pending.end(), payload, payload + size);
+    return nextLsn++;
+}
+
+bool Wal::flushTo(unsigned long long lsn, bool durable){
+    std::unique_lock<std::mutex> lock(m);
+    while(true){
+        if(failed || fd < 0){return false;}
+        if(durable ? syncedLsn >= lsn : writtenLsn >= lsn){return true;}
+        if(flushing){
+            cv.wait(lock);
+            continue;
+        }
+
+        // этот поток становится лидером и пишет всё накопленное, включая чужие записи
+        flushing = true;
+        std::vector<char> buf;
+        buf.swap(pending);
+        unsigned long long upto = nextLsn - 1;
+        lock.unlock();
+
+        bool ok = writeAll(fd, buf.data(), buf.size());
+        if(ok && durable) ok = fdatasync(fd) == 0;
+        if(metrics){
+            metrics->add(Metrics::BYTES_WRITTEN, buf.size());
+            if(durable) metrics->add(Metrics::FSYNCS);
+        }
+
+        lock.lock();
+        flushing = false;
+        if(ok){
+            fileBytes += buf.size();
+            writtenLsn = upto;
+            if(durable) syncedLsn = upto;
+        } else {
+            LOG_ERROR("Journal write failed: " << filename);
+            failed = true;
+        }
+        cv.notify_all();
+    }
+}
+
+bool Wal::flushAll(){
+    return flushTo(lastLsn(), true);
+}
+
+bool Wal::commit(unsigned long long lsn){
+    switch(durability){
+        case Durability::OnCommit:
+            return flushTo(lsn, true);
+        case Durability::None: {
+            bool overflow;
+            {
+                std::lock_guard<std::mutex> lock(m);
+                overflow = pending.size() >= NONE_MODE_BUFFER;
+            }
+            return overflow ? flushTo(lsn, false) : true;
+        }
+        case Durability::Batched:
+            return true;
+    }
+    return false;
+}
+
+bool Wal::reset(){
+    std::unique_lock<std::mutex> lock(m);
+    if(fd < 0){return false;}
+    while(flushing) cv.wait(lock);
+    pending.clear();
+    writtenLsn = syncedLsn = nextLsn - 1;
+    if(metrics) metrics->add(Metrics::FSYNCS);
+    if(ftruncate(fd, 0) != 0 || fsync(fd) != 0){return false;}
+    fileBytes = 0;
+    return true;
+}
+
+void Wal::setDurability(Durability d, int batchMs_){
+    stopFlusherThread();
+    durability = d;
+    batchMs = batchMs_ > 0 ? batchMs_ : 1;
+    if(fd >= 0 && durability == Durability::Batched) startFlusher();
+}
+
+unsigned long long Wal::size(){
+    std::lock_guard<std::mutex> lock(m);
+    return fileBytes + pending.size();
+}
+
+unsigned long long Wal::lastLsn(){
+    std::lock_guard<std::mutex> lock(m);
+    return nextLsn - 1;
+}
+
+void Wal::startFlusher(){
+    stopFlusher = false;
+    flusher = std::thread([this]{
+        std::unique_lock<std::mutex> lock(m);
+        while(!stopFlusher){
+            flusherCv.wait_for(lock, std::chrono::milliseconds(batchMs));
+            if(stopFlusher) break;
+            unsigned long long upto = nextLsn - 1;
+            if(syncedLsn >= upto) continue;
+            lock.unlock();
+            flushTo(upto, true);
+            lock.lock();
+        }
+    });
+}
+
+void Wal::stopFlusherThread(){
+    if(!flusher.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stopFlusher = true;
+    }
+    flusherCv.notify_all();
+    flusher.join();
+}
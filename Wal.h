@@ -0,0 +1,78 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include "Metrics.h"
+
+// Журнал упреждающей записи (write-ahead log).
+// Каждая запись - произвольный блок байт с длиной и CRC. append() только кладёт
+// запись в буфер и возвращает её LSN; commit(lsn) делает запись долговечной
+// в соответствии с режимом. Потоки, ожидающие commit одновременно, разделяют
+// один fdatasync (group commit).
+class Wal {
+    public:
+        enum class Durability {
+            None,       // без fsync: буфер пишется только при переполнении и контрольной точке
+            OnCommit,   // commit() возвращается после fdatasync
+            Batched     // фоновый поток делает fdatasync раз в batchMs миллисекунд
+        };
+
+        typedef std::function<bool(const char *payload, size_t size)> ReplayFn;
+
+        Wal();
+        ~Wal();
+        Wal(const Wal&) = delete;
+        Wal &operator=(const Wal&) = delete;
+
+        bool open(const std::string &filename);
+        void close();
+        bool isOpen() const { return fd >= 0; }
+
+        // Применяет все целые записи по порядку; повреждённый хвост отбрасывается
+        bool replay(const ReplayFn &fn);
+
+        unsigned long long append(const char *payload, size_t size); // 0 при ошибке
+        bool commit(unsigned long long lsn);
+        bool flushTo(unsigned long long lsn, bool durable); // запись (и fdatasync) до lsn включительно
+        bool flushAll();
+        bool reset(); // очищает журнал после контрольной точки
+
+        void setDurability(Durability d, int batchMs = 10);
+        Durability getDurability() const { return durability; }
+        unsigned long long size();
+        unsigned long long lastLsn();
+        void setMetrics(Metrics *m) { metrics = m; } // байты записи и fdatasync
+
+    private:
+        static const size_t NONE_MODE_BUFFER = 64 * 1024;
+
+        std::string filename;
+        int fd;
+        Durability durability;
+        int batchMs;
+        Metrics *metrics;
+
+        std::mutex m;
+        std::condition_variable cv;
+        std::vector<char> pending;          // ещё не записанные в файл записи
+        unsigned long long nextLsn;
+        unsigned long long writtenLsn;
+        unsigned long long syncedLsn;
+        unsigned long long fileBytes;
+        bool flushing;
+        bool failed;
+
+        std::thread flusher;
+        bool stopFlusher;
+        std::condition_variable flusherCv;
+
+        void startFlusher();
+        void stopFlusherThread();
+};
+
+#endif
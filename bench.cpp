@@ -0,0 +1,432 @@
+#include "Database.h"
+#include "Log.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Нагрузка на движок по образцу базовых нагрузок YCSB:
+//   a - 50% чтений / 50% обновлений   b - 95% чтений / 5% обновлений
+//   c - 100% чтений                   d - 95% чтений свежих / 5% вставок
+//   e - 95% проходов по полю / 5% вставок
+//   f - 50% чтений / 50% чтение-изменение-запись
+// Затем нагрузка c повторяется из --readers потоков сразу, одна и рядом с писателем.
+// После смесей замеряются запросы по диапазону и операции над всей таблицей (getAll,
+// backup, deleteByField, инкрементальная копия, deleteRange, compact). --metrics в конце
+// печатает собственные счётчики движка и гистограммы задержек в JSON.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    long long records = 10000;
+    long long ops = 10000;
+    long long scanOps = 20;
+    long long batch = 0;
+    std::vector<std::string> indexes;
+    std::string workloads = "abcdef";
+    std::string file = "filedb_bench.db";
+    unsigned seed = 42;
+    double zipfTheta = 0.99;
+    Wal::Durability durability = Wal::Durability::OnCommit;
+    int batchMs = 10;
+    bool columns = false;
+    long long threads = 0;
+    long long readers = 4;
+    bool verbose = false;
+    bool metrics = false;
+};
+
+// Генератор Ципфа на [0, n) по Грею и др., тот же, что в YCSB
+class ZipfGenerator {
+    private:
+        long long n;
+        double theta;
+        double alpha;
+        double zetan;
+        double eta;
+        std::uniform_real_distribution<double> uni{0.0, 1.0};
+
+        static double zeta(long long n, double theta){
+            double sum = 0;
+            for(long long i = 1; i <= n; i++){ sum += 1.0 / std::pow((double)i, theta); }
+            return sum;
+        }
+    public:
+        ZipfGenerator(long long n_, double theta_): n(n_), theta(theta_) {
+            double zeta2 = zeta(2, theta);
+            zetan = zeta(n, theta);
+            alpha = 1.0 / (1.0 - theta);
+            eta = (1.0 - std::pow(2.0 / (double)n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+        }
+
+        long long next(std::mt19937_64 &rng){
+            double u = uni(rng);
+            double uz = u * zetan;
+            if(uz < 1.0) return 0;
+            if(uz < 1.0 + std::pow(0.5, theta)) return 1;
+            long long v = (long long)((double)n * std::pow(eta * u - eta + 1.0, alpha));
+            return std::min(v, n - 1);
+        }
+};
+
+struct Stats {
+    std::string name;
+    std::vector<long long> latNs;
+    double totalSec = 0;
+};
+
+Student makeStudent(int id, std::mt19937_64 &rng){
+    Student s;
+    s.id = id;
+    std::snprintf(s.name, sizeof(s.name), "student_%d", (int)(rng() % 100000));
+    s.isActive = true;
+    s.averageGrade = 2.0 + (double)(rng() % 301) / 100.0;
+    s.cours = 1 + (int)(rng() % 6);
+    return s;
+}
+
+long long percentile(const std::vector<long long> &sorted, double p){
+    if(sorted.empty()) return 0;
+    size_t i = (size_t)std::ceil(p * (double)sorted.size()) - 1;
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+void report(Stats &st){
+    std::sort(st.latNs.begin(), st.latNs.end());
+    double thr = st.totalSec > 0 ? (double)st.latNs.size() / st.totalSec : 0;
+    std::printf("%-22s %10zu %12.1f %12.2f %12.2f %12.2f\n",
+                st.name.c_str(), st.latNs.size(), thr,
+                percentile(st.latNs, 0.50) / 1000.0,
+                percentile(st.latNs, 0.99) / 1000.0,
+                st.latNs.empty() ? 0.0 : st.latNs.back() / 1000.0);
+    std::fflush(stdout);
+}
+
+// Выполняет op count раз, замеряя каждый вызов отдельно
+Stats timeOps(const std::string &name, long long count, const std::function<void(long long)> &op){
+    Stats st;
+    st.name = name;
+    st.latNs.reserve((size_t)count);
+    auto begin = Clock::now();
+    for(long long i = 0; i < count; i++){
+        auto t0 = Clock::now();
+        op(i);
+        auto t1 = Clock::now();
+        st.latNs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+    }
+    st.totalSec = std::chrono::duration<double>(Clock::now() - begin).count();
+    return st;
+}
+
+// Выполняет op count раз, распределив вызовы по threads потокам; задержки всех потоков
+// сливаются, пропускная способность считается по времени всего прогона
+Stats timeParallel(const std::string &name, long long threads, long long count,
+                   const std::function<void(long long thread, long long i)> &op){
+    std::vector<Stats> parts((size_t)threads);
+    std::vector<std::thread> workers;
+    auto begin = Clock::now();
+    for(long long t = 0; t < threads; t++){
+        workers.emplace_back([&, t]{
+            long long first = count * t / threads, last = count * (t + 1) / threads;
+            parts[(size_t)t] = timeOps(name, last - first, [&](long long i){ op(t, first + i); });
+        });
+    }
+    for(std::thread &w: workers) w.join();
+    Stats st;
+    st.name = name;
+    for(Stats &p: parts) st.latNs.insert(st.latNs.end(), p.latNs.begin(), p.latNs.end());
+    st.totalSec = std::chrono::duration<double>(Clock::now() - begin).count();
+    return st;
+}
+
+bool parseArgs(int argc, char **argv, Options &o){
+    for(int i = 1; i < argc; i++){
+        std::string a = argv[i];
+        auto next = [&](const char *what) -> const char* {
+            if(i + 1 >= argc){ std::fprintf(stderr, "missing value for %s\n", what); return nullptr; }
+            return argv[++i];
+        };
+        const char *v = nullptr;
+        if(a == "--records"){ if(!(v = next("--records"))) return false; o.records = std::stoll(v); }
+        else if(a == "--ops"){ if(!(v = next("--ops"))) return false; o.ops = std::stoll(v); }
+        else if(a == "--scan-ops"){ if(!(v = next("--scan-ops"))) return false; o.scanOps = std::stoll(v); }
+        else if(a == "--batch"){ if(!(v = next("--batch"))) return false; o.batch = std::stoll(v); }
+        else if(a == "--index"){
+            if(!(v = next("--index"))) return false;
+            std::string list = v;
+            size_t pos = 0;
+            while(pos <= list.size()){
+                size_t comma = list.find(',', pos);
+                if(comma == std::string::npos) comma = list.size();
+                if(comma > pos) o.indexes.push_back(list.substr(pos, comma - pos));
+                pos = comma + 1;
+            }
+        }
+        else if(a == "--workloads"){ if(!(v = next("--workloads"))) return false; o.workloads = v; }
+        else if(a == "--file"){ if(!(v = next("--file"))) return false; o.file = v; }
+        else if(a == "--seed"){ if(!(v = next("--seed"))) return false; o.seed = (unsigned)std::stoul(v); }
+        else if(a == "--zipf"){ if(!(v = next("--zipf"))) return false; o.zipfTheta = std::stod(v); }
+        else if(a == "--durability"){
+            if(!(v = next("--durability"))) return false;
+            std::string d = v;
+            if(d == "none") o.durability = Wal::Durability::None;
+            else if(d == "commit") o.durability = Wal::Durability::OnCommit;
+            else if(d.compare(0, 7, "batched") == 0){
+                o.durability = Wal::Durability::Batched;
+                if(d.size() > 8 && d[7] == ':') o.batchMs = std::stoi(d.substr(8));
+            } else {
+                std::fprintf(stderr, "unknown durability '%s'\n", v);
+                return false;
+            }
+        }
+        else if(a == "--columns"){ o.columns = true; }
+        else if(a == "--threads"){ if(!(v = next("--threads"))) return false; o.threads = std::stoll(v); }
+        else if(a == "--readers"){ if(!(v = next("--readers"))) return false; o.readers = std::stoll(v); }
+        else if(a == "--verbose"){ o.verbose = true; }
+        else if(a == "--metrics"){ o.metrics = true; }
+        else {
+            std::fprintf(stderr,
+                "usage: %s [--records N] [--ops N] [--scan-ops N] [--batch N] [--workloads abcdef]\n"
+                "          [--file path] [--seed S] [--zipf theta] [--index name,cours,averageGrade]\n"
+                "          [--durability none|commit|batched[:ms]] [--columns] [--threads N]\n"
+                "          [--readers N] [--verbose] [--metrics]\n", argv[0]);
+            return false;
+        }
+    }
+    if(o.records < 1 || o.ops < 0 || o.scanOps < 0 || o.batch < 0 || o.threads < 0 || o.readers < 1){
+        std::fprintf(stderr, "record and operation counts must be positive\n");
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv){
+    Options o;
+    if(!parseArgs(argc, argv, o)) return 1;
+
+    // сообщения движка на каждый вызов - Debug; по умолчанию выводятся только предупреждения и ошибки
+    if(o.verbose) Log::setLevel(LogLevel::Debug);
+
+    std::mt19937_64 rng(o.seed);
+    Database db;
+    db.removeDB(o.file);
+    if(!db.create(o.file)){
+        std::fprintf(stderr, "cannot create %s\n", o.file.c_str());
+        return 1;
+    }
+    db.setDurability(o.durability, o.batchMs);
+    db.setScanThreads((size_t)o.threads);
+    if(o.columns && !db.setColumnStore(true)){
+        std::fprintf(stderr, "cannot enable the column store\n");
+        return 1;
+    }
+    for(const std::string &field: o.indexes){
+        if(!db.createIndex(field)){
+            std::fprintf(stderr, "cannot index field '%s'\n", field.c_str());
+            return 1;
+        }
+    }
+
+    std::printf("filedb_bench: %lld records, %lld ops per workload, zipf %.2f, file %s\n",
+                o.records, o.ops, o.zipfTheta, o.file.c_str());
+    if(o.columns) std::printf("column store on, %s kernels\n", ColumnStore::kernelName());
+    std::printf("%-22s %10s %12s %12s %12s %12s\n", "operation", "count", "ops/s", "p50 us", "p99 us", "max us");
+
+    std::string err;
+    if(o.batch > 0){
+        // --batch N: загрузка пакетами через addRecords, латентность - на пакет
+        long long batches = (o.records + o.batch - 1) / o.batch;
+        std::vector<std::string> errors;
+        Stats load = timeOps("load (addRecords)", batches, [&](long long b){
+            std::vector<Student> rows;
+            for(long long i = b * o.batch; i < std::min(o.records, (b + 1) * o.batch); i++){
+                rows.push_back(makeStudent((int)i, rng));
+            }
+            db.addRecords(rows, errors);
+        });
+        report(load);
+    } else {
+        Stats load = timeOps("load (addRecord)", o.records, [&](long long i){
+            db.addRecord(makeStudent((int)i, rng), err);
+        });
+        report(load);
+    }
+
+    long long nextId = o.records;
+    ZipfGenerator zipf(o.records, o.zipfTheta);
+    std::uniform_int_distribution<int> pct(0, 99);
+    // ранги Ципфа разбросаны по ключам, чтобы горячие ключи не шли подряд
+    auto hotId = [&]() -> int { return (int)((zipf.next(rng) * 2654435761ULL) % (unsigned long long)o.records); };
+    auto latestId = [&]() -> int {
+        long long back = zipf.next(rng);
+        return (int)std::max(0LL, nextId - 1 - back);
+    };
+    auto read = [&](int id){ db.searchByField("id", std::to_string(id)); };
+    auto update = [&](int id){
+        Student s = makeStudent(id, rng);
+        db.editRecordByKey(id, s);
+    };
+    auto insert = [&](){
+        int id = (int)nextId++;
+        db.addRecord(makeStudent(id, rng), err);
+    };
+
+    auto run = [&](const std::string &name, long long count, const std::function<void(long long)> &op){
+        Stats st = timeOps(name, count, op);
+        report(st);
+    };
+
+    for(char w: o.workloads){
+        switch(w){
+            case 'a':
+                run("workload a (50r/50u)", o.ops, [&](long long){
+                    if(pct(rng) < 50) read(hotId()); else update(hotId());
+                });
+                break;
+            case 'b':
+                run("workload b (95r/5u)", o.ops, [&](long long){
+                    if(pct(rng) < 95) read(hotId()); else update(hotId());
+                });
+                break;
+            case 'c':
+                run("workload c (100r)", o.ops, [&](long long){
+                    read(hotId());
+                });
+                break;
+            case 'd':
+                run("workload d (95rl/5i)", o.ops, [&](long long){
+                    if(pct(rng) < 95) read(latestId()); else insert();
+                });
+                break;
+            case 'e':
+                run("workload e (95s/5i)", o.scanOps, [&](long long i){
+                    if(pct(rng) < 95){
+                        if(i % 2 == 0) db.searchByField("cours", std::to_string(1 + (int)(rng() % 6)));
+                        else db.searchByField("name", "student_" + std::to_string((int)(rng() % 100000)));
+                    } else {
+                        insert();
+                    }
+                });
+                break;
+            case 'f':
+                run("workload f (50r/50rmw)", o.ops, [&](long long){
+                    int id = hotId();
+                    auto found = db.searchByField("id", std::to_string(id));
+                    if(pct(rng) < 50 && !found.empty()){
+                        Student s = found[0];
+                        s.averageGrade = std::min(5.0, s.averageGrade + 0.01);
+                        db.editRecordByKey(id, s);
+                    }
+                });
+                break;
+            default:
+                std::fprintf(stderr, "unknown workload '%c'\n", w);
+                return 1;
+        }
+    }
+
+    // точечные чтения из нескольких потоков делят блокировку базы; если писатель обновляет
+    // горячие ключи, они ждут только изменения в памяти, commit идёт вне блокировки
+    if(o.readers > 1){
+        std::vector<std::mt19937_64> readerRng;
+        std::vector<ZipfGenerator> readerZipf;
+        for(long long t = 0; t < o.readers; t++){
+            readerRng.emplace_back(o.seed + 1 + (unsigned)t);
+            readerZipf.emplace_back(o.records, o.zipfTheta);
+        }
+        auto parallelRead = [&](long long t, long long){
+            int id = (int)((readerZipf[(size_t)t].next(readerRng[(size_t)t]) * 2654435761ULL) % (unsigned long long)o.records);
+            db.searchByField("id", std::to_string(id));
+        };
+        std::string readersName = "workload c x" + std::to_string(o.readers);
+        Stats alone = timeParallel(readersName, o.readers, o.ops, parallelRead);
+        report(alone);
+
+        std::atomic<bool> stop{false};
+        std::thread writer([&]{
+            std::mt19937_64 wrng(o.seed + 1000);
+            ZipfGenerator wzipf(o.records, o.zipfTheta);
+            while(!stop){
+                int id = (int)((wzipf.next(wrng) * 2654435761ULL) % (unsigned long long)o.records);
+                db.editRecordByKey(id, makeStudent(id, wrng));
+            }
+        });
+        Stats mixed = timeParallel(readersName + " + writer", o.readers, o.ops, parallelRead);
+        stop = true;
+        writer.join();
+        report(mixed);
+    }
+
+    run("getAll", std::max(1LL, o.scanOps / 4), [&](long long){ db.getAll(); });
+    // курсор читает одно окно до первой строки; страницы по ключу продолжаются
+    // с последнего показанного id, поэтому дальние страницы стоят столько же, сколько первая
+    run("cursor first row", o.scanOps, [&](long long){ RecordCursor c = db.cursor(); c.next(); });
+    run("cursor full pass", std::max(1LL, o.scanOps / 4), [&](long long){
+        for(RecordCursor c = db.cursor(); c.next(); ) {}
+    });
+    run("getPageAfter (50)", o.scanOps, [&](long long){
+        db.getPageAfter((int)(rng() % (unsigned long long)nextId), 50);
+    });
+
+    // короткие диапазоны id идут по B+-дереву, диапазоны оценок - по индексу, если его включил --index
+    run("searchRange id (100)", o.scanOps, [&](long long){
+        int lo = (int)(rng() % (unsigned long long)nextId);
+        db.searchRange("id", std::to_string(lo), std::to_string(lo + 99));
+    });
+    run("searchRange grade", o.scanOps, [&](long long){
+        double lo = 2.0 + (double)(rng() % 250) / 100.0;
+        db.searchRange("averageGrade", std::to_string(lo), std::to_string(lo + 0.05));
+    });
+    // два условия за один проход (или по одному индексу с проверкой предиката)
+    Query twoFields = Query::parse("cours = 3 AND averageGrade >= 4.5");
+    run("search cours AND grade", o.scanOps, [&](long long){ db.search(twoFields); });
+    // статистика по курсам без условия берётся из поддерживаемых агрегатов,
+    // с условием считается прямо по отображённым записям
+    std::map<int, Aggregate> groups;
+    run("aggregate by cours", o.scanOps, [&](long long){ db.aggregateByCours("averageGrade", Query(), groups); });
+    Query upperCourses = Query::parse("cours >= 4");
+    run("aggregate cours >= 4", o.scanOps, [&](long long){ db.aggregateByCours("averageGrade", upperCourses, groups); });
+
+    std::string backupFile = o.file + ".bak";
+    run("backup", 1, [&](long long){ db.backup(backupFile); });
+    // после сотни обновлений дельта содержит только затронутые ими страницы
+    for(int i = 0; i < 100; i++){
+        int id = (int)(rng() % (unsigned long long)nextId);
+        db.editRecordByKey(id, makeStudent(id, rng));
+    }
+    db.save();
+    std::string deltaFile = backupFile + ".1";
+    run("backup incremental", 1, [&](long long){ db.backupIncremental(deltaFile); });
+    for(const char *ext: {"", ".idx", ".free", ".sidx", ".chain", ".1"}) std::remove((backupFile + ext).c_str());
+    for(const std::string &f: ColumnStore::files(backupFile + ".col")) std::remove(f.c_str());
+
+    run("deleteByField id", std::min(o.ops, nextId), [&](long long i){
+        db.deleteByField("id", std::to_string((int)((i * 2654435761ULL) % (unsigned long long)nextId)));
+    });
+
+    run("deleteByField cours", 1, [&](long long){
+        db.deleteByField("cours", std::to_string(1 + (int)(rng() % 6)));
+    });
+
+    run("deleteRange id", 1, [&](long long){
+        db.deleteRange("id", std::to_string(nextId / 2), std::to_string(nextId / 2 + nextId / 10));
+    });
+
+    run("compact", 1, [&](long long){ db.compact(); });
+
+    if(o.metrics) std::printf("%s\n", db.metricsJson().c_str());
+    db.removeDB(o.file);
+    return 0;
+}
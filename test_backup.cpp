@@ -0,0 +1,87 @@
+#include "TestUtil.h"
+#include "Log.h"
+#include <fstream>
+#include <iterator>
+
+// Полная копия и две инкрементальные восстанавливаются и сравниваются с живой базой;
+// дельты не по порядку и повреждённая дельта отвергаются.
+
+namespace {
+
+void testBackupRoundTrip(){
+    const std::string file = "test_backup.db", full = "test_backup_full.bak";
+    const std::string d1 = "test_backup_d1.bak", d2 = "test_backup_d2.bak", bad = "test_backup_bad.bak";
+    const std::string restored = "test_backup_full_restored.db";
+    testRemoveDb(file);
+    testRemoveDb(restored);
+
+    Database db;
+    CHECK(db.create(file));
+    CHECK(db.createIndex("cours"));
+    CHECK(db.setColumnStore(true));
+    testMutate(db, 0);
+    CHECK(db.backup(full));
+
+    testMutate(db, 20000);
+    CHECK(db.backupIncremental(d1));
+    std::vector<TestRow> atFirst = testRows(db);
+
+    testMutate(db, 40000);
+    db.deleteByField("cours", "3");
+    CHECK(db.backupIncremental(d2));
+    std::vector<TestRow> atSecond = testRows(db);
+
+    {
+        // карта изменений прежней базы с тем же именем не должна достаться восстановленной
+        std::ofstream(restored + ".bkmap", std::ios::binary | std::ios::trunc) << "stale";
+        Database r;
+        CHECK(r.restoreFromBackup(full, {d1}));
+        CHECK(testRows(r) == atFirst);
+        CHECK(r.checkIntegrity());
+        std::ifstream in(restored + ".bkmap", std::ios::binary);
+        std::string head;
+        in >> head;
+        CHECK(head != "stale");
+    }
+    {
+        Database r;
+        CHECK(r.restoreFromBackup(full, {d1, d2}));
+        CHECK(testRows(r) == atSecond);
+        CHECK(r.checkIntegrity());
+        CHECK(r.searchByField("cours", "3").empty());
+        CHECK(r.search(Query::parse("cours = 2")).size() == db.search(Query::parse("cours = 2")).size());
+    }
+    {
+        // дельты не по порядку и повреждённая дельта не принимаются
+        Database r;
+        CHECK(!r.restoreFromBackup(full, {d2}));
+        std::ifstream in(d2, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        bytes[bytes.size() / 2] ^= 0x5a;
+        std::ofstream(bad, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size());
+        CHECK(!r.restoreFromBackup(full, {d1, bad}));
+    }
+    {
+        // неудачное восстановление поверх открытой базы оставляет её открытой и целой
+        Database r;
+        CHECK(r.restoreFromBackup(full, {d1}));
+        CHECK(!r.restoreFromBackup(full, {d1, bad}));
+        CHECK(r.isOpen());
+        CHECK(testRows(r) == atFirst);
+        CHECK(!std::ifstream(restored + ".restore"));
+    }
+
+    db.close();
+    testRemoveDb(file);
+    testRemoveDb(restored);
+    testRemoveDb(full);
+    for(const std::string &f: {d1, d2, bad, full + ".chain"}) std::remove(f.c_str());
+}
+
+}
+
+int main(){
+    Log::setLevel(LogLevel::Error);
+    testBackupRoundTrip();
+    return testResult();
+}
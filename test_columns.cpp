@@ -0,0 +1,55 @@
+#include "TestUtil.h"
+#include "ColumnStore.h"
+#include "Log.h"
+#include <random>
+
+// Векторные фильтры колонок (SSE2, AVX2) сравниваются со скалярным на длинах вокруг
+// границ блоков и на случайных диапазонах, в том числе пустых.
+
+namespace {
+
+void testColumnKernels(){
+    std::mt19937 rng(7);
+    const ColumnStore::Kernel kernels[] = {ColumnStore::Kernel::Sse2, ColumnStore::Kernel::Avx2};
+    const size_t sizes[] = {0, 1, 63, 64, 65, 127, 1000, 4097};
+    for(ColumnStore::Kernel k: kernels){
+        if(!ColumnStore::setKernel(k)){
+            std::printf("column kernel %d not supported here, skipped\n", (int)k);
+            continue;
+        }
+        std::string name = ColumnStore::kernelName();
+        for(size_t n: sizes){
+            ColumnStore cols;
+            cols.setEnabled(true);
+            for(size_t i = 0; i < n; i++){
+                cols.put(i, (int)i, (int)(rng() % 7) - 1, (rng() % 60) / 10.0, rng() % 4 != 0);
+            }
+            for(int round = 0; round < 20; round++){
+                int clo = (int)(rng() % 8) - 2, chi = clo + (int)(rng() % 4) - 1;
+                double glo = (rng() % 60) / 10.0, ghi = glo + (rng() % 30) / 10.0 - 0.5;
+                std::vector<uint64_t> fast, slow;
+                ColumnStore::setKernel(k);
+                cols.selectCours(clo, chi, fast);
+                ColumnStore::setKernel(ColumnStore::Kernel::Scalar);
+                cols.selectCours(clo, chi, slow);
+                if(fast != slow) std::fprintf(stderr, "%s cours [%d, %d] differs at %zu rows\n", name.c_str(), clo, chi, n);
+                CHECK(fast == slow);
+                ColumnStore::setKernel(k);
+                cols.selectGrade(glo, ghi, fast);
+                ColumnStore::setKernel(ColumnStore::Kernel::Scalar);
+                cols.selectGrade(glo, ghi, slow);
+                if(fast != slow) std::fprintf(stderr, "%s grade [%g, %g] differs at %zu rows\n", name.c_str(), glo, ghi, n);
+                CHECK(fast == slow);
+            }
+        }
+    }
+    ColumnStore::setKernel(ColumnStore::Kernel::Auto);
+}
+
+}
+
+int main(){
+    Log::setLevel(LogLevel::Error);
+    testColumnKernels();
+    return testResult();
+}
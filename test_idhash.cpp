@@ -0,0 +1,50 @@
+#include "TestUtil.h"
+#include "IdHash.h"
+#include "Log.h"
+#include <random>
+#include <unordered_map>
+
+// Хеш-таблица id сравнивается с std::unordered_map на случайных вставках, удалениях
+// и поиске в узком диапазоне ключей.
+
+namespace {
+
+void testIdHash(){
+    std::mt19937 rng(11);
+    IdHash table;
+    std::unordered_map<int, uint32_t> model;
+    for(int i = 0; i < 200000; i++){
+        // узкий диапазон ключей заставляет удалять и снова занимать одни и те же ячейки
+        int id = (int)(rng() % 20000) - 10000;
+        uint32_t row;
+        switch(rng() % 4){
+            case 0:
+            case 1:
+                table.insert(id, (uint32_t)i);
+                model[id] = (uint32_t)i;
+                break;
+            case 2:
+                CHECK(table.erase(id) == (model.erase(id) == 1));
+                break;
+            default: {
+                auto it = model.find(id);
+                bool found = table.find(id, row);
+                CHECK(found == (it != model.end()));
+                if(found && it != model.end()) CHECK(row == it->second);
+            }
+        }
+    }
+    CHECK(table.size() == model.size());
+    for(auto &p: model){
+        uint32_t row = 0;
+        CHECK(table.find(p.first, row) && row == p.second);
+    }
+}
+
+}
+
+int main(){
+    Log::setLevel(LogLevel::Error);
+    testIdHash();
+    return testResult();
+}
@@ -0,0 +1,61 @@
+#include "TestUtil.h"
+#include "Log.h"
+#include <fstream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Восстановление по журналу: дочерний процесс меняет базу и завершается без close(),
+// после чего open() должен воспроизвести журнал и получить те же записи.
+
+namespace {
+
+bool crashChild(const std::string &file, bool create, int base){
+    pid_t pid = fork();
+    if(pid == 0){
+        Database db;
+        if(!(create ? db.create(file) : db.open(file))) _exit(2);
+        testMutate(db, base);
+        // без close(): в файле данных и индексе только то, что успело вытесниться
+        _exit(0);
+    }
+    int status = 0;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void testWalReplay(){
+    const std::string file = "test_wal.db";
+    testRemoveDb(file);
+    std::vector<TestRow> model;
+    CHECK(crashChild(file, true, 0));
+    testExpect(model, 0);
+    {
+        Database db;
+        CHECK(db.open(file));
+        CHECK(testRows(db) == model);
+        CHECK(db.checkIntegrity());
+    }
+
+    // оборванная запись в конце журнала отбрасывается, всё до неё воспроизводится
+    CHECK(crashChild(file, false, 10000));
+    testExpect(model, 10000);
+    {
+        std::ofstream wal(file + ".wal", std::ios::binary | std::ios::app);
+        const char junk[] = "\x40\x00\x00\x00torn";
+        wal.write(junk, sizeof(junk) - 1);
+    }
+    {
+        Database db;
+        CHECK(db.open(file));
+        CHECK(testRows(db) == model);
+        CHECK(db.checkIntegrity());
+    }
+    testRemoveDb(file);
+}
+
+}
+
+int main(){
+    Log::setLevel(LogLevel::Error);
+    testWalReplay();
+    return testResult();
+}